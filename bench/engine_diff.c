@@ -0,0 +1,800 @@
+// C引擎与C#引擎（jsondo.cs）的差异对比：按固定种子生成随机的文件和命令，比较两个引擎执行后的
+// 文件内容（逐字节），并给出双方的延迟和吞吐量。用法：
+//   engine_diff record [-n 用例数] [-s 种子] <结果文件> <C#命令...>   运行C#引擎，录制其结果（需要.NET）
+//   engine_diff check <结果文件>                                      按录制的结果检查C引擎，不需要.NET
+//   engine_diff live [-n 用例数] [-s 种子] <C#命令...>                直接与C#引擎对比，列出每个不一致的用例
+//   engine_diff dump [-s 种子] <用例> <目录>                         写出一个用例的f.txt和commands.json
+// C#命令如 dotnet bench/cs/out/jsondo_cs.dll，在临时目录中以 -f commands.json 执行，每个用例启动一次。
+// 用例只覆盖两个引擎行为相同的范围（见make_command）；C引擎的结果必须与C#逐字节相同，
+// 或符合KNOWN_DIFFERENCES中的一项，否则check、live、record返回1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "libjsondo.h"
+
+#define GOLDEN_VERSION 2
+#define DEFAULT_CASES 400
+#define DEFAULT_SEED 1
+#define CASE_FILE "f.txt"
+#define STARTUP_RUNS 5
+
+typedef struct {
+    int id;
+    const char* eol_name;         // "lf"、"crlf"或"mixed"
+    char* input;
+    size_t input_len;
+    uint64_t input_hash;
+    int lf_terminated;            // 只有\n换行且以换行结尾
+    int line_count;
+    cJSON* root;                  // {"commands": [...]}
+} Case;
+
+// 一次执行的结果：是否成功、执行后文件内容的哈希（原样及统一换行后）、耗时
+typedef struct {
+    int success;
+    uint64_t hash;
+    uint64_t norm_hash;
+    long long time_us;
+} Outcome;
+
+typedef enum {
+    VERDICT_SAME = 0,
+    VERDICT_KNOWN,                // 符合KNOWN_DIFFERENCES中的一项
+    VERDICT_DIVERGED
+} Verdict;
+
+// 已知且接受的差异：只有符合其中一项的用例允许与C#的结果不同
+typedef struct {
+    const char* name;
+    const char* description;
+    int (*applies)(const Case* c, const Outcome* cs, const Outcome* out);
+} KnownDifference;
+
+// C#写回文件时整个文件改为\n换行（按行替换时还总是以换行结尾），所以输入不是以换行结尾的纯\n文件时，
+// 只要求统一换行后的内容相同；C#没有修改文件时仍要求逐字节相同
+static int cs_rewrites_eol(const Case* c, const Outcome* cs, const Outcome* out) {
+    return cs->success == out->success && cs->hash != c->input_hash && !c->lf_terminated &&
+           cs->norm_hash == out->norm_hash;
+}
+
+static const KnownDifference KNOWN_DIFFERENCES[] = {
+    {"cs-rewrites-eol", "C# writes the whole file with \\n line endings", cs_rewrites_eol},
+};
+#define KNOWN_COUNT ((int)(sizeof(KNOWN_DIFFERENCES) / sizeof(KNOWN_DIFFERENCES[0])))
+
+typedef struct {
+    int cases;
+    int verdicts[3];
+    int known[KNOWN_COUNT];
+    size_t bytes;
+    long long* c_times;
+    long long* cs_times;
+    long long cs_startup_us;
+} Summary;
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// splitmix64，保证同一种子在各平台上生成相同的用例
+static uint64_t rng_next(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int rng_range(uint64_t* state, int n) {
+    return (n > 0) ? (int)(rng_next(state) % (uint64_t)n) : 0;
+}
+
+static uint64_t fnv1a(const char* data, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// 统一换行后的哈希：\r\n视为\n，忽略末尾的一个换行
+static uint64_t norm_hash(const char* data, size_t len) {
+    if (len > 0 && data[len - 1] == '\n') len--;
+    if (len > 0 && data[len - 1] == '\r') len--;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\r' && i + 1 < len && data[i + 1] == '\n') continue;
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// ---- 用例生成 ----
+
+static const char* WORDS[] = {"value", "count", "index", "buffer", "result", "line", "offset", "total"};
+static const char* INDENTS[] = {"", "", "    ", "        ", "\t", "  "};
+
+// 类似源代码的一行：含空行、只有括号的行、重复的行和行尾空白，覆盖两个引擎切分和比较行的差异
+static char* make_line(uint64_t* rng, char* lines[], int count) {
+    char text[128];
+    const char* indent = INDENTS[rng_range(rng, 6)];
+    const char* word = WORDS[rng_range(rng, 8)];
+    int n = rng_range(rng, 40);
+    switch (rng_range(rng, 10)) {
+    case 0:
+        text[0] = '\0';
+        break;
+    case 1:
+        snprintf(text, sizeof(text), "%s}", indent);
+        break;
+    case 2:
+        snprintf(text, sizeof(text), "%sif (%s > %d) {", indent, word, n);
+        break;
+    case 3:
+        snprintf(text, sizeof(text), "%s// %s %d ", indent, word, n);
+        break;
+    case 4:
+        if (count > 0) return strdup(lines[rng_range(rng, count)]);
+        // 第一行没有可重复的行
+        // fall through
+    case 5:
+        snprintf(text, sizeof(text), "%sreturn %s%d;", indent, word, n);
+        break;
+    default:
+        snprintf(text, sizeof(text), "%sint %s%d = %d;", indent, word, n, rng_range(rng, 1000));
+        break;
+    }
+    return strdup(text);
+}
+
+static char* join_lines(char* lines[], int from, int to) {
+    size_t len = 1;
+    for (int i = from; i < to; i++) len += strlen(lines[i]) + 1;
+    char* text = (char*)malloc(len);
+    size_t pos = 0;
+    for (int i = from; i < to; i++) {
+        size_t n = strlen(lines[i]);
+        memcpy(text + pos, lines[i], n);
+        pos += n;
+        if (i + 1 < to) text[pos++] = '\n';
+    }
+    text[pos] = '\0';
+    return text;
+}
+
+// min_lines~3行新内容：C#会去除new_str首尾的空白，所以首行不缩进、末行没有行尾空白，其余行约四分之一有缩进
+static char* make_new_text(uint64_t* rng, int id, int k, int min_lines) {
+    char text[256] = "";
+    int count = min_lines + rng_range(rng, 4 - min_lines);
+    size_t pos = 0;
+    for (int i = 0; i < count; i++) {
+        pos += snprintf(text + pos, sizeof(text) - pos, "%s%snew_%d_%d_%d();", (i > 0) ? "\n" : "",
+                        (i > 0 && rng_range(rng, 4) == 0) ? "    " : "", id, k, i);
+    }
+    return strdup(text);
+}
+
+// 去除首尾空白后不变的非空行（C#会去除old_str首尾的空白，只有这样的行可以作为旧文本的首行和末行）
+static int is_trim_stable(const char* line) {
+    size_t len = strlen(line);
+    return len > 0 && !isspace((unsigned char)line[0]) && !isspace((unsigned char)line[len - 1]);
+}
+
+// text在content中是否只出现一次
+static int is_unique(const char* content, const char* text) {
+    const char* found = strstr(content, text);
+    return found != NULL && strstr(found + 1, text) == NULL;
+}
+
+// 多条命令从文件末尾向前排列、互不重叠，使两个引擎的行号含义相同（C引擎按原始行号换算，C#引擎使用当前行号）。
+// C#在命令失败后继续执行后面的命令，所以只有最后一条命令（may_fail）可能失败：
+// 给出对不上的文本，或按内容替换时旧文本出现多次；content为以\n连接的全部行
+static cJSON* make_command(uint64_t* rng, char* lines[], int line_count, const char* content, int id, int k,
+                           int start, int span, int is_last_segment, int may_fail) {
+    cJSON* command = cJSON_CreateObject();
+    cJSON* args = cJSON_CreateObject();
+    cJSON_AddStringToObject(args, "file", CASE_FILE);
+
+    int by_content = rng_range(rng, 100) < 45 && is_trim_stable(lines[start]) && is_trim_stable(lines[start + span - 1]);
+    int mismatch = may_fail && rng_range(rng, 10) == 0;
+    char* old_text = by_content ? join_lines(lines, start, start + span) : NULL;
+    if (by_content && !may_fail && !is_unique(content, old_text)) {
+        free(old_text);
+        old_text = NULL;
+        by_content = 0;
+    }
+    if (by_content) {
+        char* new_text = make_new_text(rng, id, k, 0);
+        // 旧文本与文件不一致，走逐行查找及失败的路径
+        if (mismatch) {
+            char* changed = (char*)malloc(strlen(old_text) + 3);
+            sprintf(changed, "%s;;", old_text);
+            free(old_text);
+            old_text = changed;
+        }
+        cJSON_AddStringToObject(command, "call", "replace_by_content");
+        cJSON_AddStringToObject(args, "old_str", old_text);
+        cJSON_AddStringToObject(args, "new_str", new_text);
+        if (rng_range(rng, 2) == 0) cJSON_AddNumberToObject(args, "startLine", start + 1);
+        free(old_text);
+        free(new_text);
+    } else {
+        // C#按行替换时空的new_str会留下一个空行，所以至少一行新内容。
+        // 行号偏移时C#从起始标记后的第二行开始查找结束标记，并多替换一行，所以行号总是准确的
+        char* new_text = make_new_text(rng, id, k, 1);
+        int start_line = start + 1;
+        int end_line = start + span;
+        if (is_last_segment && start + span == line_count && rng_range(rng, 4) == 0) end_line = -1;
+        cJSON_AddStringToObject(command, "call", "replace_by_range");
+        cJSON_AddNumberToObject(args, "startLine", start_line);
+        cJSON_AddNumberToObject(args, "endLine", end_line);
+        cJSON_AddStringToObject(args, "startLine_str", mismatch ? "no such line;;" : lines[start]);
+        cJSON_AddStringToObject(args, "endLine_str", lines[start + span - 1]);
+        cJSON_AddStringToObject(args, "new_str", new_text);
+        free(new_text);
+    }
+    cJSON_AddItemToObject(command, "args", args);
+    return command;
+}
+
+static void make_case(uint64_t seed, int id, Case* c) {
+    uint64_t rng = seed * 1000003ULL + (uint64_t)id;
+    memset(c, 0, sizeof(*c));
+    c->id = id;
+
+    // 每16个用例中有一个大文件，用于比较吞吐量
+    int line_count = (id % 16 == 15) ? 50000 + rng_range(&rng, 100000) : 1 + rng_range(&rng, 400);
+    int eol_mode = rng_range(&rng, 10);
+    c->eol_name = (eol_mode < 6) ? "lf" : (eol_mode < 9) ? "crlf" : "mixed";
+    int trailing = rng_range(&rng, 100) < 85;
+
+    char** lines = (char**)malloc(line_count * sizeof(char*));
+    size_t len = 0;
+    for (int i = 0; i < line_count; i++) {
+        lines[i] = make_line(&rng, lines, i);
+        len += strlen(lines[i]) + 2;
+    }
+    c->input = (char*)malloc(len + 1);
+    size_t pos = 0;
+    for (int i = 0; i < line_count; i++) {
+        size_t n = strlen(lines[i]);
+        memcpy(c->input + pos, lines[i], n);
+        pos += n;
+        if (i + 1 == line_count && !trailing) break;
+        int crlf = (eol_mode >= 9) ? rng_range(&rng, 2) : (eol_mode >= 6);
+        if (crlf) c->input[pos++] = '\r';
+        c->input[pos++] = '\n';
+    }
+    c->input[pos] = '\0';
+    c->input_len = pos;
+    c->input_hash = fnv1a(c->input, pos);
+    c->lf_terminated = memchr(c->input, '\r', pos) == NULL && pos > 0 && c->input[pos - 1] == '\n';
+    c->line_count = line_count;
+
+    // 1~3条命令，文件按命令数分段，从最后一段开始各取一段
+    c->root = cJSON_CreateObject();
+    cJSON* commands = cJSON_AddArrayToObject(c->root, "commands");
+    int command_count = 1 + rng_range(&rng, 3);
+    if (command_count > line_count) command_count = line_count;
+    int segment = line_count / command_count;
+    char* content = join_lines(lines, 0, line_count);
+    for (int k = command_count - 1; k >= 0; k--) {
+        int seg_begin = k * segment;
+        int seg_end = (k == command_count - 1) ? line_count : seg_begin + segment;
+        int start = seg_begin + rng_range(&rng, seg_end - seg_begin);
+        int max_span = seg_end - start;
+        int span = 1 + rng_range(&rng, (max_span < 4) ? max_span : 4);
+        // C#不接受空的起止标记：区间的首行和末行移到非空行上，整段都是空行时不生成命令
+        while (start < seg_end && lines[start][0] == '\0') start++;
+        if (start == seg_end) continue;
+        if (span > seg_end - start) span = seg_end - start;
+        while (lines[start + span - 1][0] == '\0') span--;
+        cJSON_AddItemToArray(commands, make_command(&rng, lines, line_count, content, id, k, start, span,
+                                                    k == command_count - 1, k == 0));
+    }
+
+    free(content);
+    for (int i = 0; i < line_count; i++) free(lines[i]);
+    free(lines);
+}
+
+static void free_case(Case* c) {
+    free(c->input);
+    cJSON_Delete(c->root);
+}
+
+// ---- 执行 ----
+
+static void set_outcome(Outcome* out, int success, const char* data, size_t len, long long time_us) {
+    out->success = success;
+    out->hash = fnv1a(data, len);
+    out->norm_hash = norm_hash(data, len);
+    out->time_us = time_us;
+}
+
+// C引擎：通过libjsondo在内存缓冲区上执行，不读写磁盘
+static void run_c(const Case* c, Outcome* out, char** output, size_t* output_len) {
+    JsondoBuffer buffer = {CASE_FILE, c->input, c->input_len, NULL, 0};
+    long long started = now_us();
+    int success = jsondo_apply_json(c->root, &buffer, 1, NULL);
+    long long elapsed = now_us() - started;
+
+    const char* data = (buffer.output != NULL) ? buffer.output : c->input;
+    size_t len = (buffer.output != NULL) ? buffer.output_len : c->input_len;
+    set_outcome(out, success, data, len, elapsed);
+    if (output != NULL) {
+        *output = (char*)malloc(len + 1);
+        memcpy(*output, data, len + 1);
+        *output_len = len;
+    }
+    jsondo_free(buffer.output);
+}
+
+static int write_text(const char* path, const char* data, size_t len) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return 0;
+    int ok = fwrite(data, 1, len, file) == len;
+    return (fclose(file) == 0) && ok;
+}
+
+static char* read_text(const char* path, size_t* len) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)malloc(size + 1);
+    *len = fread(data, 1, size, file);
+    data[*len] = '\0';
+    fclose(file);
+    return data;
+}
+
+// 在work目录中执行C#引擎：cs_argv后加上 -f commands.json，返回退出码，无法启动时返回-1
+static int spawn_cs(char* const cs_argv[], int cs_argc, const char* work, long long* elapsed) {
+    char** argv = (char**)calloc(cs_argc + 3, sizeof(char*));
+    for (int i = 0; i < cs_argc; i++) argv[i] = cs_argv[i];
+    argv[cs_argc] = "-f";
+    argv[cs_argc + 1] = "commands.json";
+
+    long long started = now_us();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        if (chdir(work) != 0) _exit(127);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status = 0;
+    int waited = (pid > 0) && waitpid(pid, &status, 0) == pid;
+    *elapsed = now_us() - started;
+    free(argv);
+    if (!waited || !WIFEXITED(status) || WEXITSTATUS(status) == 127) return -1;
+    return WEXITSTATUS(status);
+}
+
+static int run_cs(char* const cs_argv[], int cs_argc, const char* work, const Case* c, long long startup_us,
+                  Outcome* out, char** output, size_t* output_len) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", work, CASE_FILE);
+    char command_path[512];
+    snprintf(command_path, sizeof(command_path), "%s/commands.json", work);
+    char* json = cJSON_Print(c->root);
+    int written = write_text(path, c->input, c->input_len) && write_text(command_path, json, strlen(json));
+    free(json);
+    if (!written) {
+        printf("Failed to write %s\n", work);
+        return 0;
+    }
+
+    long long elapsed = 0;
+    int code = spawn_cs(cs_argv, cs_argc, work, &elapsed);
+    if (code < 0) {
+        printf("Failed to run the C# engine: %s\n", cs_argv[0]);
+        return 0;
+    }
+    size_t len = 0;
+    char* data = read_text(path, &len);
+    if (data == NULL) {
+        data = strdup("");
+        len = 0;
+    }
+    elapsed -= startup_us;
+    set_outcome(out, code == 0, data, len, (elapsed > 0) ? elapsed : 0);
+    if (output != NULL) {
+        *output = data;
+        *output_len = len;
+    } else {
+        free(data);
+    }
+    return 1;
+}
+
+static int compare_times(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// C#引擎的启动时间：执行空命令文件若干次取中位数，之后从各用例的耗时中减去。
+// 空命令文件必须执行成功，否则（如找不到dll）各用例的失败都会被误认为C#引擎的结果
+static long long measure_cs_startup(char* const cs_argv[], int cs_argc, const char* work) {
+    char command_path[512];
+    snprintf(command_path, sizeof(command_path), "%s/commands.json", work);
+    long long times[STARTUP_RUNS];
+    for (int i = 0; i < STARTUP_RUNS; i++) {
+        const char* json = "{\"commands\": []}";
+        if (!write_text(command_path, json, strlen(json)) || spawn_cs(cs_argv, cs_argc, work, &times[i]) != 0) {
+            return -1;
+        }
+    }
+    qsort(times, STARTUP_RUNS, sizeof(long long), compare_times);
+    return times[STARTUP_RUNS / 2];
+}
+
+static void remove_work_dir(const char* work) {
+    const char* names[] = {CASE_FILE, "commands.json", ".jsondo/jsondo.lastbackup", ".jsondo/jsondo.lastApplied"};
+    char path[512];
+    for (int i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/%s", work, names[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/.jsondo", work);
+    rmdir(path);
+    rmdir(work);
+}
+
+// ---- 比较与报告 ----
+
+// 比较两个引擎的结果并计入summary
+static Verdict compare_outcomes(const Case* c, const Outcome* cs, const Outcome* out, Summary* s) {
+    Verdict verdict = VERDICT_DIVERGED;
+    if (cs->success == out->success && cs->hash == out->hash) {
+        verdict = VERDICT_SAME;
+    } else {
+        for (int i = 0; i < KNOWN_COUNT; i++) {
+            if (KNOWN_DIFFERENCES[i].applies(c, cs, out)) {
+                s->known[i]++;
+                verdict = VERDICT_KNOWN;
+                break;
+            }
+        }
+    }
+    s->verdicts[verdict]++;
+    return verdict;
+}
+
+static void print_case(const Case* c, const char* what, const Outcome* cs, const Outcome* out) {
+    char* json = cJSON_PrintUnformatted(cJSON_GetObjectItem(c->root, "commands"));
+    printf("  case %d (%s, %d lines): %s; C# %s, C %s\n", c->id, c->eol_name, c->line_count, what,
+           cs->success ? "applied" : "failed", out->success ? "applied" : "failed");
+    printf("    %.300s%s\n", json, (strlen(json) > 300) ? " ..." : "");
+    free(json);
+}
+
+// 显示一行（最多120字节），\r和TAB按转义显示
+static void print_escaped(const char* prefix, const char* text, size_t len, int at_end) {
+    printf("%s'", prefix);
+    for (size_t i = 0; i < len && i < 120; i++) {
+        if (text[i] == '\r') {
+            printf("\\r");
+        } else if (text[i] == '\t') {
+            printf("\\t");
+        } else {
+            putchar(text[i]);
+        }
+    }
+    printf("'%s\n", at_end ? " (end of file)" : "");
+}
+
+// 两个输出中第一处不同的行（按\n切分，含\r）
+static void print_first_difference(const char* a, size_t a_len, const char* b, size_t b_len) {
+    size_t i = 0, line_start = 0;
+    int line = 1;
+    while (i < a_len && i < b_len && a[i] == b[i]) {
+        if (a[i] == '\n') {
+            line++;
+            line_start = i + 1;
+        }
+        i++;
+    }
+    const char* a_end = memchr(a + line_start, '\n', a_len - line_start);
+    const char* b_end = memchr(b + line_start, '\n', b_len - line_start);
+    size_t a_n = (a_end != NULL) ? (size_t)(a_end - a) - line_start : a_len - line_start;
+    size_t b_n = (b_end != NULL) ? (size_t)(b_end - b) - line_start : b_len - line_start;
+    printf("    first difference at LN-%d:\n", line);
+    print_escaped("    - C#: ", a + line_start, a_n, line_start >= a_len);
+    print_escaped("    + C:  ", b + line_start, b_n, line_start >= b_len);
+}
+
+static void print_latency(const char* name, long long* times, int count, size_t bytes, const char* note) {
+    if (count == 0) return;
+    qsort(times, count, sizeof(long long), compare_times);
+    long long total = 0;
+    for (int i = 0; i < count; i++) total += times[i];
+    double mb_per_s = (total > 0) ? (double)bytes / (double)total : 0;
+    printf("  %-4s %10.3f %10.3f %10.3f %10.1f   %s\n", name, times[count / 2] / 1000.0,
+           times[(count * 95) / 100] / 1000.0, times[count - 1] / 1000.0, mb_per_s, note);
+}
+
+static void print_summary(const Summary* s) {
+    printf("\n%d cases, %.1f MB: %d identical, %d known differences, %d diverged\n", s->cases,
+           s->bytes / 1048576.0, s->verdicts[VERDICT_SAME], s->verdicts[VERDICT_KNOWN], s->verdicts[VERDICT_DIVERGED]);
+    for (int i = 0; i < KNOWN_COUNT; i++) {
+        printf("  %-16s %5d   %s\n", KNOWN_DIFFERENCES[i].name, s->known[i], KNOWN_DIFFERENCES[i].description);
+    }
+    printf("\n  %-4s %10s %10s %10s %10s\n", "", "p50 ms", "p95 ms", "max ms", "MB/s");
+    print_latency("C", s->c_times, s->cases, s->bytes, "in-process (libjsondo, memory buffers)");
+    char note[128];
+    snprintf(note, sizeof(note), "one process per case, startup %.1f ms subtracted", s->cs_startup_us / 1000.0);
+    print_latency("C#", s->cs_times, s->cases, s->bytes, note);
+}
+
+static void parse_options(int argc, char* argv[], int* next, int* cases, uint64_t* seed) {
+    while (*next + 1 < argc) {
+        if (strcmp(argv[*next], "-n") == 0) {
+            *cases = atoi(argv[*next + 1]);
+        } else if (strcmp(argv[*next], "-s") == 0) {
+            *seed = strtoull(argv[*next + 1], NULL, 10);
+        } else {
+            break;
+        }
+        *next += 2;
+    }
+}
+
+static void print_usage(void) {
+    printf("Usage: engine_diff record [-n cases] [-s seed] <golden_file> <C# command...>\n");
+    printf("       engine_diff check <golden_file>\n");
+    printf("       engine_diff live [-n cases] [-s seed] <C# command...>\n");
+    printf("       engine_diff dump [-s seed] <case> <dir>\n");
+    printf("The C# command is run as '<command> -f commands.json', e.g. dotnet bench/cs/out/jsondo_cs.dll\n");
+}
+
+// C#引擎在临时目录中执行：命令中含'/'的相对路径（如bench/cs/out/jsondo_cs.dll）先转换为绝对路径
+static char** resolve_cs_argv(char* cs_argv[], int cs_argc) {
+    char** resolved = (char**)calloc(cs_argc + 1, sizeof(char*));
+    for (int i = 0; i < cs_argc; i++) {
+        char* absolute = NULL;
+        if (cs_argv[i][0] != '/' && strchr(cs_argv[i], '/') != NULL) absolute = realpath(cs_argv[i], NULL);
+        resolved[i] = (absolute != NULL) ? absolute : strdup(cs_argv[i]);
+    }
+    return resolved;
+}
+
+static void free_cs_argv(char** cs_argv, int cs_argc) {
+    for (int i = 0; i < cs_argc; i++) free(cs_argv[i]);
+    free(cs_argv);
+}
+
+// record和live：逐个用例运行两个引擎；record写出录制结果
+static int run_against_cs(int cases, uint64_t seed, const char* golden_path, char* cs_argv[], int cs_argc) {
+    char work[] = "/tmp/engine_diff.XXXXXX";
+    if (mkdtemp(work) == NULL) {
+        printf("Failed to create a work directory\n");
+        return 1;
+    }
+    Summary s = {0};
+    s.cases = cases;
+    s.c_times = (long long*)calloc(cases, sizeof(long long));
+    s.cs_times = (long long*)calloc(cases, sizeof(long long));
+    s.cs_startup_us = measure_cs_startup(cs_argv, cs_argc, work);
+    if (s.cs_startup_us < 0) {
+        printf("The C# engine failed on an empty command file:");
+        for (int i = 0; i < cs_argc; i++) printf(" %s", cs_argv[i]);
+        printf("\n");
+        remove_work_dir(work);
+        free(s.c_times);
+        free(s.cs_times);
+        return 1;
+    }
+
+    // 录制结果先写入临时文件，全部用例执行完成后才替换原有的结果文件
+    FILE* golden = NULL;
+    char golden_tmp[512];
+    if (golden_path != NULL) {
+        snprintf(golden_tmp, sizeof(golden_tmp), "%s.tmp", golden_path);
+        golden = fopen(golden_tmp, "w");
+        if (golden == NULL) {
+            printf("Failed to write %s\n", golden_tmp);
+            remove_work_dir(work);
+            free(s.c_times);
+            free(s.cs_times);
+            return 1;
+        }
+        fprintf(golden, "# engine_diff v%d seed=%llu cases=%d startup_us=%lld\n", GOLDEN_VERSION,
+                (unsigned long long)seed, cases, s.cs_startup_us);
+        fprintf(golden, "# case\tcs_ok\tcs_hash\tcs_norm_hash\tcs_us\n");
+    }
+
+    int failed = 0;
+    for (int i = 0; i < cases && !failed; i++) {
+        Case c;
+        make_case(seed, i, &c);
+        Outcome cs = {0}, out = {0};
+        char* cs_output = NULL;
+        char* c_output = NULL;
+        size_t cs_len = 0, c_len = 0;
+        if (!run_cs(cs_argv, cs_argc, work, &c, s.cs_startup_us, &cs, &cs_output, &cs_len)) {
+            failed = 1;
+        } else {
+            run_c(&c, &out, &c_output, &c_len);
+            s.bytes += c.input_len;
+            s.c_times[i] = out.time_us;
+            s.cs_times[i] = cs.time_us;
+            if (compare_outcomes(&c, &cs, &out, &s) == VERDICT_DIVERGED) {
+                print_case(&c, "diverged", &cs, &out);
+                print_first_difference(cs_output, cs_len, c_output, c_len);
+            }
+            if (golden != NULL) {
+                fprintf(golden, "%d\t%d\t%016llx\t%016llx\t%lld\n", i, cs.success,
+                        (unsigned long long)cs.hash, (unsigned long long)cs.norm_hash, cs.time_us);
+            }
+        }
+        free(cs_output);
+        free(c_output);
+        free_case(&c);
+    }
+    remove_work_dir(work);
+    if (golden != NULL) {
+        if (fclose(golden) != 0 && !failed) {
+            printf("Failed to write %s\n", golden_tmp);
+            failed = 1;
+        }
+        if (failed) {
+            unlink(golden_tmp);
+        } else if (rename(golden_tmp, golden_path) != 0) {
+            printf("Failed to write %s\n", golden_path);
+            unlink(golden_tmp);
+            failed = 1;
+        }
+    }
+
+    if (!failed) {
+        print_summary(&s);
+        if (golden_path != NULL) printf("\nRecorded %d cases into %s\n", cases, golden_path);
+    }
+    free(s.c_times);
+    free(s.cs_times);
+    return (failed || s.verdicts[VERDICT_DIVERGED] > 0) ? 1 : 0;
+}
+
+// check：按录制时的种子重新生成用例，只运行C引擎，与录制的C#结果比较
+static int check_golden(const char* golden_path) {
+    FILE* golden = fopen(golden_path, "r");
+    if (golden == NULL) {
+        printf("Failed to read %s\n", golden_path);
+        return 1;
+    }
+    int version = 0, cases = 0;
+    unsigned long long seed = 0;
+    long long startup_us = 0;
+    char line[512];
+    if (fgets(line, sizeof(line), golden) == NULL ||
+        sscanf(line, "# engine_diff v%d seed=%llu cases=%d startup_us=%lld", &version, &seed, &cases, &startup_us) != 4 ||
+        version != GOLDEN_VERSION || cases <= 0) {
+        printf("Invalid golden file: %s\n", golden_path);
+        fclose(golden);
+        return 1;
+    }
+
+    Summary s = {0};
+    s.cases = cases;
+    s.cs_startup_us = startup_us;
+    s.c_times = (long long*)calloc(cases, sizeof(long long));
+    s.cs_times = (long long*)calloc(cases, sizeof(long long));
+    int read = 0;
+    int valid = 1;
+    while (valid && fgets(line, sizeof(line), golden) != NULL) {
+        if (line[0] == '#') continue;
+        int id = 0, cs_ok = 0;
+        unsigned long long cs_hash = 0, cs_norm = 0;
+        long long cs_us = 0;
+        if (sscanf(line, "%d\t%d\t%llx\t%llx\t%lld", &id, &cs_ok, &cs_hash, &cs_norm, &cs_us) != 5 ||
+            id != read || id >= cases) {
+            valid = 0;
+            break;
+        }
+
+        Case c;
+        make_case(seed, id, &c);
+        Outcome cs = {cs_ok, cs_hash, cs_norm, cs_us};
+        Outcome out = {0};
+        run_c(&c, &out, NULL, NULL);
+        s.bytes += c.input_len;
+        s.c_times[id] = out.time_us;
+        s.cs_times[id] = cs_us;
+        if (compare_outcomes(&c, &cs, &out, &s) == VERDICT_DIVERGED) {
+            print_case(&c, "diverged", &cs, &out);
+        }
+        free_case(&c);
+        read++;
+    }
+    fclose(golden);
+    if (!valid || read != cases) {
+        printf("Invalid golden file: %s (case %d)\n", golden_path, read);
+        free(s.c_times);
+        free(s.cs_times);
+        return 1;
+    }
+
+    print_summary(&s);
+    free(s.c_times);
+    free(s.cs_times);
+    return (s.verdicts[VERDICT_DIVERGED] > 0) ? 1 : 0;
+}
+
+// dump：写出一个用例的输入文件和命令文件，便于手工复现差异
+static int dump_case(uint64_t seed, int id, const char* dir) {
+    Case c;
+    make_case(seed, id, &c);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, CASE_FILE);
+    int written = write_text(path, c.input, c.input_len);
+    snprintf(path, sizeof(path), "%s/commands.json", dir);
+    char* json = cJSON_Print(c.root);
+    written = written && write_text(path, json, strlen(json));
+    free(json);
+    free_case(&c);
+    if (!written) {
+        printf("Failed to write %s\n", dir);
+        return 1;
+    }
+    printf("Case %d written to %s/%s and %s/commands.json\n", id, dir, CASE_FILE, dir);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        print_usage();
+        return 1;
+    }
+    int cases = DEFAULT_CASES;
+    uint64_t seed = DEFAULT_SEED;
+    int next = 2;
+
+    if (strcmp(argv[1], "check") == 0 && argc == 3) {
+        return check_golden(argv[2]);
+    } else if (strcmp(argv[1], "record") == 0) {
+        parse_options(argc, argv, &next, &cases, &seed);
+        if (argc - next < 2 || cases <= 0) {
+            print_usage();
+            return 1;
+        }
+        char** cs_argv = resolve_cs_argv(argv + next + 1, argc - next - 1);
+        int code = run_against_cs(cases, seed, argv[next], cs_argv, argc - next - 1);
+        free_cs_argv(cs_argv, argc - next - 1);
+        return code;
+    } else if (strcmp(argv[1], "dump") == 0) {
+        parse_options(argc, argv, &next, &cases, &seed);
+        if (argc - next != 2) {
+            print_usage();
+            return 1;
+        }
+        return dump_case(seed, atoi(argv[next]), argv[next + 1]);
+    } else if (strcmp(argv[1], "live") == 0) {
+        parse_options(argc, argv, &next, &cases, &seed);
+        if (argc - next < 1 || cases <= 0) {
+            print_usage();
+            return 1;
+        }
+        char** cs_argv = resolve_cs_argv(argv + next, argc - next);
+        int code = run_against_cs(cases, seed, NULL, cs_argv, argc - next);
+        free_cs_argv(cs_argv, argc - next);
+        return code;
+    }
+    print_usage();
+    return 1;
+}
@@ -0,0 +1,118 @@
+// 行扫描内核基准：生成随机长度的行（含空行和\r\n），比较各指令集版本的吞吐量，
+// 并检查各版本的结果一致。用法：scan_bench [MB]，默认256MB
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// libjsondo.c中的内部接口
+const char* scan_kernel_name(void);
+int scan_kernel_use(const char* name);
+size_t scan_count_newlines(const char* data, size_t len);
+size_t scan_count_eol(const char* data, size_t len, int prev_cr, size_t* crlfs);
+size_t scan_line_starts(const char* data, size_t len, size_t* starts);   // starts需多留4项
+const char* scan_nth_newline(const char* data, size_t len, size_t n, size_t* seen);
+size_t scan_compact_crlf(char* dst, const char* src, size_t len);
+
+#define REPEAT 5
+
+typedef struct {
+    size_t newlines;
+    size_t crlfs;
+    size_t starts_sum;
+    size_t nth_offset;
+    size_t compact_len;
+} BenchResult;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 行长0~119字节，约四分之一的行以\r\n结尾
+static char* make_data(size_t len) {
+    char* data = (char*)malloc(len);
+    if (data == NULL) return NULL;
+    unsigned int seed = 12345;
+    size_t pos = 0;
+    while (pos < len) {
+        seed = seed * 1103515245 + 12345;
+        size_t line = (seed >> 16) % 120;
+        for (size_t i = 0; i < line && pos < len; i++) data[pos++] = 'a' + (i % 26);
+        if (pos < len && ((seed >> 8) & 3) == 0) data[pos++] = '\r';
+        if (pos < len) data[pos++] = '\n';
+    }
+    return data;
+}
+
+static void report(const char* kernel, const char* test, size_t len, double seconds) {
+    printf("  %-8s %-14s %8.2f GB/s\n", kernel, test, len / seconds / 1e9);
+}
+
+static void run(const char* kernel, const char* data, size_t len, size_t* starts, char* buffer,
+                BenchResult* result) {
+    double best[4] = {1e9, 1e9, 1e9, 1e9};
+    for (int r = 0; r < REPEAT; r++) {
+        double t0 = now_seconds();
+        result->newlines = scan_count_eol(data, len, 0, &result->crlfs);
+        double t1 = now_seconds();
+        size_t count = scan_line_starts(data, len, starts);
+        double t2 = now_seconds();
+        size_t seen = 0;
+        const char* nl = scan_nth_newline(data, len, result->newlines - 1, &seen);
+        double t3 = now_seconds();
+        result->compact_len = scan_compact_crlf(buffer, data, len);
+        double t4 = now_seconds();
+
+        result->starts_sum = count;
+        for (size_t i = 0; i < count; i += 4099) result->starts_sum += starts[i];
+        result->nth_offset = (nl != NULL) ? (size_t)(nl - data) : 0;
+        double times[4] = {t1 - t0, t2 - t1, t3 - t2, t4 - t3};
+        for (int i = 0; i < 4; i++) {
+            if (times[i] < best[i]) best[i] = times[i];
+        }
+    }
+    report(kernel, "count_eol", len, best[0]);
+    report(kernel, "line_starts", len, best[1]);
+    report(kernel, "nth_newline", len, best[2]);
+    report(kernel, "compact_crlf", len, best[3]);
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = (argc > 1) ? (size_t)atol(argv[1]) : 256;
+    size_t len = megabytes * 1024 * 1024;
+    char* data = (len > 0) ? make_data(len) : NULL;
+    size_t* starts = (data != NULL) ? (size_t*)malloc((scan_count_newlines(data, len) + 4) * sizeof(size_t)) : NULL;
+    char* buffer = (char*)malloc(len);
+    if (data == NULL || starts == NULL || buffer == NULL) {
+        printf("Failed to allocate %zu MB\n", megabytes);
+        return 1;
+    }
+
+    printf("Scan kernels on %zu MB (default: %s)\n", megabytes, scan_kernel_name());
+    const char* kernels[] = {"scalar", "sse2", "avx2"};
+    BenchResult expected = {0};
+    int have_expected = 0;
+    int mismatch = 0;
+    for (int i = 0; i < 3; i++) {
+        if (!scan_kernel_use(kernels[i])) {
+            printf("  %-8s not supported on this CPU\n", kernels[i]);
+            continue;
+        }
+        BenchResult result = {0};
+        run(kernels[i], data, len, starts, buffer, &result);
+        if (!have_expected) {
+            expected = result;
+            have_expected = 1;
+        } else if (memcmp(&expected, &result, sizeof(result)) != 0) {
+            printf("  %-8s MISMATCH\n", kernels[i]);
+            mismatch = 1;
+        }
+    }
+
+    free(data);
+    free(starts);
+    free(buffer);
+    return mismatch;
+}
@@ -139,6 +139,7 @@ namespace json_do
         /// <returns>返回0表示成功，非0表示失败</returns>
         private static int eval_command(string jsonContent, string commandFile)
         {
+            bool success = true;
             try
             {
                 // 解析JSON文档
@@ -149,10 +150,9 @@ namespace json_do
                 if (commandsArray == null)
                 {
                     Console.WriteLine("Invalid JSON format: missing or invalid 'commands' array");
-                    return;
+                    return 1;
                 }
 
-                bool success = true;
                 foreach (var commandElement in commandsArray)
                 {
                     // 获取工具名称
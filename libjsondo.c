@@ -0,0 +1,6885 @@
+#define _GNU_SOURCE   // F_OFD_SETLKW
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/inotify.h>
+#endif
+#include "libjsondo.h"
+
+#define MAX_PATH_LEN 1024
+#define MAX_STR_LEN 65536
+#define MAX_LINES 10000
+#define MAX_LINE_LEN 4096
+#define MAX_COMMANDS 100
+#define MAX_SEARCH_MARGIN 50
+#define IO_RING_ENTRIES 64
+#define WATCH_CACHE_LIMIT (256u * 1024 * 1024)
+#define PARALLEL_SEARCH_MIN (16u * 1024 * 1024)   // 小于该大小的文件单线程查找
+#define PARALLEL_CHUNK_MIN (1u * 1024 * 1024)
+#define PARALLEL_MAX_THREADS 32
+#define LOCK_DIR ".jsondo/locks"
+#define RUNS_DIR ".jsondo/runs"
+#define RUNS_KEEP_DEFAULT 20          // 默认保留最近的运行目录数
+#define RUNS_PRUNE_MIN_AGE 60         // 秒，更新的运行目录可能仍在写入，不清理
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_IO_URING 1
+#endif
+
+// 结构体定义
+typedef struct {
+    char call[64];
+    char* args;  // JSON字符串格式的参数
+} Command;
+
+// 文本参数：指向命令中的原始文本（不复制），
+// 执行计划中还带有预先切分好的行及每行的哈希
+typedef struct {
+    const char* text;
+    char** lines;                // 为NULL时由执行函数按需切分
+    int line_count;
+    const uint64_t* line_hashes;
+} TextArg;
+
+// old_file等参数指向的文件：以私有可写方式映射，映射长度至少比文件多1字节，末尾总有\0
+typedef struct {
+    char* data;
+    size_t len;
+    size_t map_len;
+} MappedText;
+
+typedef struct {
+    char file[MAX_PATH_LEN];
+    TextArg old_str;
+    TextArg new_str;
+    int startLine;
+    int backward_scan_limit;
+    int forward_scan_limit;
+} ReplaceByContentArgs;
+
+typedef struct {
+    char file[MAX_PATH_LEN];
+    int startLine;
+    int endLine;
+    TextArg new_str;
+    TextArg startLine_str;
+    TextArg endLine_str;
+    int backward_scan_limit;
+    int forward_scan_limit;
+    char* new_str_buffer;        // 去除首尾空白后的new_str副本
+} ReplaceByLinesArgs;
+
+typedef struct {
+    char file[MAX_PATH_LEN];
+    TextArg header;              // 块的开头（如函数签名），可以有多行，逐行去除首尾空白后比较
+    TextArg new_str;             // 替换整个块（含开头）的新内容
+    int startLine;               // 可选，开头有多处匹配时取离该行最近的一处
+} ReplaceBlockArgs;
+
+// apply_patch：一个补丁可以修改多个文件，执行时按文件展开，每个文件的全部hunk作为一条命令执行
+typedef struct {
+    char file[MAX_PATH_LEN];     // 展开后当前文件段的目标文件
+    TextArg patch;               // 统一格式补丁的全文
+    size_t patch_len;
+    size_t section_begin;        // 当前文件段的hunk在补丁中的起止偏移
+    size_t section_end;
+    int hunk_count;
+    int strip;                   // 去掉路径中的目录层数，与patch -p相同，默认1
+    int backward_scan_limit;
+    int forward_scan_limit;
+} ApplyPatchArgs;
+
+// 补丁中一个文件的部分
+typedef struct {
+    char path[MAX_PATH_LEN];
+    size_t begin;
+    size_t end;
+    int hunk_count;
+    int create;                  // --- /dev/null
+    int remove;                  // +++ /dev/null
+    int error_line;
+} PatchSection;
+
+// insert_lines、delete_lines、append：经行号索引直接定位，只读取并校验guard给出的几行，
+// 其余内容按原始字节拼接，不切分整个文件
+typedef struct {
+    char file[MAX_PATH_LEN];
+    int startLine;               // insert_lines：插入后新内容的第一行，-1表示文件末尾；delete_lines：删除的第一行
+    int endLine;                 // delete_lines：删除的最后一行，-1表示到文件末尾
+    TextArg new_str;             // insert_lines、append插入的内容
+    TextArg guard;               // 可选：插入位置之前的行，或被删除的开头几行
+    int backward_scan_limit;     // guard不在给定位置时的查找范围
+    int forward_scan_limit;
+} LineEditArgs;
+
+typedef enum {
+    CALL_REPLACE_BY_CONTENT = 1,
+    CALL_REPLACE_BY_RANGE = 2,
+    CALL_REPLACE_BLOCK = 3,
+    CALL_APPLY_PATCH = 4,
+    CALL_INSERT_LINES = 5,
+    CALL_DELETE_LINES = 6,
+    CALL_APPEND = 7
+} CallType;
+
+// 解析后的单条命令，来源可以是JSON命令文件或编译后的执行计划
+typedef struct {
+    CallType call;
+    int index;                   // 在命令文件或执行计划中的序号
+    const char* title;
+    union {
+        ReplaceByContentArgs content;
+        ReplaceByLinesArgs range;
+        ReplaceBlockArgs block;
+        ApplyPatchArgs patch;
+        LineEditArgs lines;
+    } args;
+    char** plan_lines[4];        // 从执行计划加载时分配的行指针数组
+    MappedText payloads[4];      // old_file、new_file、startLine_file、endLine_file（guard_file）映射的文件，下标与plan_lines相同
+} CommandSpec;
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} ByteBuffer;
+
+// 执行结果输出：默认输出给人阅读的文本；--output jsonl时每条命令输出一行JSON记录，
+// 命令执行期间的文本消息收集到记录的message字段，记录在每个批次结束时统一写出
+typedef struct {
+    int jsonl;
+    const char* source;     // 当前批次的命令文件或执行计划
+    ByteBuffer out;
+    ByteBuffer message;
+    int applied;
+    int skipped;
+    int failed;
+    long long started_us;
+    int capture;            // 库接口调用：不输出，消息和命令结果收集到result
+    JsondoResult* result;
+} ReportState;
+
+// 每个线程独立，不同线程可以同时通过库接口编辑各自的缓冲区
+static __thread ReportState report_state;
+
+// 行表：记录原始缓冲区中每一行的起始偏移，不复制内容
+typedef struct {
+    const char* data;
+    size_t len;
+    size_t* starts;
+    int count;
+    int crlf_count;  // 以\r\n结尾的行数，用于推断默认换行风格
+    const char* default_eol;  // 只切分了部分行时，由调用者给出整个文件的默认换行风格
+} LineTable;
+
+// 单次编辑的结果，行号为编辑发生时的当前行号（从1开始）
+typedef struct {
+    int line;
+    int deleted;
+    int inserted;
+} EditResult;
+
+// 行号偏移表：以命令文件中的原始行号为下标，用Fenwick树累计之前编辑造成的行数变化
+typedef struct {
+    int* tree;
+    int* points;      // 各位置的单点增量，扩容时用于重建tree
+    int size;
+    int abs_total;    // 所有增量绝对值与已删除行数之和，用于限定反查范围
+    int* dead;        // 已删除的原始行区间[begin, end)，按begin排序且互不重叠（每项两个int）
+    int dead_count;
+    int dead_capacity;
+} LineDeltaMap;
+
+// 大文件分块并行查找：各线程按顺序领取分块，分块只负责起点落在其范围内的匹配
+// （查找时向后多读2倍模式长度，覆盖\r\n规范化后跨越分块边界的匹配）；
+// 结果取有匹配的最小分块，与单线程查找完全一致
+typedef struct {
+    const char* data;
+    size_t len;
+    size_t from;
+    const char* pattern;      // 为NULL时统计各分块的换行符数量
+    size_t pattern_len;
+    size_t chunk_size;
+    int chunk_count;
+    int next_chunk;           // 下一个待领取的分块（原子递增）
+    int best_chunk;           // 已找到匹配的最小分块，其后的分块不再查找
+    size_t* results;          // 各分块的匹配位置（无匹配为SIZE_MAX）或换行符数量
+    size_t* matched_lens;
+} ChunkSearch;
+
+// 账本记录：每条成功执行的命令一条，用于重放时识别已经执行过的命令
+typedef struct {
+    uint64_t key;         // hash(目标路径, 执行前内容哈希, 命令)
+    uint64_t path_hash;
+    uint64_t pre_hash;    // 执行前的文件状态
+    uint64_t post_hash;   // 执行后的文件状态
+    int32_t line;         // 编辑结果，跳过命令时用于换算后续命令的行号
+    int32_t deleted;
+    int32_t inserted;
+    int32_t reserved;
+} LedgerRecord;
+
+#define LEDGER_MAGIC "JSDOLDGR"
+#define LEDGER_VERSION 1
+#define LEDGER_PATH ".jsondo/jsondo.ledger"
+#define LEDGER_COMPACT_LIMIT 100000  // 账本记录数超过该值时只保留最新的一半
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} LedgerHeader;
+
+// 账本：.jsondo/jsondo.ledger 中的全部记录及其索引，新记录在写回文件前追加（预写）
+typedef struct {
+    LedgerRecord* records;
+    int count;
+    int capacity;
+    int* by_key;          // 开放寻址：key -> 记录下标+1
+    int* by_post;         // 开放寻址：hash(path_hash, post_hash) -> 记录下标+1
+    int index_capacity;
+    int committed;        // 已写入账本文件的记录数
+    int indexed;          // 已加入索引的记录数，其后的记录在批次写回时补全执行后状态再加入
+    int disabled;
+} Ledger;
+
+// 行号索引：每隔LINE_INDEX_STRIDE行记录一次行首偏移，以及整个文件的换行符统计；
+// 设置JSONDO_INDEX=on时保存在.jsondo/index/中，供下次执行直接定位到扫描窗口
+#define LINE_INDEX_MAGIC "JSDOLIDX"
+#define LINE_INDEX_VERSION 1
+#define LINE_INDEX_STRIDE 1024
+#define LINE_INDEX_DIR ".jsondo/index"
+
+typedef struct {
+    int64_t line;         // 行下标（从0开始）
+    uint64_t offset;      // 该行的起始字节偏移
+} LineIndexEntry;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t stride;
+    uint64_t size;        // 以下为建立索引时的文件状态，加载时用于校验
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t hash;        // 文件内容哈希（hash_content）
+    int64_t newline_count;
+    int64_t crlf_count;
+    int64_t entry_count;
+} LineIndexHeader;
+
+typedef struct {
+    LineIndexHeader header;
+    LineIndexEntry* entries;
+    int64_t capacity;
+    int dirty;            // 需要写回索引文件
+} LineIndex;
+
+typedef struct IoRing IoRing;
+typedef struct FileStateTable FileStateTable;
+
+typedef enum {
+    FILE_UNLOADED = 0,
+    FILE_QUEUED,      // 已加入预读队列，尚未提交
+    FILE_PENDING,     // 预读已提交，等待完成
+    FILE_LOADED,
+    FILE_MISSING,
+    FILE_FAILED
+} FileLoadStatus;
+
+// 批量执行期间每个目标文件的状态：行号偏移与文件内容缓存，
+// 编辑结果先保存在内存中，批次结束时统一写回
+typedef struct {
+    char* path;
+    LineDeltaMap deltas;
+    FileLoadStatus status;
+    char* content;        // 当前内容，以\0结尾
+    size_t len;
+    char* original;       // 本批次第一次修改前的内容，写回时用于备份
+    size_t original_len;
+    struct IoJob* backup; // 第一次修改时提交的备份写入，写回时收取结果
+    int dirty;
+    int fd;               // 预读期间打开的描述符
+    mode_t mode;
+    struct stat stamp;    // 加载或写回时的文件状态，用于判断缓存是否仍然有效
+    int verified;         // 本批次是否已校验过缓存
+    uint64_t hash;        // 当前内容的哈希，hash_valid为真时有效
+    int hash_valid;
+    uint64_t* replay_chain; // 账本中以当前内容结尾的内容哈希链（从早到晚）
+    int replay_len;
+    int replay_pos;       // 重放进度（链中的位置），-1表示重放已结束
+    int replay_built;
+    uint64_t ledger_state; // 本批次最后一条账本记录的执行后状态，ledger_pending为真时有效
+    int ledger_last;      // 该记录在账本中的下标
+    int ledger_pending;
+    LineIndex* line_index; // 按需建立或从索引文件加载，随编辑增量更新
+    FileStateTable* owner;
+} FileState;
+
+struct FileStateTable {
+    FileState** entries;
+    int capacity;
+    int count;
+    IoRing* ring;             // 为NULL时使用同步的pread/pwrite
+    FileState** queue;        // 等待提交的预读
+    int queue_len;
+    int queue_pos;
+    int queue_capacity;
+    FileState* last_modified; // jsondo.lastbackup指向该文件的备份
+    Ledger* ledger;           // 首次执行命令时加载
+    char run_dir[MAX_PATH_LEN]; // 本批次的备份目录，首次需要时创建
+    JsondoBuffer* buffers;    // 不为NULL时只编辑这些内存缓冲区，不访问磁盘
+    int buffer_count;
+};
+
+// 一个批次持有的目标文件锁（每个目标对应.jsondo/locks/下的一个锁文件）
+typedef struct {
+    int* fds;
+    int count;
+} FileLockSet;
+
+// io_uring提交/完成队列（直接使用系统调用，不依赖liburing）
+struct IoRing {
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned to_submit;
+    unsigned inflight;
+};
+
+typedef enum {
+    IO_JOB_READ,
+    IO_JOB_WRITE
+} IoJobKind;
+
+// 一次异步读写，完成时按kind更新对应的文件状态
+typedef struct IoJob {
+    IoJobKind kind;
+    FileState* file;
+    int fd;
+    char* data;
+    size_t len;
+    size_t done;
+    int failed;
+} IoJob;
+
+// 执行计划（jsondo compile 生成的二进制文件），可直接mmap执行：
+// 文本以\0结尾存放，每个文本参数附带按行切分后的行（同样以\0结尾）及行哈希
+#define PLAN_MAGIC "JSDOPLAN"
+#define PLAN_VERSION 1
+#define PLAN_TEXT_SLOTS 4   // old_str, new_str, startLine_str, endLine_str
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t command_count;
+    uint64_t commands_offset;
+    uint64_t size;
+} PlanHeader;
+
+typedef struct {
+    uint64_t text_offset;        // 0表示参数不存在
+    uint64_t length;
+    uint64_t lines_offset;       // uint64_t[line_count]，各行在计划中的偏移
+    uint64_t hashes_offset;      // uint64_t[line_count]
+    uint32_t line_count;
+    uint32_t reserved;
+} PlanText;
+
+typedef struct {
+    uint32_t call;
+    int32_t start_line;
+    int32_t end_line;
+    int32_t backward_scan_limit;
+    int32_t forward_scan_limit;
+    uint32_t reserved;
+    uint64_t title_offset;       // 0表示无标题
+    uint64_t file_offset;
+    PlanText texts[PLAN_TEXT_SLOTS];
+} PlanCommand;
+
+// 一个批次的命令来源：JSON命令数组、库调用者提供的命令结构体数组或执行计划，执行时逐条取出
+typedef struct {
+    cJSON* commands;
+    const JsondoCommand* structs;
+    const char* plan_base;
+    size_t plan_size;
+    const PlanCommand* plan_commands;
+    int count;
+} CommandSource;
+
+
+// 函数声明
+int parse_json_file(const char* filename, Command commands[], int* command_count);
+int eval_command(const char* json_content, const char* command_file);
+int run_command_batch(const char* json_content, FileStateTable* files);
+int run_command_source(const CommandSource* source, FileStateTable* files);
+void file_state_table_begin_batch(FileStateTable* table);
+void file_state_verify(FileState* file);
+int watch_directory(const char* dir);
+int eval_plan(const char* plan_file);
+int compile_command_file(const char* command_file, const char* plan_file);
+int parse_command(cJSON* command, int index, CommandSpec* spec);
+int parse_replace_by_content_args(cJSON* args_json, ReplaceByContentArgs* args, MappedText payloads[]);
+int parse_replace_by_range_args(cJSON* args_json, ReplaceByLinesArgs* args, MappedText payloads[]);
+int parse_replace_block_args(cJSON* args_json, ReplaceBlockArgs* args, MappedText payloads[]);
+int parse_apply_patch_args(cJSON* args_json, ApplyPatchArgs* args, MappedText payloads[]);
+int parse_line_edit_args(cJSON* args_json, CallType call, LineEditArgs* args, MappedText payloads[]);
+void free_command_spec(CommandSpec* spec);
+int command_spec_from_struct(const JsondoCommand* command, int index, CommandSpec* spec);
+int plan_command_spec(const char* base, size_t size, const PlanCommand* pc, int index, CommandSpec* spec);
+const char* command_spec_file(const CommandSpec* spec);
+const char* command_spec_call_name(const CommandSpec* spec);
+int run_command(const CommandSpec* spec, FileStateTable* files);
+int execute_replace_by_content(const ReplaceByContentArgs* args, FileState* file, EditResult* edit);
+int execute_replace_by_range(const ReplaceByLinesArgs* args, FileState* file, EditResult* edit);
+int execute_replace_block(const ReplaceBlockArgs* args, FileState* file, EditResult* edit);
+int execute_apply_patch(const ApplyPatchArgs* args, FileState* file, EditResult* edit);
+int execute_insert_lines(const LineEditArgs* args, FileState* file, EditResult* edit);
+int execute_delete_lines(const LineEditArgs* args, FileState* file, EditResult* edit);
+int execute_append(const LineEditArgs* args, FileState* file, EditResult* edit);
+int replace_by_content(FileState* file, const TextArg* old_str, int start_line, const TextArg* new_str, 
+                      int backward_scan_limit, int forward_scan_limit, EditResult* edit);
+int replace_by_range(FileState* file, int start_line, int end_line, const TextArg* new_str, 
+                     const TextArg* start_line_str, const TextArg* end_line_str, 
+                     int backward_scan_limit, int forward_scan_limit, EditResult* edit);
+int replace_block(FileState* file, const TextArg* header, int start_line, const TextArg* new_str, EditResult* edit);
+int insert_lines_at(FileState* file, int line, const TextArg* new_str, const TextArg* guard,
+                    int backward_scan_limit, int forward_scan_limit, EditResult* edit);
+int delete_lines_at(FileState* file, int start_line, int end_line, const TextArg* guard,
+                    int backward_scan_limit, int forward_scan_limit, EditResult* edit);
+int patch_next_section(const char* text, size_t len, size_t* pos, int strip, PatchSection* section);
+int apply_patch_section(FileState* file, const char* text, size_t len, size_t begin, size_t end,
+                        int hunk_count, int backward_scan_limit, int forward_scan_limit, EditResult* edit);
+void delete_command_file(const char* command_file);
+int copy_file(const char* src_path, const char* dst_path);
+char* trim(char* str);
+char* str_replace(const char* str, const char* old, const char* new);
+char* read_file(const char* filename);
+int write_file(const char* filename, const char* content);
+int file_exists(const char* filename);
+int mapped_text_open(const char* path, MappedText* map);
+void mapped_text_close(MappedText* map);
+int index_to_line(const char* str, int index);
+int count_newlines(const char* str, size_t len);
+int count_lines(const char* str);
+char** text_arg_lines(const TextArg* arg, const char* special_path, int* count, int* owned);
+void text_arg_release(char** lines, int count, int owned);
+int find_first_line(char* lines[], int line_count, int start_index, const char* search);
+int find_last_line(char* lines[], int line_count, int start_index, const char* search);
+int is_line_text_equal(const char* line1, const char* line2, int line_number);
+int replace_line_by_line(FileState* file, const LineTable* table, char* content_lines[], int line_count,
+                         int start_line, char* search_lines[], const uint64_t* search_hashes, int search_count,
+                         char* insert_lines[], int insert_count,
+                         int backward_scan_limit, int forward_scan_limit, EditResult* edit);
+char** split_lines(const char* str, int* count);
+char** split_special_multiline(const char* file_path, const char* text, int* count);
+int is_multi_lines_equal(char* lines[], int line_count, int start_index, char* compare_lines[], int compare_count);
+int locate_multi_lines_forward(char* search_lines[], int search_count, 
+                               char* source_lines[], int source_count, 
+                               int source_start, int forward);
+int locate_multi_lines_backward(char* search_lines[], int search_count, 
+                                char* source_lines[], int source_count, 
+                                int source_start, int backward);
+int locate_by_anchors(const char* data, size_t len, char* search_lines[], const uint64_t* search_hashes,
+                      int search_count);
+void free_string_array(char** array, int count);
+void diagnose_nearest(const char* data, size_t len, char* search_lines[], int search_count, int near_line);
+const char* scan_kernel_name(void);
+int scan_kernel_use(const char* name);
+size_t scan_count_newlines(const char* data, size_t len);
+size_t scan_count_eol(const char* data, size_t len, int prev_cr, size_t* crlfs);
+size_t scan_line_starts(const char* data, size_t len, size_t* starts);
+const char* scan_nth_newline(const char* data, size_t len, size_t n, size_t* seen);
+size_t scan_compact_crlf(char* dst, const char* src, size_t len);
+int line_table_build(LineTable* table, const char* data, size_t len);
+void line_table_free(LineTable* table);
+size_t line_table_start(const LineTable* table, int index);
+size_t line_table_end(const LineTable* table, int index);
+size_t line_table_next(const LineTable* table, int index);
+const char* line_table_eol(const LineTable* table, int index);
+const char* line_table_default_eol(const LineTable* table);
+char** line_table_to_lines(const LineTable* table);
+const char* norm_find(const char* data, size_t len, size_t from, const char* pattern, size_t* matched_len);
+const char* parallel_find(const char* data, size_t len, size_t from, const char* pattern, size_t* matched_len);
+size_t parallel_count_newlines(const char* data, size_t len);
+const char* detect_eol_at(const char* data, size_t len, size_t pos);
+void byte_buffer_append_eol(ByteBuffer* buffer, const char* text, size_t len, const char* eol);
+char* splice_bytes(const char* data, size_t len, size_t begin, size_t end,
+                   const char* insert, const char* eol, size_t* out_len);
+char* splice_lines(const LineTable* table, int from_line, int to_line,
+                   char* insert_lines[], int insert_count, size_t* out_len);
+int splice_line_text(ByteBuffer* buffer, const LineTable* table, int from_line, int to_line, const char* text);
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed);
+uint64_t hash_content(const char* data, size_t len);
+void line_delta_init(LineDeltaMap* map);
+void line_delta_free(LineDeltaMap* map);
+void line_delta_add(LineDeltaMap* map, int line, int delta);
+int line_delta_prefix(const LineDeltaMap* map, int line);
+int line_delta_translate(const LineDeltaMap* map, int line);
+int line_delta_inverse(const LineDeltaMap* map, int line);
+void line_delta_record(LineDeltaMap* map, const EditResult* edit);
+FileState* file_state_get(FileStateTable* table, const char* path);
+void file_state_table_free(FileStateTable* table);
+const char* file_state_load(FileState* file, size_t* len);
+void file_state_replace(FileState* file, char* content, size_t len, size_t begin, size_t end);
+int file_state_flush(FileStateTable* table);
+void file_prefetch(FileStateTable* table, const char* path);
+IoRing* io_ring_create(unsigned entries);
+void io_ring_destroy(IoRing* ring);
+int command_target_path(cJSON* command, char* path, size_t size);
+int file_lock_acquire(FileLockSet* locks, char** paths, int count);
+void file_lock_release(FileLockSet* locks);
+const char* file_state_run_dir(FileStateTable* table);
+void file_state_backup(FileState* file);
+void record_applied(FileStateTable* table, const char* command_file);
+LineIndex* line_index_build(const char* data, size_t len);
+void line_index_free(LineIndex* index);
+int line_index_line_count(const LineIndex* index, const char* data, size_t len);
+size_t line_index_seek(const LineIndex* index, const char* data, size_t len, int line);
+const char* line_index_default_eol(const LineIndex* index, const char* data, size_t len);
+void line_index_update(LineIndex* index, const char* old_data, size_t old_len, const char* new_data, size_t new_len,
+                       size_t begin, size_t end);
+LineIndex* file_state_line_index(FileState* file);
+void file_state_save_line_index(FileState* file);
+int file_state_hash(FileState* file, uint64_t* hash);
+uint64_t command_spec_key(const CommandSpec* spec);
+Ledger* ledger_open(FileStateTable* table);
+void ledger_free(Ledger* ledger);
+int ledger_skip(Ledger* ledger, FileState* file, uint64_t command_key, EditResult* edit);
+void ledger_record(Ledger* ledger, FileState* file, uint64_t command_key, uint64_t pre_hash, const EditResult* edit);
+void ledger_seal(Ledger* ledger, FileState* file);
+int ledger_commit(Ledger* ledger);
+char* get_file_extension(const char* file_path);
+int is_special_extension(const char* ext);
+size_t byte_buffer_append(ByteBuffer* buffer, const void* data, size_t len, size_t align);
+void report(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void report_text(const char* format, ...) __attribute__((format(printf, 1, 2)));
+long long report_clock_us(void);
+int report_records(void);
+void report_begin_batch(const char* source);
+void report_command(const CommandSpec* spec, const char* status, const EditResult* edit,
+                    long long bytes_delta, long long elapsed_us);
+void report_end_batch(int success);
+
+// 解析并执行JSON命令
+int eval_command(const char* json_content, const char* command_file) {
+    FileStateTable files = {0};
+    int success = run_command_batch(json_content, &files);
+    
+    // 只有在所有操作都成功时才删除命令文件
+    if (success) {
+        // 复制命令文件到本次运行的备份目录
+        record_applied(&files, command_file);
+        
+        delete_command_file(command_file);
+    }
+    file_state_table_free(&files);
+    
+    return success ? 0 : 1;
+}
+
+// 执行一个命令文件中的所有命令并写回修改，返回1表示全部成功；
+// files可以跨批次复用（监视模式），已缓存的文件内容经校验后直接使用
+int run_command_batch(const char* json_content, FileStateTable* files) {
+    cJSON* root = cJSON_Parse(json_content);
+    if (root == NULL) {
+        report("Invalid JSON format\n");
+        return 0;
+    }
+    
+    cJSON* commands_array = cJSON_GetObjectItem(root, "commands");
+    if (commands_array == NULL || !cJSON_IsArray(commands_array)) {
+        report("Invalid JSON format: missing 'commands' array\n");
+        cJSON_Delete(root);
+        return 0;
+    }
+    
+    CommandSource source = {0};
+    source.commands = commands_array;
+    source.count = cJSON_GetArraySize(commands_array);
+    int success = run_command_source(&source, files);
+    cJSON_Delete(root);
+    return success;
+}
+
+// 取出第index条命令的目标文件路径（与解析命令相同，去除首尾空白）
+static int command_source_target(const CommandSource* source, int index, char* path, size_t size) {
+    if (source->commands != NULL) {
+        return command_target_path(cJSON_GetArrayItem(source->commands, index), path, size);
+    }
+
+    const char* file = NULL;
+    if (source->structs != NULL) {
+        file = source->structs[index].file;
+    } else {
+        uint64_t offset = source->plan_commands[index].file_offset;
+        if (offset != 0 && offset < source->plan_size &&
+            memchr(source->plan_base + offset, '\0', source->plan_size - offset) != NULL) {
+            file = source->plan_base + offset;
+        }
+    }
+    if (file == NULL) return 0;
+
+    char* temp_file = strdup(file);
+    path[0] = '\0';
+    strncat(path, trim(temp_file), size - 1);
+    free(temp_file);
+    return 1;
+}
+
+static int command_source_spec(const CommandSource* source, int index, CommandSpec* spec) {
+    if (source->commands != NULL) {
+        return parse_command(cJSON_GetArrayItem(source->commands, index), index, spec);
+    } else if (source->structs != NULL) {
+        return command_spec_from_struct(&source->structs[index], index, spec);
+    }
+    return plan_command_spec(source->plan_base, source->plan_size, &source->plan_commands[index], index, spec);
+}
+
+// 将一个目标文件追加到列表，容量不足时扩容；失败时释放整个列表并返回NULL
+static char** target_list_push(char** targets, int* count, int* capacity, const char* path) {
+    if (*count + 1 >= *capacity) {
+        char** grown = (char**)realloc(targets, (*capacity * 2) * sizeof(char*));
+        if (grown == NULL) {
+            for (int i = 0; i < *count; i++) free(targets[i]);
+            free(targets);
+            *count = 0;
+            return NULL;
+        }
+        targets = grown;
+        *capacity *= 2;
+    }
+    targets[(*count)++] = strdup(path);
+    return targets;
+}
+
+// 补丁命令的全部目标文件（逐个文件段扫描补丁，不输出错误，格式错误留到执行时报告）
+static char** command_source_patch_targets(const CommandSource* source, int index, char** targets,
+                                           int* count, int* capacity) {
+    const char* text = NULL;
+    int strip = 1;
+    MappedText map = {0};
+    if (source->commands != NULL) {
+        cJSON* command = cJSON_GetArrayItem(source->commands, index);
+        cJSON* call_item = cJSON_GetObjectItem(command, "call");
+        cJSON* args_item = cJSON_GetObjectItem(command, "args");
+        if (call_item == NULL || !cJSON_IsString(call_item) || strcasecmp(call_item->valuestring, "apply_patch") != 0) {
+            return targets;
+        }
+        cJSON* patch_item = cJSON_GetObjectItem(args_item, "patch");
+        cJSON* patch_file_item = cJSON_GetObjectItem(args_item, "patch_file");
+        cJSON* strip_item = cJSON_GetObjectItem(args_item, "strip");
+        if (strip_item != NULL && cJSON_IsNumber(strip_item)) strip = strip_item->valueint;
+        if (patch_item != NULL && cJSON_IsString(patch_item)) {
+            text = patch_item->valuestring;
+        } else if (patch_file_item != NULL && cJSON_IsString(patch_file_item)) {
+            char* temp_path = strdup(patch_file_item->valuestring);
+            if (mapped_text_open(trim(temp_path), &map)) text = map.data;
+            free(temp_path);
+        }
+    } else if (source->structs != NULL) {
+        if (source->structs[index].call != JSONDO_APPLY_PATCH) return targets;
+        text = source->structs[index].patch;
+        strip = source->structs[index].strip;
+    } else {
+        const PlanCommand* pc = &source->plan_commands[index];
+        if (pc->call != CALL_APPLY_PATCH) return targets;
+        if (pc->texts[0].text_offset != 0 && pc->texts[0].text_offset + pc->texts[0].length < source->plan_size) {
+            text = source->plan_base + pc->texts[0].text_offset;
+        }
+    }
+    if (text == NULL) return targets;
+
+    size_t len = strlen(text);
+    size_t pos = 0;
+    PatchSection section;
+    while (targets != NULL && patch_next_section(text, len, &pos, strip, &section) == 1) {
+        targets = target_list_push(targets, count, capacity, section.path);
+    }
+    mapped_text_close(&map);
+    return targets;
+}
+
+// 补丁命令按文件展开：流式取出每个文件的部分，该文件的全部hunk作为一条命令执行（一次读取、一次写回），
+// 每个文件输出一条执行记录
+static int run_patch_command(CommandSpec* spec, FileStateTable* files) {
+    ApplyPatchArgs* args = &spec->args.patch;
+    args->patch_len = strlen(args->patch.text);
+
+    size_t pos = 0;
+    int sections = 0, status = 0;
+    PatchSection section;
+    while ((status = patch_next_section(args->patch.text, args->patch_len, &pos, args->strip, &section)) == 1) {
+        if (section.create || section.remove) {
+            report("  Creating or deleting files is not supported: %s\n", section.path);
+            return 0;
+        }
+        memcpy(args->file, section.path, sizeof(args->file));
+        args->section_begin = section.begin;
+        args->section_end = section.end;
+        args->hunk_count = section.hunk_count;
+        sections++;
+        if (!run_command(spec, files)) return 0;
+    }
+    if (status < 0) {
+        report("  Malformed patch at line %d\n", section.error_line);
+        return 0;
+    }
+    if (sections == 0) {
+        report("  No file changes found in the patch\n");
+        return 0;
+    }
+    return 1;
+}
+
+// 执行一个批次的所有命令并写回修改，返回1表示全部成功
+int run_command_source(const CommandSource* source, FileStateTable* files) {
+    int success = 1;
+    int command_count = source->count;
+    int memory = (files->buffers != NULL);
+    if (!memory) mkdir(".jsondo", 0755);
+
+    // 先锁定所有目标文件再读取，同一文件的读取-修改-写回不会与其他jsondo进程交错
+    int target_capacity = command_count + 1;
+    char** targets = (char**)calloc(target_capacity, sizeof(char*));
+    int target_count = 0;
+    char path[MAX_PATH_LEN];
+    for (int i = 0; i < command_count && targets != NULL; i++) {
+        if (command_source_target(source, i, path, sizeof(path))) {
+            targets = target_list_push(targets, &target_count, &target_capacity, path);
+        } else {
+            targets = command_source_patch_targets(source, i, targets, &target_count, &target_capacity);
+        }
+    }
+    FileLockSet locks;
+    if (targets == NULL || !file_lock_acquire(&locks, targets, memory ? 0 : target_count)) {
+        for (int i = 0; i < target_count; i++) free(targets[i]);
+        free(targets);
+        return 0;
+    }
+    file_state_table_begin_batch(files);
+
+    // 多条命令时预先提交所有目标文件的读取，与前面命令的查找重叠执行
+    if (command_count > 1 && files->ring == NULL && !memory) {
+        files->ring = io_ring_create(IO_RING_ENTRIES);
+    }
+    if (command_count > 1 && files->ring != NULL) {
+        for (int i = 0; i < target_count; i++) {
+            file_prefetch(files, targets[i]);
+        }
+    }
+    for (int i = 0; i < target_count; i++) free(targets[i]);
+    free(targets);
+    
+    for (int i = 0; i < command_count; i++) {
+        CommandSpec spec;
+        if (!command_source_spec(source, i, &spec)) {
+            free_command_spec(&spec);
+            success = 0;
+            break;
+        }
+
+        int operation_success = (spec.call == CALL_APPLY_PATCH) ? run_patch_command(&spec, files)
+                                                                : run_command(&spec, files);
+        free_command_spec(&spec);
+        
+        if (!operation_success) {
+            success = 0;
+            break;
+        }
+    }
+
+    // 统一写回本批次修改过的文件（失败前已完成的修改同样写回）
+    if (!file_state_flush(files)) {
+        success = 0;
+    }
+    file_lock_release(&locks);
+    return success;
+}
+
+// 解析单条命令，字符串参数直接引用cJSON树中的内容
+int parse_command(cJSON* command, int index, CommandSpec* spec) {
+    memset(spec, 0, sizeof(*spec));
+    spec->index = index;
+
+    if (command == NULL || !cJSON_IsObject(command)) {
+        report("Invalid command at index %d\n", index);
+        return 0;
+    }
+    
+    cJSON* call_item = cJSON_GetObjectItem(command, "call");
+    if (call_item == NULL || !cJSON_IsString(call_item)) {
+        report("Invalid JSON format: missing or invalid 'call' property\n");
+        return 0;
+    }
+    
+    const char* tool_name = call_item->valuestring;
+    
+    cJSON* args_item = cJSON_GetObjectItem(command, "args");
+    if (args_item == NULL || !cJSON_IsObject(args_item)) {
+        report("Invalid JSON format: missing or invalid 'args' object\n");
+        return 0;
+    }
+
+    // 获取可选的title字段
+    cJSON* title_item = cJSON_GetObjectItem(command, "title");
+    spec->title = (title_item != NULL && cJSON_IsString(title_item)) ? title_item->valuestring : NULL;
+
+    // 根据工具名称解析相应的参数（支持大小写不敏感）
+    char lower_tool_name[64] = {0};
+    for (int j = 0; tool_name[j] && j < 63; j++) {
+        lower_tool_name[j] = tolower(tool_name[j]);
+    }
+
+    if (strcmp(lower_tool_name, "replace_by_content") == 0) {
+        spec->call = CALL_REPLACE_BY_CONTENT;
+        return parse_replace_by_content_args(args_item, &spec->args.content, spec->payloads);
+    } else if (strcmp(lower_tool_name, "replace_by_range") == 0) {
+        spec->call = CALL_REPLACE_BY_RANGE;
+        return parse_replace_by_range_args(args_item, &spec->args.range, spec->payloads);
+    } else if (strcmp(lower_tool_name, "replace_block") == 0) {
+        spec->call = CALL_REPLACE_BLOCK;
+        return parse_replace_block_args(args_item, &spec->args.block, spec->payloads);
+    } else if (strcmp(lower_tool_name, "apply_patch") == 0) {
+        spec->call = CALL_APPLY_PATCH;
+        return parse_apply_patch_args(args_item, &spec->args.patch, spec->payloads);
+    } else if (strcmp(lower_tool_name, "insert_lines") == 0) {
+        spec->call = CALL_INSERT_LINES;
+        return parse_line_edit_args(args_item, spec->call, &spec->args.lines, spec->payloads);
+    } else if (strcmp(lower_tool_name, "delete_lines") == 0) {
+        spec->call = CALL_DELETE_LINES;
+        return parse_line_edit_args(args_item, spec->call, &spec->args.lines, spec->payloads);
+    } else if (strcmp(lower_tool_name, "append") == 0) {
+        spec->call = CALL_APPEND;
+        return parse_line_edit_args(args_item, spec->call, &spec->args.lines, spec->payloads);
+    }
+
+    if (spec->title != NULL && strlen(spec->title) > 0) {
+        report_text("  Executing: `%s`\n", spec->title);
+    }
+    report("Unsupported tool: %s\n", tool_name);
+    return 0;
+}
+
+void free_command_spec(CommandSpec* spec) {
+    if (spec->call == CALL_REPLACE_BY_RANGE) {
+        free(spec->args.range.new_str_buffer);
+    }
+    for (int i = 0; i < PLAN_TEXT_SLOTS; i++) {
+        free(spec->plan_lines[i]);
+        mapped_text_close(&spec->payloads[i]);
+    }
+}
+
+// 由库调用者提供的命令结构体生成命令，与解析命令文件相同：file去除首尾空白，
+// replace_by_range的new_str去除首尾空白
+int command_spec_from_struct(const JsondoCommand* command, int index, CommandSpec* spec) {
+    memset(spec, 0, sizeof(*spec));
+    spec->index = index;
+    spec->title = command->title;
+
+    // 补丁的目标文件由补丁本身给出
+    if (command->call == JSONDO_APPLY_PATCH) {
+        spec->call = CALL_APPLY_PATCH;
+        ApplyPatchArgs* args = &spec->args.patch;
+        if (command->patch == NULL) {
+            report("Missing or invalid patch parameter\n");
+            return 0;
+        }
+        args->patch.text = command->patch;
+        args->strip = command->strip;
+        args->backward_scan_limit = command->backward_scan_limit;
+        args->forward_scan_limit = command->forward_scan_limit;
+        return 1;
+    }
+
+    char file[MAX_PATH_LEN] = "";
+    if (command->file == NULL) {
+        report("Missing or invalid file parameter\n");
+        return 0;
+    }
+    char* temp_file = strdup(command->file);
+    strncat(file, trim(temp_file), sizeof(file) - 1);
+    free(temp_file);
+
+    if (command->call == JSONDO_REPLACE_BY_CONTENT) {
+        spec->call = CALL_REPLACE_BY_CONTENT;
+        ReplaceByContentArgs* args = &spec->args.content;
+        memcpy(args->file, file, sizeof(args->file));
+        if (command->old_str == NULL) {
+            report("Missing or invalid old_str parameter\n");
+            return 0;
+        }
+        if (command->new_str == NULL) {
+            report("Missing or invalid new_str parameter\n");
+            return 0;
+        }
+        args->old_str.text = command->old_str;
+        args->new_str.text = command->new_str;
+        args->startLine = command->startLine;
+        args->backward_scan_limit = command->backward_scan_limit;
+        args->forward_scan_limit = command->forward_scan_limit;
+        return 1;
+    } else if (command->call == JSONDO_REPLACE_BY_RANGE) {
+        spec->call = CALL_REPLACE_BY_RANGE;
+        ReplaceByLinesArgs* args = &spec->args.range;
+        memcpy(args->file, file, sizeof(args->file));
+        if (command->new_str == NULL) {
+            report("Missing or invalid new_str parameter\n");
+            return 0;
+        }
+        if (command->startLine_str == NULL) {
+            report("Missing or invalid startLine_str parameter\n");
+            return 0;
+        }
+        if (command->endLine_str == NULL) {
+            report("Missing or invalid endLine_str parameter\n");
+            return 0;
+        }
+        args->new_str_buffer = strdup(command->new_str);
+        args->new_str.text = trim(args->new_str_buffer);
+        args->startLine_str.text = command->startLine_str;
+        args->endLine_str.text = command->endLine_str;
+        args->startLine = command->startLine;
+        args->endLine = command->endLine;
+        args->backward_scan_limit = command->backward_scan_limit;
+        args->forward_scan_limit = command->forward_scan_limit;
+        return 1;
+    } else if (command->call == JSONDO_REPLACE_BLOCK) {
+        spec->call = CALL_REPLACE_BLOCK;
+        ReplaceBlockArgs* args = &spec->args.block;
+        memcpy(args->file, file, sizeof(args->file));
+        if (command->header == NULL) {
+            report("Missing or invalid header parameter\n");
+            return 0;
+        }
+        if (command->new_str == NULL) {
+            report("Missing or invalid new_str parameter\n");
+            return 0;
+        }
+        args->header.text = command->header;
+        args->new_str.text = command->new_str;
+        args->startLine = command->startLine;
+        return 1;
+    } else if (command->call == JSONDO_INSERT_LINES || command->call == JSONDO_DELETE_LINES ||
+               command->call == JSONDO_APPEND) {
+        spec->call = (CallType)command->call;
+        LineEditArgs* args = &spec->args.lines;
+        memcpy(args->file, file, sizeof(args->file));
+        if (spec->call != CALL_DELETE_LINES && command->new_str == NULL) {
+            report("Missing or invalid new_str parameter\n");
+            return 0;
+        }
+        args->new_str.text = command->new_str;
+        args->guard.text = command->guard;
+        args->startLine = (spec->call == CALL_APPEND) ? -1 : command->startLine;
+        args->endLine = (spec->call == CALL_DELETE_LINES) ? command->endLine : -1;
+        args->backward_scan_limit = command->backward_scan_limit;
+        args->forward_scan_limit = command->forward_scan_limit;
+        return 1;
+    }
+
+    report("Unsupported tool: %d\n", (int)command->call);
+    return 0;
+}
+
+const char* command_spec_file(const CommandSpec* spec) {
+    if (spec->call == CALL_REPLACE_BY_RANGE) return spec->args.range.file;
+    if (spec->call == CALL_REPLACE_BLOCK) return spec->args.block.file;
+    if (spec->call == CALL_APPLY_PATCH) return spec->args.patch.file;
+    if (spec->call == CALL_INSERT_LINES || spec->call == CALL_DELETE_LINES || spec->call == CALL_APPEND) {
+        return spec->args.lines.file;
+    }
+    return spec->args.content.file;
+}
+
+const char* command_spec_call_name(const CommandSpec* spec) {
+    if (spec->call == CALL_REPLACE_BY_RANGE) return "replace_by_range";
+    if (spec->call == CALL_REPLACE_BLOCK) return "replace_block";
+    if (spec->call == CALL_APPLY_PATCH) return "apply_patch";
+    if (spec->call == CALL_INSERT_LINES) return "insert_lines";
+    if (spec->call == CALL_DELETE_LINES) return "delete_lines";
+    if (spec->call == CALL_APPEND) return "append";
+    return "replace_by_content";
+}
+
+// 执行单条命令：同一文件的前序编辑会使后续命令的行号偏移，按文件记录偏移以换算startLine/endLine
+int run_command(const CommandSpec* spec, FileStateTable* files) {
+    long long started_us = report_clock_us();
+    // 显示当前命令
+    if (spec->title != NULL && strlen(spec->title) > 0) {
+        report_text("  Executing: `%s`\n", spec->title);
+    }
+
+    FileState* file = file_state_get(files, command_spec_file(spec));
+    if (file == NULL) return 0;
+    EditResult edit = {0};
+    int operation_success = 0;
+    int skipped = 0;
+
+    // 输出JSON记录或返回执行结果时统计内容长度的变化（执行命令时同样需要读取文件）
+    size_t len_before = 0;
+    if (report_records()) file_state_load(file, &len_before);
+
+    // 账本中记录过的命令（文件内容已是其执行后的状态）直接跳过，不再查找
+    Ledger* ledger = ledger_open(files);
+    uint64_t command_key = 0, pre_hash = 0;
+    int tracked = 0;
+    if (ledger != NULL) {
+        command_key = command_spec_key(spec);
+        if (ledger_skip(ledger, file, command_key, &edit)) {
+            report_text("  Already applied, skipped: %s\n", file->path);
+            line_delta_record(&file->deltas, &edit);
+            operation_success = skipped = 1;
+        } else if (file->ledger_pending) {
+            // 本批次已记录过该文件，执行前状态接续上一条记录，不再对整个文件计算哈希
+            pre_hash = file->ledger_state;
+            tracked = 1;
+        } else {
+            tracked = file_state_hash(file, &pre_hash);
+        }
+    }
+
+    if (skipped) {
+        // 已在账本中
+    } else if (spec->call == CALL_REPLACE_BY_CONTENT) {
+        operation_success = execute_replace_by_content(&spec->args.content, file, &edit);
+    } else if (spec->call == CALL_REPLACE_BY_RANGE) {
+        operation_success = execute_replace_by_range(&spec->args.range, file, &edit);
+    } else if (spec->call == CALL_REPLACE_BLOCK) {
+        operation_success = execute_replace_block(&spec->args.block, file, &edit);
+    } else if (spec->call == CALL_APPLY_PATCH) {
+        operation_success = execute_apply_patch(&spec->args.patch, file, &edit);
+    } else if (spec->call == CALL_INSERT_LINES) {
+        operation_success = execute_insert_lines(&spec->args.lines, file, &edit);
+    } else if (spec->call == CALL_DELETE_LINES) {
+        operation_success = execute_delete_lines(&spec->args.lines, file, &edit);
+    } else if (spec->call == CALL_APPEND) {
+        operation_success = execute_append(&spec->args.lines, file, &edit);
+    }
+
+    if (operation_success && !skipped) {
+        line_delta_record(&file->deltas, &edit);
+        if (tracked) {
+            ledger_record(ledger, file, command_key, pre_hash, &edit);
+        }
+    }
+
+    const char* status = skipped ? "skipped" : (operation_success ? "applied" : "failed");
+    long long bytes_delta = report_records() ? (long long)file->len - (long long)len_before : 0;
+    report_command(spec, status, &edit, bytes_delta, report_clock_us() - started_us);
+    return operation_success;
+}
+
+// 将文本参数及其切分结果写入执行计划
+static int plan_write_text(ByteBuffer* buffer, const TextArg* arg, const char* special_path, PlanText* out) {
+    memset(out, 0, sizeof(*out));
+    if (arg->text == NULL) return 1;
+
+    out->length = strlen(arg->text);
+    out->text_offset = byte_buffer_append(buffer, arg->text, out->length + 1, 1);
+
+    int count = 0, owned = 0;
+    char** lines = text_arg_lines(arg, special_path, &count, &owned);
+    if (lines == NULL && count > 0) return 0;
+
+    uint64_t* offsets = (uint64_t*)malloc((count + 1) * sizeof(uint64_t));
+    uint64_t* hashes = (uint64_t*)malloc((count + 1) * sizeof(uint64_t));
+    if (offsets == NULL || hashes == NULL) {
+        free(offsets);
+        free(hashes);
+        text_arg_release(lines, count, owned);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(lines[i]);
+        offsets[i] = byte_buffer_append(buffer, lines[i], len + 1, 1);
+        hashes[i] = hash_bytes(lines[i], len, 0);
+    }
+    out->line_count = (uint32_t)count;
+    out->lines_offset = byte_buffer_append(buffer, offsets, count * sizeof(uint64_t), 8);
+    out->hashes_offset = byte_buffer_append(buffer, hashes, count * sizeof(uint64_t), 8);
+
+    free(offsets);
+    free(hashes);
+    text_arg_release(lines, count, owned);
+    return 1;
+}
+
+// 编译命令文件：解析JSON、切分各文本参数并计算行哈希，写成可mmap的二进制执行计划
+int compile_command_file(const char* command_file, const char* plan_file) {
+    char* json_content = read_file(command_file);
+    if (json_content == NULL) {
+        printf("Failed to read command file: %s\n", command_file);
+        return 0;
+    }
+
+    cJSON* root = cJSON_Parse(json_content);
+    free(json_content);
+    if (root == NULL) {
+        printf("Invalid JSON format\n");
+        return 0;
+    }
+
+    cJSON* commands_array = cJSON_GetObjectItem(root, "commands");
+    if (commands_array == NULL || !cJSON_IsArray(commands_array)) {
+        printf("Invalid JSON format: missing 'commands' array\n");
+        cJSON_Delete(root);
+        return 0;
+    }
+
+    int command_count = cJSON_GetArraySize(commands_array);
+    PlanCommand* plan_commands = (PlanCommand*)calloc(command_count + 1, sizeof(PlanCommand));
+    ByteBuffer buffer = {0};
+
+    // 预留文件头和命令表，文本数据追加在其后
+    PlanHeader header = {0};
+    byte_buffer_append(&buffer, &header, sizeof(header), 8);
+    size_t commands_offset = byte_buffer_append(&buffer, plan_commands, command_count * sizeof(PlanCommand), 8);
+
+    int success = 1;
+    for (int i = 0; i < command_count && success; i++) {
+        CommandSpec spec;
+        if (!parse_command(cJSON_GetArrayItem(commands_array, i), i, &spec)) {
+            success = 0;
+            break;
+        }
+
+        PlanCommand* pc = &plan_commands[i];
+        pc->call = spec.call;
+        if (spec.title != NULL) {
+            pc->title_offset = byte_buffer_append(&buffer, spec.title, strlen(spec.title) + 1, 1);
+        }
+        const char* file = command_spec_file(&spec);
+        pc->file_offset = byte_buffer_append(&buffer, file, strlen(file) + 1, 1);
+
+        // 各文本参数的切分方式与执行时保持一致
+        if (spec.call == CALL_REPLACE_BY_CONTENT) {
+            const ReplaceByContentArgs* args = &spec.args.content;
+            pc->start_line = args->startLine;
+            pc->backward_scan_limit = args->backward_scan_limit;
+            pc->forward_scan_limit = args->forward_scan_limit;
+            success = plan_write_text(&buffer, &args->old_str, args->file, &pc->texts[0]) &&
+                      plan_write_text(&buffer, &args->new_str, args->file, &pc->texts[1]);
+        } else if (spec.call == CALL_REPLACE_BLOCK) {
+            const ReplaceBlockArgs* args = &spec.args.block;
+            pc->start_line = args->startLine;
+            success = plan_write_text(&buffer, &args->header, NULL, &pc->texts[0]) &&
+                      plan_write_text(&buffer, &args->new_str, NULL, &pc->texts[1]);
+        } else if (spec.call == CALL_APPLY_PATCH) {
+            // 补丁按原文保存，执行时流式解析，不需要切分行
+            const ApplyPatchArgs* args = &spec.args.patch;
+            pc->start_line = args->strip;
+            pc->backward_scan_limit = args->backward_scan_limit;
+            pc->forward_scan_limit = args->forward_scan_limit;
+            pc->texts[0].length = strlen(args->patch.text);
+            pc->texts[0].text_offset = byte_buffer_append(&buffer, args->patch.text, pc->texts[0].length + 1, 1);
+        } else if (spec.call == CALL_INSERT_LINES || spec.call == CALL_DELETE_LINES || spec.call == CALL_APPEND) {
+            const LineEditArgs* args = &spec.args.lines;
+            pc->start_line = args->startLine;
+            pc->end_line = args->endLine;
+            pc->backward_scan_limit = args->backward_scan_limit;
+            pc->forward_scan_limit = args->forward_scan_limit;
+            success = plan_write_text(&buffer, &args->new_str, NULL, &pc->texts[1]) &&
+                      plan_write_text(&buffer, &args->guard, NULL, &pc->texts[2]);
+        } else {
+            const ReplaceByLinesArgs* args = &spec.args.range;
+            pc->start_line = args->startLine;
+            pc->end_line = args->endLine;
+            pc->backward_scan_limit = args->backward_scan_limit;
+            pc->forward_scan_limit = args->forward_scan_limit;
+            success = plan_write_text(&buffer, &args->new_str, NULL, &pc->texts[1]) &&
+                      plan_write_text(&buffer, &args->startLine_str, NULL, &pc->texts[2]) &&
+                      plan_write_text(&buffer, &args->endLine_str, NULL, &pc->texts[3]);
+        }
+        free_command_spec(&spec);
+    }
+    cJSON_Delete(root);
+
+    if (success) {
+        memcpy(header.magic, PLAN_MAGIC, sizeof(header.magic));
+        header.version = PLAN_VERSION;
+        header.command_count = (uint32_t)command_count;
+        header.commands_offset = commands_offset;
+        header.size = buffer.len;
+        memcpy(buffer.data, &header, sizeof(header));
+        memcpy(buffer.data + commands_offset, plan_commands, command_count * sizeof(PlanCommand));
+
+        FILE* file = fopen(plan_file, "wb");
+        if (file == NULL || fwrite(buffer.data, 1, buffer.len, file) != buffer.len) {
+            printf("Failed to write plan file: %s\n", plan_file);
+            success = 0;
+        } else {
+            printf("Compiled %d commands from %s into %s (%zu bytes)\n",
+                   command_count, command_file, plan_file, buffer.len);
+        }
+        if (file != NULL) fclose(file);
+    }
+
+    free(plan_commands);
+    free(buffer.data);
+    return success;
+}
+
+// 判断[offset, offset + len)是否位于映射范围内，比较时不会溢出
+static int plan_range_valid(size_t size, uint64_t offset, uint64_t len) {
+    return offset <= size && len <= size - offset;
+}
+
+// 判断offset处是否是映射范围内以\0结尾的字符串
+static int plan_string_valid(const char* base, size_t size, uint64_t offset) {
+    return offset < size && memchr(base + offset, '\0', size - offset) != NULL;
+}
+
+// 从映射的执行计划中取出文本参数：文本和各行直接指向映射内存，只分配行指针数组。
+// 文本、各行的\0结尾以及偏移数组和哈希数组都必须位于映射范围内
+static int plan_load_text(const char* base, size_t size, const PlanText* text, TextArg* arg, char*** lines_out) {
+    if (text->text_offset == 0) return 1;
+    if (text->text_offset >= size || text->length >= size - text->text_offset ||
+        base[text->text_offset + text->length] != '\0') {
+        return 0;
+    }
+    uint64_t array_len = (uint64_t)text->line_count * sizeof(uint64_t);
+    if (text->lines_offset % sizeof(uint64_t) != 0 || text->hashes_offset % sizeof(uint64_t) != 0 ||
+        !plan_range_valid(size, text->lines_offset, array_len) ||
+        !plan_range_valid(size, text->hashes_offset, array_len)) {
+        return 0;
+    }
+
+    const uint64_t* offsets = (const uint64_t*)(base + text->lines_offset);
+    char** lines = (char**)malloc(((size_t)text->line_count + 1) * sizeof(char*));
+    if (lines == NULL) return 0;
+    for (uint32_t i = 0; i < text->line_count; i++) {
+        if (!plan_string_valid(base, size, offsets[i])) {
+            free(lines);
+            return 0;
+        }
+        lines[i] = (char*)base + offsets[i];
+    }
+
+    arg->text = base + text->text_offset;
+    arg->lines = lines;
+    arg->line_count = (int)text->line_count;
+    arg->line_hashes = (const uint64_t*)(base + text->hashes_offset);
+    *lines_out = lines;
+    return 1;
+}
+
+// 从执行计划中取出一条命令，文本参数直接引用映射内存
+int plan_command_spec(const char* base, size_t size, const PlanCommand* pc, int index, CommandSpec* spec) {
+    memset(spec, 0, sizeof(*spec));
+    spec->call = (CallType)pc->call;
+    spec->index = index;
+    int has_title = (pc->title_offset != 0 && plan_string_valid(base, size, pc->title_offset));
+    spec->title = has_title ? base + pc->title_offset : NULL;
+
+    int valid = (spec->call == CALL_REPLACE_BY_CONTENT || spec->call == CALL_REPLACE_BY_RANGE ||
+                 spec->call == CALL_REPLACE_BLOCK || spec->call == CALL_APPLY_PATCH ||
+                 spec->call == CALL_INSERT_LINES || spec->call == CALL_DELETE_LINES || spec->call == CALL_APPEND) &&
+                pc->file_offset != 0 && plan_string_valid(base, size, pc->file_offset);
+    TextArg texts[PLAN_TEXT_SLOTS];
+    memset(texts, 0, sizeof(texts));
+    for (int j = 0; j < PLAN_TEXT_SLOTS && valid; j++) {
+        valid = plan_load_text(base, size, &pc->texts[j], &texts[j], &spec->plan_lines[j]);
+    }
+
+    // 必需的文本参数与解析JSON命令时相同（按PLAN_TEXT_SLOTS的顺序，每位对应一个参数）
+    unsigned required = 0;
+    if (spec->call == CALL_REPLACE_BY_CONTENT || spec->call == CALL_REPLACE_BLOCK) {
+        required = 0x3;
+    } else if (spec->call == CALL_APPLY_PATCH) {
+        required = 0x1;
+    } else if (spec->call == CALL_INSERT_LINES || spec->call == CALL_APPEND) {
+        required = 0x2;
+    } else if (spec->call == CALL_REPLACE_BY_RANGE) {
+        required = 0xe;
+    }
+    for (int j = 0; j < PLAN_TEXT_SLOTS && valid; j++) {
+        if ((required & (1u << j)) && texts[j].text == NULL) valid = 0;
+    }
+    if (!valid) {
+        report("Invalid command at index %d\n", index);
+        return 0;
+    }
+
+    if (spec->call == CALL_REPLACE_BY_CONTENT) {
+        ReplaceByContentArgs* args = &spec->args.content;
+        strncpy(args->file, base + pc->file_offset, sizeof(args->file) - 1);
+        args->old_str = texts[0];
+        args->new_str = texts[1];
+        args->startLine = pc->start_line;
+        args->backward_scan_limit = pc->backward_scan_limit;
+        args->forward_scan_limit = pc->forward_scan_limit;
+    } else if (spec->call == CALL_REPLACE_BLOCK) {
+        ReplaceBlockArgs* args = &spec->args.block;
+        strncpy(args->file, base + pc->file_offset, sizeof(args->file) - 1);
+        args->header = texts[0];
+        args->new_str = texts[1];
+        args->startLine = pc->start_line;
+    } else if (spec->call == CALL_APPLY_PATCH) {
+        ApplyPatchArgs* args = &spec->args.patch;
+        args->patch = texts[0];
+        args->strip = pc->start_line;
+        args->backward_scan_limit = pc->backward_scan_limit;
+        args->forward_scan_limit = pc->forward_scan_limit;
+    } else if (spec->call == CALL_INSERT_LINES || spec->call == CALL_DELETE_LINES || spec->call == CALL_APPEND) {
+        LineEditArgs* args = &spec->args.lines;
+        strncpy(args->file, base + pc->file_offset, sizeof(args->file) - 1);
+        args->new_str = texts[1];
+        args->guard = texts[2];
+        args->startLine = pc->start_line;
+        args->endLine = pc->end_line;
+        args->backward_scan_limit = pc->backward_scan_limit;
+        args->forward_scan_limit = pc->forward_scan_limit;
+    } else {
+        ReplaceByLinesArgs* args = &spec->args.range;
+        strncpy(args->file, base + pc->file_offset, sizeof(args->file) - 1);
+        args->new_str = texts[1];
+        args->startLine_str = texts[2];
+        args->endLine_str = texts[3];
+        args->startLine = pc->start_line;
+        args->endLine = pc->end_line;
+        args->backward_scan_limit = pc->backward_scan_limit;
+        args->forward_scan_limit = pc->forward_scan_limit;
+    }
+    return 1;
+}
+
+// 执行编译后的执行计划：mmap后直接使用其中的文本和行表，不做任何解析
+int eval_plan(const char* plan_file) {
+    int fd = open(plan_file, O_RDONLY);
+    if (fd < 0) {
+        report("Plan file not found: %s\n", plan_file);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PlanHeader)) {
+        report("Invalid plan file: %s\n", plan_file);
+        close(fd);
+        return 1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char* base = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        report("Failed to map plan file: %s\n", plan_file);
+        return 1;
+    }
+
+    const PlanHeader* header = (const PlanHeader*)base;
+    if (memcmp(header->magic, PLAN_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != PLAN_VERSION || header->size != size ||
+        header->commands_offset % 8 != 0 ||
+        !plan_range_valid(size, header->commands_offset, (uint64_t)header->command_count * sizeof(PlanCommand))) {
+        report("Invalid plan file: %s\n", plan_file);
+        munmap((void*)base, size);
+        return 1;
+    }
+
+    CommandSource source = {0};
+    source.plan_base = base;
+    source.plan_size = size;
+    source.plan_commands = (const PlanCommand*)(base + header->commands_offset);
+    source.count = (int)header->command_count;
+    FileStateTable files = {0};
+    int success = run_command_source(&source, &files);
+    file_state_table_free(&files);
+    munmap((void*)base, size);
+
+    if (success) {
+        report_text("[OK] All changes from %s are applied.\n", plan_file);
+    }
+    return success ? 0 : 1;
+}
+
+// 删除命令文件
+void delete_command_file(const char* command_file) {
+    if (file_exists(command_file)) {
+        remove(command_file);
+        report_text("[OK] All changes from %s[deleted] are applied.\n", command_file);
+    }
+}
+
+// 复制文件（Linux兼容）
+int copy_file(const char* src_path, const char* dst_path) {
+    FILE* src = fopen(src_path, "rb");
+    if (src == NULL) return 0;
+
+    FILE* dst = fopen(dst_path, "wb");
+    if (dst == NULL) {
+        fclose(src);
+        return 0;
+    }
+
+    char buffer[4096];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        fwrite(buffer, 1, bytes, dst);
+    }
+
+    fclose(src);
+    fclose(dst);
+    return 1;
+}
+
+// 解析文本参数：直接给出name，或用file_name指向保存原始文本的文件（不需要JSON转义）。
+// 文件通过mmap映射，文本直接引用映射内存，不复制
+static int parse_text_arg(cJSON* args_json, const char* name, const char* file_name,
+                          TextArg* arg, MappedText* map) {
+    cJSON* text_item = cJSON_GetObjectItem(args_json, name);
+    cJSON* file_item = cJSON_GetObjectItem(args_json, file_name);
+    if (text_item != NULL && file_item != NULL) {
+        report("Parameters %s and %s cannot be used together\n", name, file_name);
+        return 0;
+    }
+
+    if (file_item != NULL) {
+        if (!cJSON_IsString(file_item)) {
+            report("Missing or invalid %s parameter\n", file_name);
+            return 0;
+        }
+        char* temp_path = strdup(file_item->valuestring);
+        char* path = trim(temp_path);
+        int success = mapped_text_open(path, map);
+        if (!success) {
+            report("Failed to read %s: %s\n", file_name, path);
+        } else if (memchr(map->data, '\0', map->len) != NULL) {
+            report("Invalid %s: %s contains NUL bytes\n", file_name, path);
+            mapped_text_close(map);
+            success = 0;
+        }
+        free(temp_path);
+        if (!success) return 0;
+        arg->text = map->data;
+        return 1;
+    }
+
+    if (text_item == NULL || !cJSON_IsString(text_item)) {
+        report("Missing or invalid %s parameter\n", name);
+        return 0;
+    }
+    arg->text = text_item->valuestring;
+    return 1;
+}
+
+// 解析文件替换参数
+int parse_replace_by_content_args(cJSON* args_json, ReplaceByContentArgs* args, MappedText payloads[]) {
+    cJSON* file_item = cJSON_GetObjectItem(args_json, "file");
+    if (file_item == NULL || !cJSON_IsString(file_item)) {
+        report("Missing or invalid file parameter\n");
+        return 0;
+    }
+    char* temp_file = strdup(file_item->valuestring);
+    char* file_trimmed = trim(temp_file);
+    strncpy(args->file, file_trimmed, sizeof(args->file) - 1);
+    free(temp_file);
+
+    if (!parse_text_arg(args_json, "old_str", "old_file", &args->old_str, &payloads[0]) ||
+        !parse_text_arg(args_json, "new_str", "new_file", &args->new_str, &payloads[1])) {
+        return 0;
+    }
+
+    args->startLine = 0;
+    cJSON* start_line_item = cJSON_GetObjectItem(args_json, "startLine");
+    if (start_line_item != NULL && cJSON_IsNumber(start_line_item)) {
+        args->startLine = start_line_item->valueint;
+    }
+
+    args->backward_scan_limit = 10;
+    cJSON* backward_item = cJSON_GetObjectItem(args_json, "backward_scan_limit");
+    if (backward_item != NULL && cJSON_IsNumber(backward_item)) {
+        args->backward_scan_limit = backward_item->valueint;
+    }
+
+    args->forward_scan_limit = 15;
+    cJSON* forward_item = cJSON_GetObjectItem(args_json, "forward_scan_limit");
+    if (forward_item != NULL && cJSON_IsNumber(forward_item)) {
+        args->forward_scan_limit = forward_item->valueint;
+    }
+
+    return 1;
+}
+
+// 解析按行替换参数
+int parse_replace_by_range_args(cJSON* args_json, ReplaceByLinesArgs* args, MappedText payloads[]) {
+    cJSON* file_item = cJSON_GetObjectItem(args_json, "file");
+    if (file_item == NULL || !cJSON_IsString(file_item)) {
+        report("Missing or invalid file parameter\n");
+        return 0;
+    }
+    char* temp_file = strdup(file_item->valuestring);
+    char* file_trimmed = trim(temp_file);
+    strncpy(args->file, file_trimmed, sizeof(args->file) - 1);
+    free(temp_file);
+
+    cJSON* start_line_item = cJSON_GetObjectItem(args_json, "startLine");
+    if (start_line_item == NULL || !cJSON_IsNumber(start_line_item)) {
+        report("Missing or invalid startLine parameter\n");
+        return 0;
+    }
+    args->startLine = start_line_item->valueint;
+
+    cJSON* end_line_item = cJSON_GetObjectItem(args_json, "endLine");
+    if (end_line_item == NULL || !cJSON_IsNumber(end_line_item)) {
+        report("Missing or invalid endLine parameter\n");
+        return 0;
+    }
+    args->endLine = end_line_item->valueint;
+
+    // new_str去除首尾空白：JSON中的文本复制后处理，映射的文件直接在私有映射上处理
+    if (!parse_text_arg(args_json, "new_str", "new_file", &args->new_str, &payloads[1])) {
+        return 0;
+    }
+    if (payloads[1].data != NULL) {
+        args->new_str.text = trim(payloads[1].data);
+    } else {
+        args->new_str_buffer = strdup(args->new_str.text);
+        args->new_str.text = trim(args->new_str_buffer);
+    }
+
+    if (!parse_text_arg(args_json, "startLine_str", "startLine_file", &args->startLine_str, &payloads[2]) ||
+        !parse_text_arg(args_json, "endLine_str", "endLine_file", &args->endLine_str, &payloads[3])) {
+        return 0;
+    }
+
+    args->backward_scan_limit = 10;
+    cJSON* backward_item = cJSON_GetObjectItem(args_json, "backward_scan_limit");
+    if (backward_item != NULL && cJSON_IsNumber(backward_item)) {
+        args->backward_scan_limit = backward_item->valueint;
+    }
+
+    args->forward_scan_limit = 15;
+    cJSON* forward_item = cJSON_GetObjectItem(args_json, "forward_scan_limit");
+    if (forward_item != NULL && cJSON_IsNumber(forward_item)) {
+        args->forward_scan_limit = forward_item->valueint;
+    }
+
+    return 1;
+}
+
+// 解析按块替换参数
+int parse_replace_block_args(cJSON* args_json, ReplaceBlockArgs* args, MappedText payloads[]) {
+    cJSON* file_item = cJSON_GetObjectItem(args_json, "file");
+    if (file_item == NULL || !cJSON_IsString(file_item)) {
+        report("Missing or invalid file parameter\n");
+        return 0;
+    }
+    char* temp_file = strdup(file_item->valuestring);
+    char* file_trimmed = trim(temp_file);
+    strncpy(args->file, file_trimmed, sizeof(args->file) - 1);
+    free(temp_file);
+
+    // new_str按原样使用（保留首行缩进），末尾的一个换行不产生空行
+    if (!parse_text_arg(args_json, "header", "header_file", &args->header, &payloads[0]) ||
+        !parse_text_arg(args_json, "new_str", "new_file", &args->new_str, &payloads[1])) {
+        return 0;
+    }
+
+    args->startLine = 0;
+    cJSON* start_line_item = cJSON_GetObjectItem(args_json, "startLine");
+    if (start_line_item != NULL && cJSON_IsNumber(start_line_item)) {
+        args->startLine = start_line_item->valueint;
+    }
+    return 1;
+}
+
+// 解析补丁参数：补丁全文（patch或patch_file），目标文件由补丁给出
+int parse_apply_patch_args(cJSON* args_json, ApplyPatchArgs* args, MappedText payloads[]) {
+    if (!parse_text_arg(args_json, "patch", "patch_file", &args->patch, &payloads[0])) {
+        return 0;
+    }
+
+    args->strip = 1;
+    cJSON* strip_item = cJSON_GetObjectItem(args_json, "strip");
+    if (strip_item != NULL && cJSON_IsNumber(strip_item)) {
+        args->strip = strip_item->valueint;
+    }
+
+    args->backward_scan_limit = 10;
+    cJSON* backward_item = cJSON_GetObjectItem(args_json, "backward_scan_limit");
+    if (backward_item != NULL && cJSON_IsNumber(backward_item)) {
+        args->backward_scan_limit = backward_item->valueint;
+    }
+
+    args->forward_scan_limit = 15;
+    cJSON* forward_item = cJSON_GetObjectItem(args_json, "forward_scan_limit");
+    if (forward_item != NULL && cJSON_IsNumber(forward_item)) {
+        args->forward_scan_limit = forward_item->valueint;
+    }
+    return 1;
+}
+
+// 解析按行号编辑的参数：insert_lines给出line（或startLine），delete_lines给出startLine和可选的endLine（默认与startLine相同），
+// append只需要new_str；guard（或guard_file）可选
+int parse_line_edit_args(cJSON* args_json, CallType call, LineEditArgs* args, MappedText payloads[]) {
+    cJSON* file_item = cJSON_GetObjectItem(args_json, "file");
+    if (file_item == NULL || !cJSON_IsString(file_item)) {
+        report("Missing or invalid file parameter\n");
+        return 0;
+    }
+    char* temp_file = strdup(file_item->valuestring);
+    char* file_trimmed = trim(temp_file);
+    strncpy(args->file, file_trimmed, sizeof(args->file) - 1);
+    free(temp_file);
+
+    args->startLine = -1;
+    args->endLine = -1;
+    if (call == CALL_INSERT_LINES) {
+        // 与JsondoCommand的字段一致，也接受startLine
+        cJSON* line_item = cJSON_GetObjectItem(args_json, "line");
+        if (line_item == NULL) line_item = cJSON_GetObjectItem(args_json, "startLine");
+        if (line_item == NULL || !cJSON_IsNumber(line_item)) {
+            report("Missing or invalid line parameter\n");
+            return 0;
+        }
+        args->startLine = line_item->valueint;
+    } else if (call == CALL_DELETE_LINES) {
+        cJSON* start_line_item = cJSON_GetObjectItem(args_json, "startLine");
+        if (start_line_item == NULL || !cJSON_IsNumber(start_line_item)) {
+            report("Missing or invalid startLine parameter\n");
+            return 0;
+        }
+        args->startLine = start_line_item->valueint;
+        args->endLine = args->startLine;
+        cJSON* end_line_item = cJSON_GetObjectItem(args_json, "endLine");
+        if (end_line_item != NULL && cJSON_IsNumber(end_line_item)) {
+            args->endLine = end_line_item->valueint;
+        }
+    }
+
+    // new_str按原样使用，末尾的一个换行不产生空行
+    if (call != CALL_DELETE_LINES &&
+        !parse_text_arg(args_json, "new_str", "new_file", &args->new_str, &payloads[1])) {
+        return 0;
+    }
+    if ((cJSON_GetObjectItem(args_json, "guard") != NULL || cJSON_GetObjectItem(args_json, "guard_file") != NULL) &&
+        !parse_text_arg(args_json, "guard", "guard_file", &args->guard, &payloads[2])) {
+        return 0;
+    }
+
+    args->backward_scan_limit = 10;
+    cJSON* backward_item = cJSON_GetObjectItem(args_json, "backward_scan_limit");
+    if (backward_item != NULL && cJSON_IsNumber(backward_item)) {
+        args->backward_scan_limit = backward_item->valueint;
+    }
+
+    args->forward_scan_limit = 15;
+    cJSON* forward_item = cJSON_GetObjectItem(args_json, "forward_scan_limit");
+    if (forward_item != NULL && cJSON_IsNumber(forward_item)) {
+        args->forward_scan_limit = forward_item->valueint;
+    }
+    return 1;
+}
+
+// 执行文件替换操作
+int execute_replace_by_content(const ReplaceByContentArgs* args, FileState* file, EditResult* edit) {
+    // 换算为当前文件中的行号
+    int start_line = line_delta_translate(&file->deltas, args->startLine);
+
+    return replace_by_content(file, &args->old_str, start_line, &args->new_str,
+                             args->backward_scan_limit, args->forward_scan_limit, edit);
+}
+
+// 执行按行替换文件操作
+int execute_replace_by_range(const ReplaceByLinesArgs* args, FileState* file, EditResult* edit) {
+    // 换算为当前文件中的行号（endLine为-1时保持不变）
+    int start_line = line_delta_translate(&file->deltas, args->startLine);
+    int end_line = (args->endLine != -1) ? line_delta_translate(&file->deltas, args->endLine) : -1;
+
+    return replace_by_range(file, start_line, end_line, &args->new_str,
+                           &args->startLine_str, &args->endLine_str,
+                           args->backward_scan_limit, args->forward_scan_limit, edit);
+}
+
+// 执行补丁中一个文件的部分
+int execute_apply_patch(const ApplyPatchArgs* args, FileState* file, EditResult* edit) {
+    int backward = (args->backward_scan_limit > 0) ? args->backward_scan_limit : 0;
+    int forward = (args->forward_scan_limit > 0) ? args->forward_scan_limit : 0;
+    return apply_patch_section(file, args->patch.text, args->patch_len, args->section_begin, args->section_end,
+                               args->hunk_count, backward, forward, edit);
+}
+
+// 执行按块替换操作
+int execute_replace_block(const ReplaceBlockArgs* args, FileState* file, EditResult* edit) {
+    int start_line = (args->startLine > 0) ? line_delta_translate(&file->deltas, args->startLine) : 0;
+    return replace_block(file, &args->header, start_line, &args->new_str, edit);
+}
+
+// 执行插入操作（line为-1时保持不变，表示文件末尾）
+int execute_insert_lines(const LineEditArgs* args, FileState* file, EditResult* edit) {
+    int line = line_delta_translate(&file->deltas, args->startLine);
+    return insert_lines_at(file, line, &args->new_str, &args->guard,
+                           args->backward_scan_limit, args->forward_scan_limit, edit);
+}
+
+// 执行删除操作
+int execute_delete_lines(const LineEditArgs* args, FileState* file, EditResult* edit) {
+    int start_line = line_delta_translate(&file->deltas, args->startLine);
+    int end_line = (args->endLine != -1) ? line_delta_translate(&file->deltas, args->endLine) : -1;
+    return delete_lines_at(file, start_line, end_line, &args->guard,
+                           args->backward_scan_limit, args->forward_scan_limit, edit);
+}
+
+// 执行追加操作：文件末尾的位置是确定的，guard只在原位校验
+int execute_append(const LineEditArgs* args, FileState* file, EditResult* edit) {
+    return insert_lines_at(file, -1, &args->new_str, &args->guard, 0, 0, edit);
+}
+
+// 文件替换方法：将文件中的指定文本替换为新文本
+int replace_by_content(FileState* file, const TextArg* old_str, int start_line, const TextArg* new_str,
+                      int backward_scan_limit, int forward_scan_limit, EditResult* edit) {
+    size_t content_len = 0;
+    const char* content = file_state_load(file, &content_len);
+    if (content == NULL) {
+        if (file->status == FILE_MISSING) {
+            report("  File not found: %s\n", file->path);
+        } else {
+            report("  Failed to read file: %s\n", file->path);
+        }
+        return 0;
+    }
+    
+    // 在规范化视图上查找旧文本（\r\n视为\n，不复制内容），返回原始字节位置
+    size_t matched_len = 0;
+    const char* found = parallel_find(content, content_len, 0, old_str->text, &matched_len);
+    if (found == NULL) {
+        // 尝试逐行替换
+        int search_count = 0, insert_count = 0, search_owned = 0, insert_owned = 0;
+        char** search_lines = text_arg_lines(old_str, file->path, &search_count, &search_owned);
+        char** insert_lines = text_arg_lines(new_str, file->path, &insert_count, &insert_owned);
+
+        // 分割内容为行（行表保留原始换行符位置）
+        LineTable table;
+        line_table_build(&table, content, content_len);
+        char** content_lines = line_table_to_lines(&table);
+
+        int result = replace_line_by_line(file, &table, content_lines, table.count,
+                                         start_line, search_lines, old_str->line_hashes, search_count,
+                                         insert_lines, insert_count,
+                                         backward_scan_limit, forward_scan_limit, edit);
+
+        // 释放内存
+        text_arg_release(search_lines, search_count, search_owned);
+        text_arg_release(insert_lines, insert_count, insert_owned);
+        free_string_array(content_lines, table.count);
+        line_table_free(&table);
+
+        return result;
+    }
+    
+    // 检查是否有多个匹配项（大文件时同样分块并行检查）
+    size_t index = found - content;
+    size_t next_len = 0;
+    if (parallel_find(content, content_len, index + (matched_len > 0 ? matched_len : 1), old_str->text, &next_len) != NULL) {
+        report("  Multiple occurrences found: %s\n", file->path);
+        return 0;
+    }
+    
+    // 计算行数和删除/插入的行数
+    int line_number = (int)parallel_count_newlines(content, index) + 1;
+    int old_line_count = count_lines(old_str->text);
+    int new_line_count = count_lines(new_str->text);
+    
+    // 生成新内容：匹配区间之外保持原始字节，新文本沿用匹配处的换行风格
+    const char* eol = detect_eol_at(content, content_len, index);
+    size_t new_len = 0;
+    char* new_content = splice_bytes(content, content_len, index, index + matched_len, new_str->text, eol, &new_len);
+    if (new_content == NULL) {
+        report("  Failed to write file: %s\n", file->path);
+        return 0;
+    }
+
+    report("  Replaced at line %d, deleted %d lines, inserted %d lines\n",
+           line_number, old_line_count, new_line_count);
+    // 按实际跨越的行数记录，供后续命令换算行号
+    edit->line = line_number;
+    edit->deleted = count_newlines(found, matched_len) + 1;
+    edit->inserted = count_newlines(new_str->text, strlen(new_str->text)) + 1;
+
+    file_state_replace(file, new_content, new_len, index, index + matched_len);
+    return 1;
+}
+
+// 按行替换文件方法
+int replace_by_range(FileState* file, int start_line, int end_line, const TextArg* new_str,
+                     const TextArg* start_line_str, const TextArg* end_line_str,
+                     int backward_scan_limit, int forward_scan_limit, EditResult* edit) {
+    // 读取文件所有行（行表记录原始偏移，写回时保留换行风格）
+    size_t content_len = 0;
+    const char* content = file_state_load(file, &content_len);
+    if (content == NULL) {
+        if (file->status == FILE_MISSING) {
+            report("  File not found: %s\n", file->path);
+        } else {
+            report("Failed to open file: %s\n", file->path);
+        }
+        return 0;
+    }
+    
+    // 行号索引给出总行数及行首偏移，只需切分扫描窗口内的行
+    LineIndex* index = file_state_line_index(file);
+    if (index == NULL) {
+        report("Failed to open file: %s\n", file->path);
+        return 0;
+    }
+    int line_count = line_index_line_count(index, content, content_len);
+    
+    // 验证行号范围
+    if (start_line < 1) {
+        report("  Invalid start line %d\n", start_line);
+        return 0;
+    }
+    if (start_line > line_count) {
+        report("  Start line %d exceeds file length %d\n", start_line, line_count);
+        return 0;
+    }
+    
+    // 如果endLine为-1，则替换到文件末尾
+    int actual_end_line = (end_line == -1) ? line_count : end_line;
+    if (actual_end_line < 1) {
+        report("  Invalid end line %d\n", actual_end_line);
+        return 0;
+    }
+    if (actual_end_line > line_count) {
+        report("  End line %d exceeds file length %d\n", actual_end_line, line_count);
+        return 0;
+    }
+    
+    int start_line_count = 0, start_owned = 0;
+    char** start_lines = text_arg_lines(start_line_str, NULL, &start_line_count, &start_owned);
+    int end_line_count = 0, end_owned = 0;
+    char** end_lines = text_arg_lines(end_line_str, NULL, &end_line_count, &end_owned);
+
+    // 扫描窗口[base, window_end)覆盖起始/结束标记的全部查找范围，窗口内的行下标减去base
+    long long backward = (backward_scan_limit > 0) ? backward_scan_limit : 0;
+    long long forward = (forward_scan_limit > 0) ? forward_scan_limit : 0;
+    long long window_start = (long long)start_line - 1 - backward;
+    if ((long long)actual_end_line - end_line_count < window_start) window_start = (long long)actual_end_line - end_line_count;
+    if (window_start < 0) window_start = 0;
+    long long window_end = start_line + forward + start_line_count;
+    if (window_end < actual_end_line) window_end = actual_end_line;
+    window_end += forward + end_line_count + 1;
+    if (window_end > line_count) window_end = line_count;
+    int base = (int)window_start;
+
+    size_t window_begin = line_index_seek(index, content, content_len, base);
+    size_t window_stop = line_index_seek(index, content, content_len, (int)window_end);
+    LineTable table;
+    line_table_build(&table, content + window_begin, window_stop - window_begin);
+    table.default_eol = line_index_default_eol(index, content, content_len);
+    char** lines = line_table_to_lines(&table);
+    int window_count = table.count;
+    
+    // 校验起始行内容
+    int actual_start_line = start_line;
+    
+    if (!is_multi_lines_equal(lines, window_count, start_line - 1 - base, start_lines, start_line_count)) {
+        // 尝试从前面搜索
+        int marker_start = locate_multi_lines_backward(start_lines, start_line_count,
+                                                      lines, window_count,
+                                                      start_line - 1 - base, backward_scan_limit);
+        if (marker_start == -1) {
+            // 向后搜索
+            marker_start = locate_multi_lines_forward(start_lines, start_line_count,
+                                                     lines, window_count,
+                                                     start_line - 1 - base, forward_scan_limit);
+        }
+
+        if (marker_start == -1) {
+            // 扫描范围内找不到起始标记时，用标记中的唯一行在整个文件中定位，
+            // 起止行号按相同的偏移平移后重新执行（平移后起始标记必然匹配，不会再次进入此处）
+            int anchored = locate_by_anchors(content, content_len, start_lines, start_line_str->line_hashes,
+                                             start_line_count);
+            if (anchored != -1 && anchored + 1 != start_line) {
+                int shift = anchored + 1 - start_line;
+                report("  INFO: Start marker located by anchor lines at LN-%d (%+d lines from LN-%d)\n",
+                       anchored + 1, shift, start_line);
+                text_arg_release(start_lines, start_line_count, start_owned);
+                text_arg_release(end_lines, end_line_count, end_owned);
+                free_string_array(lines, window_count);
+                line_table_free(&table);
+                return replace_by_range(file, anchored + 1, (end_line == -1) ? -1 : end_line + shift, new_str,
+                                        start_line_str, end_line_str, backward_scan_limit, forward_scan_limit, edit);
+            }
+
+            report("  W: Start marker not found near LN-%d (±%d lines). \n", start_line, backward_scan_limit + forward_scan_limit);
+            report("  REQEUSTED: '%s'\n", start_line_str->text);
+            int actual = start_line - 1 - base;
+            report("  ACTRUALLY: '%s'\n", (actual >= 0 && actual < window_count) ? lines[actual] : "");
+            diagnose_nearest(content, content_len, start_lines, start_line_count, start_line);
+            text_arg_release(start_lines, start_line_count, start_owned);
+            text_arg_release(end_lines, end_line_count, end_owned);
+            free_string_array(lines, window_count);
+            line_table_free(&table);
+            return 0;
+        }
+
+        actual_start_line = marker_start + base + 1;
+    }
+    
+    // 校验结束行内容
+    int actual_end = actual_end_line;
+    
+    if (!is_multi_lines_equal(lines, window_count, actual_end - end_line_count - base, end_lines, end_line_count)) {
+        int min_start_line_of_end_marker = actual_start_line + start_line_count;
+        int marker_start = locate_multi_lines_forward(end_lines, end_line_count,
+                                                     lines, window_count,
+                                                     min_start_line_of_end_marker - 1 - base, forward_scan_limit);
+
+        if (marker_start == -1) {
+            report("  WARN: End marker not found within %d lines after LN-%d.\n", forward_scan_limit, actual_end_line);
+            report("  REQEUSTED: '%s'\n", end_line_str->text);
+            int actual = actual_end_line - 1 - base;
+            report("  ACTRUALLY: '%s'\n", (actual >= 0 && actual < window_count) ? lines[actual] : "");
+            diagnose_nearest(content, content_len, end_lines, end_line_count, actual_end_line);
+            text_arg_release(start_lines, start_line_count, start_owned);
+            text_arg_release(end_lines, end_line_count, end_owned);
+            free_string_array(lines, window_count);
+            line_table_free(&table);
+            return 0;
+        }
+
+        actual_end = marker_start + base + 1 + end_line_count;
+        report("  INFO: Searching extended, found end marker at LN-%d instead of LN-%d\n",
+               marker_start + base + 1, end_line);
+    }
+
+    // 构建新内容：窗口之外按原始字节写回，窗口内按行替换（新内容直接按原始文本写入，
+    // 预留换行符全部变为\r\n时的长度，不再扩容）
+    int new_str_count = 0;
+    char* new_content = NULL;
+    size_t new_len = 0;
+    ByteBuffer buffer = {0};
+    buffer.capacity = content_len + strlen(new_str->text) * 2 + 8;
+    buffer.data = (char*)malloc(buffer.capacity);
+    if (buffer.data != NULL) {
+        byte_buffer_append(&buffer, content, window_begin, 1);
+        new_str_count = splice_line_text(&buffer, &table, actual_start_line - 1 - base, actual_end - base,
+                                         new_str->text);
+        byte_buffer_append(&buffer, content + window_stop, content_len - window_stop, 1);
+        byte_buffer_append(&buffer, "", 1, 1);
+        new_content = buffer.data;
+        new_len = buffer.len - 1;
+    }
+    if (new_content == NULL) {
+        report("  Failed to open file for writing: %s\n", file->path);
+        text_arg_release(start_lines, start_line_count, start_owned);
+        text_arg_release(end_lines, end_line_count, end_owned);
+        free_string_array(lines, window_count);
+        line_table_free(&table);
+        return 0;
+    }
+
+    edit->line = actual_start_line;
+    edit->deleted = actual_end - actual_start_line + 1;
+    edit->inserted = new_str_count;
+
+    if (actual_start_line != start_line || actual_end != actual_end_line) {
+        report("  Replaced %d lines LN%d~%d (adjusted from requested LN%d~%d) in: %s\n",
+               actual_end - actual_start_line, actual_start_line, actual_end,
+               start_line, actual_end_line, file->path);
+    } else {
+        report("  Replaced %d lines LN%d~%d successfully in: %s\n",
+               end_line - start_line, start_line, end_line, file->path);
+    }
+    
+    // 释放内存（行表引用旧内容，须在替换文件内容之前释放）
+    text_arg_release(start_lines, start_line_count, start_owned);
+    text_arg_release(end_lines, end_line_count, end_owned);
+    free_string_array(lines, window_count);
+    line_table_free(&table);
+
+    file_state_replace(file, new_content, new_len, window_begin, window_stop);
+    return 1;
+}
+
+// ---- insert_lines、delete_lines、append：按行号编辑 ----
+
+// 校验guard：先比较期望位置expected（从0开始的行号），不匹配时在[expected - backward, expected + forward]内
+// 由近到远查找，返回guard第一行的行号，找不到时返回-1。只切分这个窗口内的行
+static int line_guard_locate(LineIndex* index, const char* content, size_t content_len,
+                             const TextArg* guard, char* guard_lines[], int guard_count,
+                             int expected, int backward, int forward) {
+    if (guard_count == 0) return expected;
+    if (backward < 0) backward = 0;
+    if (forward < 0) forward = 0;
+
+    int line_count = line_index_line_count(index, content, content_len);
+    long long window_end = (long long)expected + forward + guard_count;
+    if (window_end > line_count) window_end = line_count;
+    long long window_start = (long long)expected - backward;
+    if (window_start > window_end) window_start = window_end;
+    if (window_start < 0) window_start = 0;
+    int base = (int)window_start;
+
+    size_t begin = line_index_seek(index, content, content_len, base);
+    size_t stop = line_index_seek(index, content, content_len, (int)window_end);
+    LineTable table;
+    line_table_build(&table, content + begin, stop - begin);
+    char** lines = line_table_to_lines(&table);
+
+    int found = -1;
+    for (int distance = 0; found == -1 && (distance <= backward || distance <= forward); distance++) {
+        if (distance <= backward &&
+            is_multi_lines_equal(lines, table.count, expected - distance - base, guard_lines, guard_count)) {
+            found = expected - distance;
+        } else if (distance > 0 && distance <= forward &&
+                   is_multi_lines_equal(lines, table.count, expected + distance - base, guard_lines, guard_count)) {
+            found = expected + distance;
+        }
+    }
+
+    if (found == -1) {
+        int actual = expected - base;
+        report("  W: Guard not found near LN-%d (±%d lines). \n", expected + 1, backward + forward);
+        report("  REQEUSTED: '%s'\n", guard->text);
+        report("  ACTRUALLY: '%s'\n", (actual >= 0 && actual < table.count) ? lines[actual] : "");
+        diagnose_nearest(content, content_len, guard_lines, guard_count, expected + 1);
+    } else if (found != expected) {
+        report("  INFO: Guard found at LN-%d instead of LN-%d\n", found + 1, expected + 1);
+    }
+
+    free_string_array(lines, table.count);
+    line_table_free(&table);
+    return found;
+}
+
+// 插入new_str，使其成为第line行（line为-1时追加到文件末尾）；guard为插入位置之前的几行，
+// 不在原位时插入位置随guard移动。只切分插入位置前后两行，用于确定换行风格
+int insert_lines_at(FileState* file, int line, const TextArg* new_str, const TextArg* guard,
+                    int backward_scan_limit, int forward_scan_limit, EditResult* edit) {
+    size_t content_len = 0;
+    const char* content = file_state_load(file, &content_len);
+    if (content == NULL) {
+        if (file->status == FILE_MISSING) {
+            report("  File not found: %s\n", file->path);
+        } else {
+            report("Failed to open file: %s\n", file->path);
+        }
+        return 0;
+    }
+    LineIndex* index = file_state_line_index(file);
+    if (index == NULL) {
+        report("Failed to open file: %s\n", file->path);
+        return 0;
+    }
+    int line_count = line_index_line_count(index, content, content_len);
+
+    int requested = (line == -1) ? line_count + 1 : line;
+    if (requested < 1 || requested > line_count + 1) {
+        report("  Line %d is out of range (file has %d lines)\n", requested, line_count);
+        return 0;
+    }
+
+    int guard_count = 0, guard_owned = 0;
+    char** guard_lines = (guard->text != NULL) ? text_arg_lines(guard, NULL, &guard_count, &guard_owned) : NULL;
+    int found = line_guard_locate(index, content, content_len, guard, guard_lines, guard_count,
+                                  requested - 1 - guard_count, backward_scan_limit, forward_scan_limit);
+    text_arg_release(guard_lines, guard_count, guard_owned);
+    if (found == -1) return 0;
+    int actual = found + guard_count + 1;
+
+    // 行表只包含插入位置所在的行及其前一行：插入到没有换行结尾的最后一行之后时需要先补上换行
+    int base = (actual >= 2) ? actual - 2 : 0;
+    int stop_line = (actual <= line_count) ? actual : line_count;
+    size_t begin = line_index_seek(index, content, content_len, base);
+    size_t stop = line_index_seek(index, content, content_len, stop_line);
+    LineTable table;
+    line_table_build(&table, content + begin, stop - begin);
+    table.default_eol = line_index_default_eol(index, content, content_len);
+
+    ByteBuffer buffer = {0};
+    buffer.capacity = content_len + strlen(new_str->text) * 2 + 8;
+    buffer.data = (char*)malloc(buffer.capacity);
+    if (buffer.data == NULL) {
+        report("  Failed to open file for writing: %s\n", file->path);
+        line_table_free(&table);
+        return 0;
+    }
+    byte_buffer_append(&buffer, content, begin, 1);
+    int inserted = splice_line_text(&buffer, &table, actual - 1 - base, actual - 1 - base, new_str->text);
+    byte_buffer_append(&buffer, content + stop, content_len - stop, 1);
+    byte_buffer_append(&buffer, "", 1, 1);
+    line_table_free(&table);
+
+    edit->line = actual;
+    edit->deleted = 0;
+    edit->inserted = inserted;
+    if (line == -1) {
+        report("  Appended %d lines at LN-%d in: %s\n", inserted, actual, file->path);
+    } else if (actual != requested) {
+        report("  Inserted %d lines at LN-%d (adjusted from requested LN-%d) in: %s\n",
+               inserted, actual, requested, file->path);
+    } else {
+        report("  Inserted %d lines at LN-%d in: %s\n", inserted, actual, file->path);
+    }
+
+    file_state_replace(file, buffer.data, buffer.len - 1, begin, stop);
+    return 1;
+}
+
+// 删除第start_line~end_line行（end_line为-1时到文件末尾）；guard为被删除的开头几行，
+// 不在原位时整个区间随guard平移。删除的区间按字节跳过，不读取其中的行
+int delete_lines_at(FileState* file, int start_line, int end_line, const TextArg* guard,
+                    int backward_scan_limit, int forward_scan_limit, EditResult* edit) {
+    size_t content_len = 0;
+    const char* content = file_state_load(file, &content_len);
+    if (content == NULL) {
+        if (file->status == FILE_MISSING) {
+            report("  File not found: %s\n", file->path);
+        } else {
+            report("Failed to open file: %s\n", file->path);
+        }
+        return 0;
+    }
+    LineIndex* index = file_state_line_index(file);
+    if (index == NULL) {
+        report("Failed to open file: %s\n", file->path);
+        return 0;
+    }
+    int line_count = line_index_line_count(index, content, content_len);
+
+    if (start_line < 1 || start_line > line_count) {
+        report("  Start line %d exceeds file length %d\n", start_line, line_count);
+        return 0;
+    }
+    int requested_end = (end_line == -1) ? line_count : end_line;
+    if (requested_end < start_line) {
+        report("  End line %d is before start line %d\n", requested_end, start_line);
+        return 0;
+    }
+    if (requested_end > line_count) {
+        report("  End line %d exceeds file length %d\n", requested_end, line_count);
+        return 0;
+    }
+
+    int guard_count = 0, guard_owned = 0;
+    char** guard_lines = (guard->text != NULL) ? text_arg_lines(guard, NULL, &guard_count, &guard_owned) : NULL;
+    if (guard_count > requested_end - start_line + 1) {
+        report("  Guard has %d lines but only %d lines are deleted\n", guard_count, requested_end - start_line + 1);
+        text_arg_release(guard_lines, guard_count, guard_owned);
+        return 0;
+    }
+    int found = line_guard_locate(index, content, content_len, guard, guard_lines, guard_count,
+                                  start_line - 1, backward_scan_limit, forward_scan_limit);
+    text_arg_release(guard_lines, guard_count, guard_owned);
+    if (found == -1) return 0;
+
+    int actual_start = found + 1;
+    int actual_end = requested_end + (actual_start - start_line);
+    if (actual_end > line_count) {
+        report("  End line %d exceeds file length %d\n", actual_end, line_count);
+        return 0;
+    }
+
+    // 与按行替换为空内容相同：区间之外的字节（包括前一行的换行符）保持不变
+    size_t begin = line_index_seek(index, content, content_len, actual_start - 1);
+    size_t stop = line_index_seek(index, content, content_len, actual_end);
+    ByteBuffer buffer = {0};
+    buffer.capacity = content_len - (stop - begin) + 1;
+    buffer.data = (char*)malloc(buffer.capacity);
+    if (buffer.data == NULL) {
+        report("  Failed to open file for writing: %s\n", file->path);
+        return 0;
+    }
+    byte_buffer_append(&buffer, content, begin, 1);
+    byte_buffer_append(&buffer, content + stop, content_len - stop, 1);
+    byte_buffer_append(&buffer, "", 1, 1);
+
+    edit->line = actual_start;
+    edit->deleted = actual_end - actual_start + 1;
+    edit->inserted = 0;
+    if (actual_start != start_line) {
+        report("  Deleted %d lines LN%d~%d (adjusted from requested LN%d~%d) in: %s\n",
+               edit->deleted, actual_start, actual_end, start_line, requested_end, file->path);
+    } else {
+        report("  Deleted %d lines LN%d~%d in: %s\n", edit->deleted, actual_start, actual_end, file->path);
+    }
+
+    file_state_replace(file, buffer.data, buffer.len - 1, begin, stop);
+    return 1;
+}
+
+// ---- apply_patch：统一格式（unified diff）补丁，按文件逐段执行 ----
+
+// 补丁中的一个hunk：@@行之后的正文包含old_count行旧内容和new_count行新内容（上下文行同时计入两者）
+typedef struct {
+    int old_start;
+    int old_count;
+    int new_start;
+    int new_count;
+    size_t body;          // 正文在补丁中的起止偏移
+    size_t body_end;
+    int row;              // 在文件中定位到的起始行（从0开始）
+} PatchHunk;
+
+static size_t patch_line_end(const char* text, size_t len, size_t pos) {
+    const char* nl = (const char*)memchr(text + pos, '\n', len - pos);
+    return (nl != NULL) ? (size_t)(nl - text) : len;
+}
+
+static size_t patch_next_line(const char* text, size_t len, size_t pos) {
+    size_t end = patch_line_end(text, len, pos);
+    return (end < len) ? end + 1 : len;
+}
+
+// 正文中的一行：返回类型（' '、'-'、'+'或'\\'），[*start, *end)为去掉类型字符和行尾\r后的内容。
+// 编辑器或邮件去掉了行尾空白的空上下文行按空行处理
+static char patch_body_line(const char* text, size_t len, size_t pos, size_t* start, size_t* end) {
+    size_t line_end = patch_line_end(text, len, pos);
+    if (line_end > pos && text[line_end - 1] == '\r') line_end--;
+    *end = line_end;
+    if (line_end == pos) {
+        *start = pos;
+        return ' ';
+    }
+    *start = pos + 1;
+    return text[pos];
+}
+
+static int patch_parse_range(const char** p, int* start, int* count) {
+    char* end = NULL;
+    long value = strtol(*p, &end, 10);
+    if (end == *p || value < 0) return 0;
+    *start = (int)value;
+    *count = 1;
+    if (*end == ',') {
+        const char* q = end + 1;
+        value = strtol(q, &end, 10);
+        if (end == q || value < 0) return 0;
+        *count = (int)value;
+    }
+    *p = end;
+    return 1;
+}
+
+// 解析"@@ -a,b +c,d @@"，省略的行数为1
+static int patch_parse_hunk_header(const char* line, size_t line_len, PatchHunk* hunk) {
+    if (line_len < 4 || memcmp(line, "@@ -", 4) != 0) return 0;
+    const char* p = line + 4;
+    if (!patch_parse_range(&p, &hunk->old_start, &hunk->old_count)) return 0;
+    if (p[0] != ' ' || p[1] != '+') return 0;
+    p += 2;
+    if (!patch_parse_range(&p, &hunk->new_start, &hunk->new_count)) return 0;
+    return strncmp(p, " @@", 3) == 0;
+}
+
+// 按头部给出的行数读取hunk正文（不依赖"--- "等行判断结束，删除以"-- "开头的行不会被误认），
+// 正文之后紧跟的"\ No newline at end of file"同样属于该hunk，返回0表示格式错误
+static int patch_parse_hunk_body(const char* text, size_t len, size_t pos, PatchHunk* hunk) {
+    int old_left = hunk->old_count;
+    int new_left = hunk->new_count;
+    hunk->body = pos;
+    while (old_left > 0 || new_left > 0) {
+        if (pos >= len) return 0;
+        size_t start = 0, end = 0;
+        char type = patch_body_line(text, len, pos, &start, &end);
+        if (type == ' ') {
+            old_left--;
+            new_left--;
+        } else if (type == '-') {
+            old_left--;
+        } else if (type == '+') {
+            new_left--;
+        } else if (type != '\\') {
+            return 0;
+        }
+        if (old_left < 0 || new_left < 0) return 0;
+        pos = patch_next_line(text, len, pos);
+    }
+    while (pos < len && text[pos] == '\\') pos = patch_next_line(text, len, pos);
+    hunk->body_end = pos;
+    return 1;
+}
+
+// "+++ "或"--- "行中的路径：去掉制表符后的时间戳、行尾空白和外层引号，再去掉strip层目录前缀
+static int patch_parse_path(const char* name, size_t len, int strip, char* path, size_t size, int* dev_null) {
+    size_t n = 0;
+    while (n < len && name[n] != '\t' && name[n] != '\r') n++;
+    while (n > 0 && name[n - 1] == ' ') n--;
+    if (n >= 2 && name[0] == '"' && name[n - 1] == '"') {
+        name++;
+        n -= 2;
+    }
+    *dev_null = (n == 9 && memcmp(name, "/dev/null", 9) == 0);
+    for (int i = 0; i < strip && !*dev_null; i++) {
+        const char* slash = (const char*)memchr(name, '/', n);
+        if (slash == NULL) break;
+        n -= (size_t)(slash + 1 - name);
+        name = slash + 1;
+    }
+    if (n == 0 || n >= size) return 0;
+    memcpy(path, name, n);
+    path[n] = '\0';
+    return 1;
+}
+
+// 从*pos开始流式取出下一个文件的部分："--- "、"+++ "行及其后连续的hunk。
+// 返回1表示取出一个文件，0表示补丁中没有更多文件，-1表示格式错误（error_line为出错的行号）
+int patch_next_section(const char* text, size_t len, size_t* pos, int strip, PatchSection* section) {
+    size_t p = *pos;
+    while (p < len) {
+        size_t next = patch_next_line(text, len, p);
+        if (len - p < 4 || memcmp(text + p, "--- ", 4) != 0 ||
+            len - next < 4 || memcmp(text + next, "+++ ", 4) != 0) {
+            p = next;
+            continue;
+        }
+
+        int old_null = 0, new_null = 0;
+        size_t old_end = patch_line_end(text, len, p);
+        size_t new_end = patch_line_end(text, len, next);
+        char old_path[MAX_PATH_LEN];
+        if (!patch_parse_path(text + p + 4, old_end - p - 4, strip, old_path, sizeof(old_path), &old_null) ||
+            !patch_parse_path(text + next + 4, new_end - next - 4, strip, section->path, sizeof(section->path), &new_null)) {
+            section->error_line = (int)scan_count_newlines(text, next) + 1;
+            return -1;
+        }
+        section->create = old_null;
+        section->remove = new_null;
+        if (new_null) memcpy(section->path, old_path, sizeof(old_path));
+
+        size_t hunks = patch_next_line(text, len, next);
+        section->begin = hunks;
+        section->hunk_count = 0;
+        PatchHunk hunk;
+        while (hunks < len) {
+            size_t line_end = patch_line_end(text, len, hunks);
+            if (!patch_parse_hunk_header(text + hunks, line_end - hunks, &hunk)) break;
+            if (!patch_parse_hunk_body(text, len, patch_next_line(text, len, hunks), &hunk)) {
+                section->error_line = (int)scan_count_newlines(text, hunks) + 1;
+                return -1;
+            }
+            hunks = hunk.body_end;
+            section->hunk_count++;
+        }
+        section->end = hunks;
+        *pos = hunks;
+        // 没有hunk的文件（只修改权限、重命名等）不需要执行
+        if (section->hunk_count > 0) return 1;
+        p = hunks;
+    }
+    *pos = len;
+    return 0;
+}
+
+// 第row行起的各行是否与hunk的旧内容（上下文行和删除行）一致
+static int patch_hunk_matches(const LineTable* table, int row, const char* text, size_t len, const PatchHunk* hunk) {
+    if (row < 0 || row + hunk->old_count > table->count) return 0;
+    for (size_t pos = hunk->body; pos < hunk->body_end; pos = patch_next_line(text, len, pos)) {
+        size_t start = 0, end = 0;
+        char type = patch_body_line(text, len, pos, &start, &end);
+        if (type != ' ' && type != '-') continue;
+        size_t line_start = table->starts[row];
+        size_t line_len = line_table_end(table, row) - line_start;
+        if (line_len != end - start || memcmp(table->data + line_start, text + start, line_len) != 0) return 0;
+        row++;
+    }
+    return 1;
+}
+
+// 定位失败时取出hunk的旧内容，供诊断使用
+static char** patch_hunk_old_lines(const char* text, size_t len, const PatchHunk* hunk, int* count) {
+    char** lines = (char**)malloc((hunk->old_count + 1) * sizeof(char*));
+    *count = 0;
+    if (lines == NULL) return NULL;
+    for (size_t pos = hunk->body; pos < hunk->body_end; pos = patch_next_line(text, len, pos)) {
+        size_t start = 0, end = 0;
+        char type = patch_body_line(text, len, pos, &start, &end);
+        if (type == ' ' || type == '-') lines[(*count)++] = strndup(text + start, end - start);
+    }
+    return lines;
+}
+
+// 将一个文件的全部hunk应用到文件内容：先依次定位各hunk（在起始行附近的扫描范围内，
+// 位置按前面hunk的偏移修正），全部定位成功后一次生成新内容。任一hunk定位失败时不修改文件
+int apply_patch_section(FileState* file, const char* text, size_t len, size_t begin, size_t end,
+                        int hunk_count, int backward_scan_limit, int forward_scan_limit, EditResult* edit) {
+    size_t content_len = 0;
+    const char* content = file_state_load(file, &content_len);
+    if (content == NULL) {
+        if (file->status == FILE_MISSING) {
+            report("  File not found: %s\n", file->path);
+        } else {
+            report("  Failed to read file: %s\n", file->path);
+        }
+        return 0;
+    }
+
+    PatchHunk* hunks = (PatchHunk*)malloc(hunk_count * sizeof(PatchHunk));
+    LineTable table;
+    if (hunks == NULL || !line_table_build(&table, content, content_len)) {
+        report("  Failed to read file: %s\n", file->path);
+        free(hunks);
+        return 0;
+    }
+
+    int count = 0, offset = 0, min_row = 0, max_scan = backward_scan_limit;
+    if (forward_scan_limit > max_scan) max_scan = forward_scan_limit;
+    size_t pos = begin;
+    while (count < hunk_count && pos < end) {
+        PatchHunk* hunk = &hunks[count];
+        patch_parse_hunk_header(text + pos, patch_line_end(text, len, pos) - pos, hunk);
+        patch_parse_hunk_body(text, len, patch_next_line(text, len, pos), hunk);
+        pos = hunk->body_end;
+
+        // 旧内容为空的hunk插入在第old_start行之后，其余从第old_start行开始
+        int origin = (hunk->old_count > 0) ? hunk->old_start - 1 : hunk->old_start;
+        int expected = origin + offset;
+        if (expected < min_row) expected = min_row;
+        if (expected > table.count) expected = table.count;
+
+        int found = -1;
+        if (hunk->old_count == 0) {
+            found = expected;
+        } else {
+            for (int d = 0; d <= max_scan && found < 0; d++) {
+                if (d <= backward_scan_limit && expected - d >= min_row &&
+                    patch_hunk_matches(&table, expected - d, text, len, hunk)) {
+                    found = expected - d;
+                } else if (d > 0 && d <= forward_scan_limit &&
+                           patch_hunk_matches(&table, expected + d, text, len, hunk)) {
+                    found = expected + d;
+                }
+            }
+        }
+        if (found < 0) {
+            report("  Hunk #%d (@@ -%d,%d +%d,%d @@) not found near LN-%d (-%d/+%d lines) in: %s\n",
+                   count + 1, hunk->old_start, hunk->old_count, hunk->new_start, hunk->new_count,
+                   expected + 1, backward_scan_limit, forward_scan_limit, file->path);
+            int old_count = 0;
+            char** old_lines = patch_hunk_old_lines(text, len, hunk, &old_count);
+            diagnose_nearest(content, content_len, old_lines, old_count, expected + 1);
+            free_string_array(old_lines, old_count);
+            free(hunks);
+            line_table_free(&table);
+            return 0;
+        }
+        if (found != expected) {
+            report("  INFO: Hunk #%d applied at LN-%d (offset %+d lines)\n", count + 1, found + 1, found - origin);
+        }
+        hunk->row = found;
+        offset = found - origin;
+        min_row = found + hunk->old_count;
+        count++;
+    }
+
+    // 一次生成新内容：hunk之间按原始字节复制，上下文行保留原有的字节和换行，新增行使用所在位置的换行风格
+    ByteBuffer buffer = {0};
+    buffer.capacity = content_len + (end - begin) * 2 + 16;
+    buffer.data = (char*)malloc(buffer.capacity);
+    if (buffer.data == NULL) {
+        report("  Failed to open file for writing: %s\n", file->path);
+        free(hunks);
+        line_table_free(&table);
+        return 0;
+    }
+
+    int cursor = 0;
+    int need_eol = 0;           // 上一行是没有换行结尾的最后一行，其后还有内容时先补上换行
+    size_t last_eol_len = 0;
+    const char* default_eol = line_table_default_eol(&table);
+    int added = 0, removed = 0;
+    for (int h = 0; h < count; h++) {
+        const PatchHunk* hunk = &hunks[h];
+        size_t copy_from = (cursor < table.count) ? table.starts[cursor] : content_len;
+        size_t copy_to = (hunk->row < table.count) ? table.starts[hunk->row] : content_len;
+        byte_buffer_append(&buffer, content + copy_from, copy_to - copy_from, 1);
+
+        const char* eol = default_eol;
+        if (hunk->row < table.count && line_table_eol(&table, hunk->row)[0] != '\0') {
+            eol = line_table_eol(&table, hunk->row);
+        }
+        if (copy_to == content_len && content_len > 0 && content[content_len - 1] != '\n') need_eol = 1;
+
+        int row = hunk->row;
+        int new_side = 0;
+        for (size_t p = hunk->body; p < hunk->body_end; p = patch_next_line(text, len, p)) {
+            size_t start = 0, stop = 0;
+            char type = patch_body_line(text, len, p, &start, &stop);
+            if (type == '-') {
+                row++;
+                removed++;
+                new_side = 0;
+                continue;
+            }
+            if (type == '\\') {
+                // 新内容的最后一行没有换行
+                if (new_side) {
+                    buffer.len -= last_eol_len;
+                    last_eol_len = 0;
+                    need_eol = 1;
+                }
+                continue;
+            }
+            if (need_eol) {
+                byte_buffer_append(&buffer, eol, strlen(eol), 1);
+                need_eol = 0;
+            }
+            if (type == ' ') {
+                const char* line_eol = line_table_eol(&table, row);
+                byte_buffer_append(&buffer, content + table.starts[row], line_table_next(&table, row) - table.starts[row], 1);
+                last_eol_len = strlen(line_eol);
+                if (last_eol_len == 0) need_eol = 1;
+                row++;
+            } else {
+                byte_buffer_append(&buffer, text + start, stop - start, 1);
+                byte_buffer_append(&buffer, eol, strlen(eol), 1);
+                last_eol_len = strlen(eol);
+                added++;
+            }
+            new_side = 1;
+        }
+        cursor = hunk->row + hunk->old_count;
+    }
+    if (cursor < table.count) {
+        if (need_eol) byte_buffer_append(&buffer, default_eol, strlen(default_eol), 1);
+        byte_buffer_append(&buffer, content + table.starts[cursor], content_len - table.starts[cursor], 1);
+    }
+    byte_buffer_append(&buffer, "", 1, 1);
+
+    // 按覆盖全部hunk的区间记录，供后续命令换算行号
+    int first = hunks[0].row;
+    int last = hunks[count - 1].row + hunks[count - 1].old_count;
+    int line_change = 0;
+    for (int h = 0; h < count; h++) line_change += hunks[h].new_count - hunks[h].old_count;
+    edit->line = first + 1;
+    edit->deleted = last - first;
+    edit->inserted = last - first + line_change;
+    report("  Applied %d hunks at LN%d~%d (-%d +%d lines) in: %s\n", count, first + 1, last, removed, added, file->path);
+
+    size_t span_begin = line_table_start(&table, hunks[0].row);
+    size_t span_end = line_table_start(&table, cursor);
+    free(hunks);
+    line_table_free(&table);
+    file_state_replace(file, buffer.data, buffer.len - 1, span_begin, span_end);
+    return 1;
+}
+
+// ---- replace_block：按开头定位代码块，括号匹配确定块的结束位置 ----
+
+#define BLOCK_TEMPLATE_MAX 64   // 模板字符串中${...}的最大嵌套层数
+
+// 去除首尾空白后的区间
+static const char* block_trim_span(const char* text, size_t len, size_t* out_len) {
+    while (len > 0 && isspace((unsigned char)*text)) {
+        text++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)text[len - 1])) len--;
+    *out_len = len;
+    return text;
+}
+
+static int block_is_ident(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// 跳过"..."或JS/TS中'...'形式的字符串，遇到未转义的换行时视为结束（避免不完整的字符串吞掉后续代码）
+static size_t block_skip_quoted(const char* data, size_t len, size_t pos, char quote) {
+    pos++;
+    while (pos < len) {
+        char c = data[pos];
+        if (c == '\\') {
+            pos += 2;
+        } else if (c == quote) {
+            return pos + 1;
+        } else if (c == '\n') {
+            return pos;
+        } else {
+            pos++;
+        }
+    }
+    return len;
+}
+
+// C/C++的字符字面量：只接受'x'、'\n'等短形式（含UTF-8多字节字符），
+// 其余单引号（Rust生命周期、C++14数字分隔符）按普通字符处理
+static size_t block_skip_char_literal(const char* data, size_t len, size_t pos) {
+    size_t limit = (pos + 12 < len) ? pos + 12 : len;
+    if (pos + 1 < len && data[pos + 1] == '\\') {
+        for (size_t i = pos + 3; i < limit && data[i] != '\n'; i++) {
+            if (data[i] == '\'') return i + 1;
+        }
+        return pos + 1;
+    }
+    if (pos + 2 < len && data[pos + 2] == '\'') return pos + 3;
+    for (size_t i = pos + 1; i < limit && (unsigned char)data[i] >= 0x80; i++) {
+        if (i + 1 < len && data[i + 1] == '\'') return i + 2;
+    }
+    return pos + 1;
+}
+
+// C++原始字符串R"delim(...)delim"，pos指向引号；不是原始字符串时返回0
+static size_t block_skip_raw_string(const char* data, size_t len, size_t pos) {
+    if (pos == 0 || data[pos - 1] != 'R') return 0;
+    if (pos >= 2 && block_is_ident(data[pos - 2]) &&
+        !(data[pos - 2] == 'L' || data[pos - 2] == 'u' || data[pos - 2] == 'U' || data[pos - 2] == '8')) {
+        return 0;
+    }
+
+    char terminator[20];
+    size_t delim_len = 0;
+    size_t i = pos + 1;
+    while (i < len && data[i] != '(' && delim_len < 16) {
+        if (data[i] == ')' || data[i] == '\\' || isspace((unsigned char)data[i]) || data[i] == '"') return 0;
+        terminator[1 + delim_len++] = data[i++];
+    }
+    if (i >= len || data[i] != '(') return 0;
+    terminator[0] = ')';
+    terminator[1 + delim_len] = '"';
+
+    const char* end = (const char*)memmem(data + i + 1, len - i - 1, terminator, delim_len + 2);
+    return (end != NULL) ? (size_t)(end - data) + delim_len + 2 : len;
+}
+
+// 扫描模板字符串的内容，到结束的`（*expr为0）或${（*expr为1）为止，返回其后的位置
+static size_t block_skip_template(const char* data, size_t len, size_t pos, int* expr) {
+    *expr = 0;
+    while (pos < len) {
+        char c = data[pos];
+        if (c == '\\') {
+            pos += 2;
+        } else if (c == '`') {
+            return pos + 1;
+        } else if (c == '$' && pos + 1 < len && data[pos + 1] == '{') {
+            *expr = 1;
+            return pos + 2;
+        } else {
+            pos++;
+        }
+    }
+    return len;
+}
+
+// 从pos开始一次线性扫描：找到第一个不在括号内的'{'以及与之配对的'}'，跳过字符串、字符字面量、
+// 注释、C++原始字符串，以及（templates为1时）JS/TS模板字符串和其中的${...}。
+// 返回1表示找到；返回0表示在'{'之前遇到了';'或外层的'}'（没有块体），返回-1表示括号不配对
+static int block_scan(const char* data, size_t len, size_t pos, int templates, size_t* open, size_t* close) {
+    int depth = 0;
+    int parens = 0;
+    int opened = 0;
+    int template_depth[BLOCK_TEMPLATE_MAX];
+    int template_count = 0;
+
+    while (pos < len) {
+        char c = data[pos];
+        char next = (pos + 1 < len) ? data[pos + 1] : '\0';
+
+        if (c == '/' && next == '/') {
+            const char* nl = (const char*)memchr(data + pos, '\n', len - pos);
+            pos = (nl != NULL) ? (size_t)(nl - data) + 1 : len;
+        } else if (c == '/' && next == '*') {
+            const char* end = (const char*)memmem(data + pos + 2, len - pos - 2, "*/", 2);
+            if (end == NULL) return -1;
+            pos = (size_t)(end - data) + 2;
+        } else if (c == '"') {
+            size_t raw_end = block_skip_raw_string(data, len, pos);
+            pos = (raw_end != 0) ? raw_end : block_skip_quoted(data, len, pos, '"');
+        } else if (c == '\'') {
+            pos = templates ? block_skip_quoted(data, len, pos, '\'') : block_skip_char_literal(data, len, pos);
+        } else if (c == '`' && templates) {
+            int expr = 0;
+            pos = block_skip_template(data, len, pos + 1, &expr);
+            if (expr) {
+                if (template_count == BLOCK_TEMPLATE_MAX) return -1;
+                template_depth[template_count++] = depth++;
+            }
+        } else if (c == '{') {
+            if (!opened && parens == 0 && depth == 0) {
+                opened = 1;
+                *open = pos;
+            }
+            depth++;
+            pos++;
+        } else if (c == '}') {
+            if (template_count > 0 && depth - 1 == template_depth[template_count - 1]) {
+                // ${...}结束，回到模板字符串中继续扫描
+                template_count--;
+                depth--;
+                int expr = 0;
+                pos = block_skip_template(data, len, pos + 1, &expr);
+                if (expr) template_depth[template_count++] = depth++;
+                continue;
+            }
+            if (--depth < 0) return 0;
+            if (opened && depth == 0) {
+                *close = pos;
+                return 1;
+            }
+            pos++;
+        } else if (!opened && depth == 0) {
+            // 块体之前：括号内的'{'不是块的开始，括号外的';'表示只有声明
+            if (c == '(' || c == '[') parens++;
+            if ((c == ')' || c == ']') && parens > 0) parens--;
+            if (c == ';' && parens == 0) return 0;
+            pos++;
+        } else {
+            pos++;
+        }
+    }
+    return opened ? -1 : 0;
+}
+
+// 偏移所在的行（从0开始）
+static int block_line_of(const LineTable* table, size_t offset) {
+    int low = 0, high = table->count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (table->starts[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+// 第row行起是否依次与header的各行相同（去除首尾空白后比较）
+static int block_header_at(const LineTable* table, int row, char* header_lines[], int header_count) {
+    if (row + header_count > table->count) return 0;
+    for (int i = 0; i < header_count; i++) {
+        size_t line_len = 0, header_len = 0;
+        const char* line = block_trim_span(table->data + table->starts[row + i],
+                                           line_table_end(table, row + i) - table->starts[row + i], &line_len);
+        const char* header = block_trim_span(header_lines[i], strlen(header_lines[i]), &header_len);
+        if (line_len != header_len || memcmp(line, header, line_len) != 0) return 0;
+    }
+    return 1;
+}
+
+// 按开头定位代码块并整体替换：开头所在行到配对的'}'所在行替换为new_str，
+// '}'之后同一行的其余内容保留在new_str之后
+int replace_block(FileState* file, const TextArg* header, int start_line, const TextArg* new_str, EditResult* edit) {
+    size_t content_len = 0;
+    const char* content = file_state_load(file, &content_len);
+    if (content == NULL) {
+        if (file->status == FILE_MISSING) {
+            report("  File not found: %s\n", file->path);
+        } else {
+            report("Failed to open file: %s\n", file->path);
+        }
+        return 0;
+    }
+
+    int header_count = 0, header_owned = 0;
+    char** header_lines = text_arg_lines(header, NULL, &header_count, &header_owned);
+    size_t first_len = 0;
+    const char* first = (header_count > 0) ? block_trim_span(header_lines[0], strlen(header_lines[0]), &first_len) : "";
+    if (first_len == 0) {
+        report("  Block header is empty\n");
+        text_arg_release(header_lines, header_count, header_owned);
+        return 0;
+    }
+
+    LineTable table;
+    if (!line_table_build(&table, content, content_len)) {
+        report("Failed to open file: %s\n", file->path);
+        text_arg_release(header_lines, header_count, header_owned);
+        return 0;
+    }
+
+    // 查找开头：先比较首行去除空白后的长度和首字节，再逐行确认；有多处时取离startLine最近的一处
+    int found = -1, matches = 0;
+    int shown[3];
+    for (int row = 0; row < table.count; row++) {
+        const char* line = table.data + table.starts[row];
+        size_t line_len = line_table_end(&table, row) - table.starts[row];
+        if (line_len < first_len) continue;
+        line = block_trim_span(line, line_len, &line_len);
+        if (line_len != first_len || line[0] != first[0] || !block_header_at(&table, row, header_lines, header_count)) {
+            continue;
+        }
+        if (matches < 3) shown[matches] = row + 1;
+        matches++;
+        if (found < 0 || (start_line > 0 && abs(row + 1 - start_line) < abs(found + 1 - start_line))) {
+            found = row;
+        }
+    }
+    if (matches == 0) {
+        report("  Block header not found: '%.*s'\n", (int)first_len, first);
+        diagnose_nearest(content, content_len, header_lines, header_count, start_line);
+    }
+    text_arg_release(header_lines, header_count, header_owned);
+    if (matches == 0) {
+        line_table_free(&table);
+        return 0;
+    }
+    if (matches > 1 && start_line <= 0) {
+        char locations[64];
+        int written = snprintf(locations, sizeof(locations), "LN-%d, LN-%d", shown[0], shown[1]);
+        if (matches > 2) {
+            snprintf(locations + written, sizeof(locations) - written, (matches > 3) ? ", LN-%d, ..." : ", LN-%d", shown[2]);
+        }
+        report("  Block header matches %d locations (%s), specify startLine to choose one\n", matches, locations);
+        line_table_free(&table);
+        return 0;
+    }
+
+    // 一次线性扫描找到块的结束位置
+    int templates = is_special_extension(get_file_extension(file->path));
+    size_t open = 0, close = 0;
+    int scanned = block_scan(content, content_len, table.starts[found], templates, &open, &close);
+    if (scanned <= 0) {
+        if (scanned == 0) {
+            report("  No block body found after header at LN-%d\n", found + 1);
+        } else {
+            report("  Unbalanced braces in block starting at LN-%d\n", found + 1);
+        }
+        line_table_free(&table);
+        return 0;
+    }
+    int end_row = block_line_of(&table, close);
+
+    // '}'之后同一行还有内容（如"} else {"、"};"、"}, {"）时只替换到'}'为止，保留其后的内容
+    size_t tail = close + 1;
+    size_t line_end = line_table_end(&table, end_row);
+    while (tail < line_end && isspace((unsigned char)content[tail])) tail++;
+    int keep_tail = (tail < line_end);
+
+    ByteBuffer buffer = {0};
+    buffer.capacity = content_len + strlen(new_str->text) * 2 + 8;
+    buffer.data = (char*)malloc(buffer.capacity);
+    if (buffer.data == NULL) {
+        report("  Failed to open file for writing: %s\n", file->path);
+        line_table_free(&table);
+        return 0;
+    }
+    int insert_count = 0;
+    if (keep_tail) {
+        // 与split_lines一致：去掉new_str末尾的换行，使其最后一行与'}'之后的内容相接
+        size_t text_len = strlen(new_str->text);
+        if (text_len > 0 && new_str->text[text_len - 1] == '\n') text_len--;
+        if (text_len > 0 && new_str->text[text_len - 1] == '\r') text_len--;
+        insert_count = (int)scan_count_newlines(new_str->text, text_len) + 1;
+        byte_buffer_append(&buffer, content, table.starts[found], 1);
+        byte_buffer_append_eol(&buffer, new_str->text, text_len, detect_eol_at(content, content_len, close));
+        byte_buffer_append(&buffer, content + close + 1, content_len - close - 1, 1);
+    } else {
+        insert_count = splice_line_text(&buffer, &table, found, end_row + 1, new_str->text);
+    }
+    byte_buffer_append(&buffer, "", 1, 1);
+
+    edit->line = found + 1;
+    edit->deleted = end_row - found + 1;
+    edit->inserted = insert_count;
+    if (matches > 1) {
+        report("  Replaced block LN%d~%d (nearest of %d matches to LN-%d) in: %s\n",
+               found + 1, end_row + 1, matches, start_line, file->path);
+    } else {
+        report("  Replaced block LN%d~%d successfully in: %s\n", found + 1, end_row + 1, file->path);
+    }
+
+    size_t span_begin = table.starts[found];
+    size_t span_end = keep_tail ? close + 1 : line_table_start(&table, end_row + 1);
+    line_table_free(&table);
+    file_state_replace(file, buffer.data, buffer.len - 1, span_begin, span_end);
+    return 1;
+}
+
+// 辅助函数实现
+// 获取文件扩展名
+char* get_file_extension(const char* file_path) {
+    const char* dot = strrchr(file_path, '.');
+    if (dot == NULL || dot == file_path) return "";
+    return (char*)dot + 1;
+}
+
+// 检查是否是特定扩展名（不区分大小写）
+int is_special_extension(const char* ext) {
+    char lower_ext[16] = {0};
+    for (int i = 0; ext[i] && i < 15; i++) {
+        lower_ext[i] = tolower(ext[i]);
+    }
+    return (strcmp(lower_ext, "js") == 0 ||
+            strcmp(lower_ext, "ts") == 0 ||
+            strcmp(lower_ext, "tsx") == 0);
+}
+
+char* trim(char* str) {
+    if (str == NULL) return NULL;
+    
+    // 去除尾部空白
+    char* end = str + strlen(str) - 1;
+    while (end >= str && isspace(*end)) end--;
+    *(end + 1) = '\0';
+    
+    // 去除头部空白
+    while (isspace(*str)) str++;
+    
+    return str;
+}
+
+char* str_replace(const char* str, const char* old, const char* new) {
+    if (str == NULL || old == NULL || new == NULL) return NULL;
+    
+    int old_len = strlen(old);
+    int new_len = strlen(new);
+    
+    // 计算新字符串的长度
+    int count = 0;
+    const char* pos = str;
+    while ((pos = strstr(pos, old)) != NULL) {
+        count++;
+        pos += old_len;
+    }
+    
+    int new_size = strlen(str) + count * (new_len - old_len) + 1;
+    char* result = (char*)malloc(new_size);
+    if (result == NULL) return NULL;
+    
+    char* current = result;
+    const char* start = str;
+    while ((pos = strstr(start, old)) != NULL) {
+        int segment_len = pos - start;
+        memcpy(current, start, segment_len);
+        current += segment_len;
+        memcpy(current, new, new_len);
+        current += new_len;
+        start = pos + old_len;
+    }
+    
+    strcpy(current, start);
+    return result;
+}
+
+char* read_file(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    char* content = (char*)malloc(size + 1);
+    if (content == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    
+    fread(content, 1, size, file);
+    content[size] = '\0';
+    fclose(file);
+    
+    return content;
+}
+
+int write_file(const char* filename, const char* content) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) return 0;
+    
+    fwrite(content, 1, strlen(content), file);
+    fclose(file);
+    
+    return 1;
+}
+
+int file_exists(const char* filename) {
+    struct stat buffer;
+    return (stat(filename, &buffer) == 0);
+}
+
+// 映射文本文件：先保留文件长度+1字节（按页取整）的匿名映射，再将文件覆盖映射到起始处，
+// 文件末尾之后的字节为0，不复制即可作为\0结尾的字符串使用。
+// 私有映射可以原地修改（只复制被修改的页），不会写回文件
+int mapped_text_open(const char* path, MappedText* map) {
+    memset(map, 0, sizeof(*map));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_len = (size / page + 1) * page;
+    char* data = (char*)mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    if (size > 0 && mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(data, map_len);
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    map->data = data;
+    map->len = size;
+    map->map_len = map_len;
+    return 1;
+}
+
+void mapped_text_close(MappedText* map) {
+    if (map->data != NULL) munmap(map->data, map->map_len);
+    memset(map, 0, sizeof(*map));
+}
+
+int index_to_line(const char* str, int index) {
+    if (str == NULL || index < 0 || index > (int)strlen(str)) return 0;
+    return (int)scan_count_newlines(str, index) + 1;
+}
+
+int count_newlines(const char* str, size_t len) {
+    return (int)scan_count_newlines(str, len);
+}
+
+// 按split_lines的规则计算行数（末尾换行不计为新的一行）
+int count_lines(const char* str) {
+    size_t len = strlen(str);
+    if (len == 0) return 0;
+    return count_newlines(str, len) + (str[len - 1] != '\n');
+}
+
+// 取得文本参数的行：优先使用执行计划中预先切分的行，否则现场切分；
+// special_path非NULL时按该文件类型处理JS/TS模板字符串中的转义换行
+char** text_arg_lines(const TextArg* arg, const char* special_path, int* count, int* owned) {
+    if (arg->lines != NULL) {
+        *count = arg->line_count;
+        *owned = 0;
+        return arg->lines;
+    }
+    *owned = 1;
+    if (special_path != NULL) {
+        return split_special_multiline(special_path, arg->text, count);
+    }
+    return split_lines(arg->text, count);
+}
+
+void text_arg_release(char** lines, int count, int owned) {
+    if (owned) free_string_array(lines, count);
+}
+
+int find_first_line(char* lines[], int line_count, int start_index, const char* search) {
+    if (start_index >= line_count) return -1;
+    
+    for (int i = start_index; i < line_count && i < start_index + 10; i++) {
+        char* trimmed_line = trim(strdup(lines[i]));
+        char* trimmed_search = trim(strdup(search));
+        int result = (strcmp(trimmed_line, trimmed_search) == 0);
+        free(trimmed_line);
+        free(trimmed_search);
+        
+        if (result) return i;
+    }
+    
+    return -1;
+}
+
+int find_last_line(char* lines[], int line_count, int start_index, const char* search) {
+    if (start_index >= line_count) return -1;
+    
+    for (int i = start_index; i < line_count && i < start_index + 30; i++) {
+        // 去除尾部空白比较
+        char line_copy[MAX_LINE_LEN];
+        strcpy(line_copy, lines[i]);
+        char* line_end = line_copy + strlen(line_copy) - 1;
+        while (line_end >= line_copy && isspace(*line_end)) line_end--;
+        *(line_end + 1) = '\0';
+        
+        char search_copy[MAX_LINE_LEN];
+        strcpy(search_copy, search);
+        char* search_end = search_copy + strlen(search_copy) - 1;
+        while (search_end >= search_copy && isspace(*search_end)) search_end--;
+        *(search_end + 1) = '\0';
+        
+        if (strcmp(line_copy, search_copy) == 0) return i;
+    }
+    
+    return -1;
+}
+
+int is_line_text_equal(const char* line1, const char* line2, int line_number) {
+    if (strcmp(line1, line2) == 0) return 1;
+    
+    if (line_number != -1) {
+        report("==== LN-%d: This Line is Not Equal ==== \n", line_number);
+        report("REQEUSTED: %s\n\n", line2);
+        report("ACTRUALLY: %s\n\n", line1);
+    }
+    
+    return 0;
+}
+
+// 在start_line附近的扫描范围内逐行匹配查找文本，返回匹配的起始行下标，不匹配时返回-1；
+// verbose为真时输出不匹配的原因
+static int match_lines_near(char* content_lines[], int line_count, int start_line,
+                            char* search_lines[], int search_count,
+                            int backward_scan_limit, int forward_scan_limit, int verbose) {
+    // 检查第一行
+    int search_start_line = start_line - backward_scan_limit;
+    if (search_start_line < 0) search_start_line = 0;
+    int search_end_line = start_line + forward_scan_limit;
+
+    int start_row = -1;
+    for (int i = search_start_line; i <= search_end_line && i < line_count; i++) {
+        if (strcmp(content_lines[i], search_lines[0]) == 0) {
+            start_row = i;
+            break;
+        }
+    }
+
+    if (start_row == -1) {
+        if (verbose) report("  E: First line mismatch near LN-%d (±%d lines)\n", start_line, backward_scan_limit + forward_scan_limit);
+        return -1;
+    }
+
+    if (start_row + search_count > line_count) {
+        if (verbose) {
+            report("  E: Total lines of the searching content is more than the rest lines of source\n");
+            report("  Searching lines sum: %d, but %d lines from LN-%d to the source.\n",
+                   search_count, line_count - start_line, start_line);
+        }
+        return -1;
+    }
+
+    if (search_count > 1) {
+        // 检查最后一行
+        int search_end_start = start_row + search_count;
+        int search_end_limit = forward_scan_limit;
+        int end = -1;
+        for (int i = search_end_start; i < search_end_start + search_end_limit && i < line_count; i++) {
+            if (strcmp(content_lines[i], search_lines[search_count - 1]) == 0) {
+                end = i;
+                break;
+            }
+        }
+
+        if (end == -1) {
+            if (verbose) report("  Last line mismatch near LN-%d.\n", start_row + search_count);
+            return -1;
+        }
+
+        // 检查其他行
+        if (search_count > 2) {
+            for (int i = 1; i < search_count - 1; i++) {
+                if (!is_line_text_equal(content_lines[start_row + i], search_lines[i], -1)) {
+                    if (verbose) {
+                        report("  Matched first %d lines, but mismatch at at LN-%d\n", i, start_row + i);
+                        is_line_text_equal(content_lines[start_row + i], search_lines[i], start_row + i);
+                    }
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return start_row;
+}
+
+int replace_line_by_line(FileState* file, const LineTable* table, char* content_lines[], int line_count,
+                         int start_line, char* search_lines[], const uint64_t* search_hashes, int search_count,
+                         char* insert_lines[], int insert_count,
+                         int backward_scan_limit, int forward_scan_limit, EditResult* edit) {
+    int start_row = match_lines_near(content_lines, line_count, start_line, search_lines, search_count,
+                                     backward_scan_limit, forward_scan_limit, 0);
+    if (start_row == -1) {
+        // 扫描范围内没有匹配时，用查找文本中的唯一行在整个文件中定位
+        start_row = locate_by_anchors(table->data, table->len, search_lines, search_hashes, search_count);
+        if (start_row == -1) {
+            // 重新检查一次以输出不匹配的详细信息
+            match_lines_near(content_lines, line_count, start_line, search_lines, search_count,
+                             backward_scan_limit, forward_scan_limit, 1);
+            diagnose_nearest(table->data, table->len, search_lines, search_count, start_line);
+            return 0;
+        }
+        report("  INFO: Located by anchor lines at LN-%d, outside the scan range near LN-%d\n",
+               start_row + 1, start_line);
+    }
+
+    // 所有行匹配，执行替换（区间之外按原始字节写回）
+    size_t new_len = 0;
+    char* new_content = splice_lines(table, start_row, start_row + search_count, insert_lines, insert_count, &new_len);
+    if (new_content == NULL) {
+        report("  Failed to open file for writing: %s\n", file->path);
+        return 0;
+    }
+
+    edit->line = start_row + 1;
+    edit->deleted = search_count;
+    edit->inserted = insert_count;
+
+    file_state_replace(file, new_content, new_len, line_table_start(table, start_row),
+                       line_table_start(table, start_row + search_count));
+    return 1;
+}
+
+// ---- 不匹配时的诊断：用位并行（Myers）近似查找列出与查找文本最接近的几处 ----
+
+#define DIAG_PATTERN_MAX 512    // 参与近似查找的最大字节数，更长的查找文本只取开头
+#define DIAG_DIFF_LINES 8       // 每个候选最多列出的差异行数
+#define DIAG_LCS_MAX 256        // 候选或查找文本超过该行数时按行号对齐比较，不计算LCS
+#define DIAG_DISPLAY_MAX 160    // 差异行最多显示的字节数
+
+// 列出的候选个数，0表示关闭诊断
+static int diagnose_candidates = 0;
+
+// Myers位并行编辑距离：模式按64位分块，每读入文本的一个字节更新一列
+typedef struct {
+    int words;
+    uint64_t* peq;      // peq[c * words + w]：字节c在模式中出现的位置
+    uint64_t* pv;       // 纵向差值为+1/-1的位置
+    uint64_t* mv;
+    int* block_score;   // 各块最后一行的编辑距离（只对查找带内的块有效）
+    uint64_t high;      // 最后一块中模式末字节对应的位
+    int length;
+    int score;          // 当前列最后一行的编辑距离
+} MyersState;
+
+static void myers_free(MyersState* state) {
+    free(state->peq);
+    free(state->pv);
+    free(state->mv);
+    free(state->block_score);
+}
+
+static int myers_init(MyersState* state, const char* pattern, int length, int reverse) {
+    state->words = (length + 63) / 64;
+    state->peq = (uint64_t*)calloc((size_t)256 * state->words, sizeof(uint64_t));
+    state->pv = (uint64_t*)malloc(state->words * sizeof(uint64_t));
+    state->mv = (uint64_t*)calloc(state->words, sizeof(uint64_t));
+    state->block_score = (int*)malloc(state->words * sizeof(int));
+    if (state->peq == NULL || state->pv == NULL || state->mv == NULL || state->block_score == NULL) {
+        myers_free(state);
+        return 0;
+    }
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)pattern[reverse ? length - 1 - i : i];
+        state->peq[c * state->words + i / 64] |= 1ULL << (i % 64);
+    }
+    memset(state->pv, 0xff, state->words * sizeof(uint64_t));
+    state->high = 1ULL << ((length - 1) % 64);
+    state->length = length;
+    state->score = length;
+    return 1;
+}
+
+// 读入一个字节后更新一块：eq为该字节在块内的出现位置，high为块最后一行对应的位，
+// hin为块上方一行的横向差值，返回块最后一行的横向差值
+static inline int myers_advance(uint64_t* pv_block, uint64_t* mv_block, uint64_t eq, uint64_t high, int hin) {
+    uint64_t pv = *pv_block;
+    uint64_t mv = *mv_block;
+    uint64_t hin_neg = (hin < 0);
+    uint64_t hin_pos = (hin > 0);
+    uint64_t xv = eq | mv;
+    eq |= hin_neg;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+
+    // 分支在文本逐字节的循环中难以预测，改为按位计算
+    int hout = (int)((ph & high) != 0) - (int)((mh & high) != 0);
+    ph = (ph << 1) | hin_pos;
+    mh = (mh << 1) | hin_neg;
+    *pv_block = mh | ~(xv | ph);
+    *mv_block = ph & xv;
+    return hout;
+}
+
+// 读入一个字节并计算所有块；hin为1表示匹配从第一个读入的字节开始（第0行逐列加1）
+static int myers_step(MyersState* state, unsigned char c, int hin) {
+    const uint64_t* peq = state->peq + (size_t)c * state->words;
+    int last = state->words - 1;
+    for (int w = 0; w <= last; w++) {
+        hin = myers_advance(&state->pv[w], &state->mv[w], peq[w], (w == last) ? state->high : (1ULL << 63), hin);
+    }
+    state->score += hin;
+    return state->score;
+}
+
+// 近似查找（匹配可以从任意位置开始）只需计算编辑距离可能不超过limit的前active+1块，
+// 其余块的值必然大于limit，按需启用或停用（Myers 1999的分块算法）
+static void myers_search_begin(MyersState* state, int limit, int* active) {
+    *active = (limit + 63) / 64 - 1;
+    if (*active < 0) *active = 0;
+    if (*active > state->words - 1) *active = state->words - 1;
+    for (int w = 0; w <= *active; w++) {
+        state->pv[w] = ~0ULL;
+        state->mv[w] = 0;
+        state->block_score[w] = (w == state->words - 1) ? state->length : (w + 1) * 64;
+    }
+}
+
+// 读入一个字节，返回模式最后一行的编辑距离；超过limit时返回-1
+static int myers_search_step(MyersState* state, unsigned char c, int limit, int* active) {
+    const uint64_t* peq = state->peq + (size_t)c * state->words;
+    uint64_t* pv = state->pv;
+    uint64_t* mv = state->mv;
+    int* block_score = state->block_score;
+    int last = state->words - 1;
+    uint64_t last_high = state->high;
+    int y = *active;
+
+    int carry = 0;
+    for (int w = 0; w <= y; w++) {
+        carry = myers_advance(&pv[w], &mv[w], peq[w], (w == last) ? last_high : (1ULL << 63), carry);
+        block_score[w] += carry;
+    }
+    if (y < last && block_score[y] - carry <= limit && ((peq[y + 1] & 1) || carry < 0)) {
+        // 下一块进入查找带：上一列的值按纵向逐行加1估计
+        y++;
+        pv[y] = ~0ULL;
+        mv[y] = 0;
+        int rows = (y == last) ? state->length - y * 64 : 64;
+        block_score[y] = block_score[y - 1] + rows - carry;
+        block_score[y] += myers_advance(&pv[y], &mv[y], peq[y], (y == last) ? last_high : (1ULL << 63), carry);
+    } else {
+        while (y > 0 && block_score[y] >= limit + 64) y--;
+    }
+    *active = y;
+    return (y == last && block_score[y] <= limit) ? block_score[y] : -1;
+}
+
+typedef struct {
+    int score;
+    int distance;       // 与给定行号的距离，得分相同时优先较近的候选
+    int row;            // 近似匹配结束所在的行（从0开始）
+    size_t end;         // 近似匹配结束的字节位置
+} DiagEnd;
+
+static int diag_end_compare(const void* a, const void* b) {
+    const DiagEnd* x = (const DiagEnd*)a;
+    const DiagEnd* y = (const DiagEnd*)b;
+    if (x->score != y->score) return (x->score < y->score) ? -1 : 1;
+    if (x->distance != y->distance) return (x->distance < y->distance) ? -1 : 1;
+    return (x->row < y->row) ? -1 : (x->row > y->row);
+}
+
+// \r\n中的\r不参与比较，与匹配时的换行规范化一致
+static int diag_skip_byte(const char* data, size_t len, size_t pos) {
+    return data[pos] == '\r' && pos + 1 < len && data[pos + 1] == '\n';
+}
+
+static void diag_report_line(const char* prefix, int line_number, const char* text) {
+    int len = (int)strlen(text);
+    const char* more = (len > DIAG_DISPLAY_MAX) ? "..." : "";
+    if (len > DIAG_DISPLAY_MAX) len = DIAG_DISPLAY_MAX;
+    if (line_number > 0) {
+        report("    %s LN-%d: '%.*s'%s\n", prefix, line_number, len, text, more);
+    } else {
+        report("    %s REQUESTED: '%.*s'%s\n", prefix, len, text, more);
+    }
+}
+
+// 逐行比较查找文本与候选：-表示文件中没有的查找行，+表示查找文本中没有的文件行
+static void diag_report_diff(char* search_lines[], int search_count, char* block_lines[], int block_count,
+                             int first_line) {
+    int shown = 0, differing = 0;
+    if (search_count <= DIAG_LCS_MAX && block_count <= DIAG_LCS_MAX) {
+        int columns = block_count + 1;
+        int* lcs = (int*)calloc((size_t)(search_count + 1) * columns, sizeof(int));
+        if (lcs == NULL) return;
+        for (int i = search_count - 1; i >= 0; i--) {
+            for (int j = block_count - 1; j >= 0; j--) {
+                int* cell = &lcs[i * columns + j];
+                if (strcmp(search_lines[i], block_lines[j]) == 0) {
+                    *cell = lcs[(i + 1) * columns + j + 1] + 1;
+                } else {
+                    int down = lcs[(i + 1) * columns + j], right = lcs[i * columns + j + 1];
+                    *cell = (down > right) ? down : right;
+                }
+            }
+        }
+        int i = 0, j = 0;
+        while (i < search_count || j < block_count) {
+            if (i < search_count && j < block_count && strcmp(search_lines[i], block_lines[j]) == 0) {
+                i++;
+                j++;
+            } else if (i < search_count && (j == block_count || lcs[(i + 1) * columns + j] >= lcs[i * columns + j + 1])) {
+                if (shown++ < DIAG_DIFF_LINES) diag_report_line("-", 0, search_lines[i]);
+                differing++;
+                i++;
+            } else {
+                if (shown++ < DIAG_DIFF_LINES) diag_report_line("+", first_line + j, block_lines[j]);
+                differing++;
+                j++;
+            }
+        }
+        free(lcs);
+    } else {
+        int count = (search_count > block_count) ? search_count : block_count;
+        for (int i = 0; i < count; i++) {
+            if (i < search_count && i < block_count && strcmp(search_lines[i], block_lines[i]) == 0) continue;
+            if (i < search_count) {
+                if (shown++ < DIAG_DIFF_LINES) diag_report_line("-", 0, search_lines[i]);
+                differing++;
+            }
+            if (i < block_count) {
+                if (shown++ < DIAG_DIFF_LINES) diag_report_line("+", first_line + i, block_lines[i]);
+                differing++;
+            }
+        }
+    }
+    if (differing > DIAG_DIFF_LINES) {
+        report("    ... %d more differing lines\n", differing - DIAG_DIFF_LINES);
+    }
+}
+
+// 查找失败后调用（仅在开启诊断时生效）：在整个文件中近似查找search_lines，
+// 按编辑距离列出最接近的几处及其与查找文本的逐行差异，near_line为命令给出的行号（从1开始）
+void diagnose_nearest(const char* data, size_t len, char* search_lines[], int search_count, int near_line) {
+    if (diagnose_candidates <= 0 || data == NULL || search_count <= 0) return;
+
+    // 查找文本按\n连接（与规范化后的文件内容比较）
+    char* pattern = (char*)malloc(DIAG_PATTERN_MAX);
+    if (pattern == NULL) return;
+    int length = 0, truncated = 0, joined = 0;
+    for (; joined < search_count && length < DIAG_PATTERN_MAX; joined++) {
+        if (joined > 0) pattern[length++] = '\n';
+        size_t line_len = strlen(search_lines[joined]);
+        if (line_len > (size_t)(DIAG_PATTERN_MAX - length)) {
+            line_len = DIAG_PATTERN_MAX - length;
+            truncated = 1;
+        }
+        memcpy(pattern + length, search_lines[joined], line_len);
+        length += (int)line_len;
+    }
+    if (joined < search_count) truncated = 1;
+    if (length == 0) {
+        free(pattern);
+        return;
+    }
+    int max_score = length / 2;
+
+    MyersState forward;
+    if (!myers_init(&forward, pattern, length, 0)) {
+        free(pattern);
+        return;
+    }
+
+    // 一次扫描整个文件，记录每行中结束于该行的最小编辑距离
+    int rows = (int)scan_count_newlines(data, len) + 1;
+    DiagEnd* ends = (DiagEnd*)malloc(rows * sizeof(DiagEnd));
+    if (ends == NULL) {
+        myers_free(&forward);
+        free(pattern);
+        return;
+    }
+    int end_count = 0, row = 0, active = 0;
+    myers_search_begin(&forward, max_score, &active);
+    for (size_t pos = 0; pos < len; pos++) {
+        if (diag_skip_byte(data, len, pos)) continue;
+        int score = myers_search_step(&forward, (unsigned char)data[pos], max_score, &active);
+        if (score >= 0) {
+            if (end_count > 0 && ends[end_count - 1].row == row) {
+                if (score < ends[end_count - 1].score) {
+                    ends[end_count - 1].score = score;
+                    ends[end_count - 1].end = pos;
+                }
+            } else {
+                DiagEnd* end = &ends[end_count++];
+                end->score = score;
+                end->distance = (near_line > 0) ? abs(row + 1 - near_line) : row;
+                end->row = row;
+                end->end = pos;
+            }
+        }
+        if (data[pos] == '\n') row++;
+    }
+    myers_free(&forward);
+    qsort(ends, end_count, sizeof(DiagEnd), diag_end_compare);
+
+    MyersState backward;
+    if (end_count > 0 && !myers_init(&backward, pattern, length, 1)) end_count = 0;
+
+    int* chosen = (int*)malloc(diagnose_candidates * 2 * sizeof(int));
+    int chosen_count = 0;
+    int attempts = 0;
+    for (int c = 0; c < end_count && chosen != NULL && chosen_count < diagnose_candidates; c++) {
+        const DiagEnd* end = &ends[c];
+        int covered = 0;
+        for (int k = 0; k < chosen_count && !covered; k++) {
+            covered = (end->row >= chosen[k * 2] && end->row <= chosen[k * 2 + 1]);
+        }
+        if (covered || attempts++ >= diagnose_candidates * 8) continue;
+
+        // 从结束位置反向匹配（反转的模式，从结束位置开始计算），找到近似匹配的开始位置
+        memset(backward.pv, 0xff, backward.words * sizeof(uint64_t));
+        memset(backward.mv, 0, backward.words * sizeof(uint64_t));
+        backward.score = length;
+        size_t start = end->end;
+        int best = length, consumed = 0;
+        for (size_t pos = end->end + 1; pos > 0 && consumed <= length + max_score; pos--) {
+            if (diag_skip_byte(data, len, pos - 1)) continue;
+            consumed++;
+            int score = myers_step(&backward, (unsigned char)data[pos - 1], 1);
+            if (score < best) {
+                best = score;
+                start = pos - 1;
+            }
+        }
+
+        int first_row = end->row - (int)scan_count_newlines(data + start, end->end - start);
+        int last_row = end->row;
+        if (truncated) {
+            last_row = first_row + search_count - 1;
+            if (last_row >= rows) last_row = rows - 1;
+        }
+        int overlaps = 0;
+        for (int k = 0; k < chosen_count && !overlaps; k++) {
+            overlaps = (first_row <= chosen[k * 2 + 1] && last_row >= chosen[k * 2]);
+        }
+        if (overlaps) continue;
+
+        if (chosen_count == 0 && truncated) {
+            report("  DIAG: Closest matches of the requested text (%d lines, compared by its first %d bytes):\n",
+                   search_count, length);
+        } else if (chosen_count == 0) {
+            report("  DIAG: Closest matches of the requested text (%d lines):\n", search_count);
+        }
+        chosen[chosen_count * 2] = first_row;
+        chosen[chosen_count * 2 + 1] = last_row;
+        chosen_count++;
+
+        // 取出候选所在的完整行
+        size_t block_begin = start;
+        while (block_begin > 0 && data[block_begin - 1] != '\n') block_begin--;
+        size_t block_end = block_begin;
+        for (int r = first_row; r <= last_row && block_end < len; r++) {
+            const char* nl = (const char*)memchr(data + block_end, '\n', len - block_end);
+            block_end = (nl != NULL) ? (size_t)(nl - data) + 1 : len;
+        }
+        char* block_text = (char*)malloc(block_end - block_begin + 1);
+        if (block_text == NULL) break;
+        memcpy(block_text, data + block_begin, block_end - block_begin);
+        block_text[block_end - block_begin] = '\0';
+        int block_count = 0;
+        char** block_lines = split_lines(block_text, &block_count);
+        free(block_text);
+
+        report("  #%d LN-%d~%d, edit distance %d\n", chosen_count, first_row + 1, first_row + block_count,
+               end->score);
+        diag_report_diff(search_lines, search_count, block_lines, block_count, first_row + 1);
+        free_string_array(block_lines, block_count);
+    }
+    if (chosen_count == 0) {
+        report("  DIAG: No similar text found (edit distance above %d)\n", max_score);
+    }
+
+    if (end_count > 0) myers_free(&backward);
+    free(chosen);
+    free(ends);
+    free(pattern);
+}
+
+char** split_lines(const char* str, int* count) {
+    if (str == NULL) {
+        *count = 0;
+        return NULL;
+    }
+    
+    // 计算行数
+    size_t str_len = strlen(str);
+    *count = (int)scan_count_newlines(str, str_len) + 1;
+    
+    char** lines = (char**)malloc(*count * sizeof(char*));
+    if (lines == NULL) {
+        *count = 0;
+        return NULL;
+    }
+    
+    // 分割字符串：保留空行，\r\n与\n都视为行结束，末尾换行不产生额外空行
+    int i = 0;
+    const char* start = str;
+    const char* str_end = str + str_len;
+    while (start < str_end) {
+        const char* end = memchr(start, '\n', str_end - start);
+        size_t len = (end != NULL) ? (size_t)(end - start) : (size_t)(str_end - start);
+        size_t text_len = (len > 0 && start[len - 1] == '\r') ? len - 1 : len;
+        lines[i] = (char*)malloc(text_len + 1);
+        memcpy(lines[i], start, text_len);
+        lines[i][text_len] = '\0';
+        i++;
+        if (end == NULL) break;
+        start = end + 1;
+    }
+    
+    *count = i;  // 实际行数
+    return lines;
+}
+
+char** split_special_multiline(const char* file_path, const char* text, int* count) {
+    // 获取文件扩展名
+    const char* ext = get_file_extension(file_path);
+
+    // 如果是js/ts/tsx文件，且文本包含反引号，按转义换行符分割
+    if (is_special_extension(ext)) {
+        // 检查文本中是否包含反引号
+        if (strchr(text, '`') != NULL) {
+            // 先按 `\n` 分割，然后处理每个 `\r\n`
+            int temp_count = 0;
+            char** temp_lines = split_lines(text, &temp_count);
+
+            // 计算实际行数（包含转义换行符）
+            int actual_count = 0;
+            for (int i = 0; i < temp_count; i++) {
+                // 查找 \r\n 和 \n 的转义形式
+                char* pos = temp_lines[i];
+                int has_escaped = 0;
+                while ((pos = strstr(pos, "\\r\\n")) != NULL) {
+                    actual_count++;
+                    pos += 4;
+                    has_escaped = 1;
+                }
+                pos = temp_lines[i];
+                while ((pos = strstr(pos, "\\n")) != NULL) {
+                    actual_count++;
+                    pos += 2;
+                    has_escaped = 1;
+                }
+                if (!has_escaped) {
+                    actual_count++;
+                }
+            }
+
+            // 分配结果数组
+            char** result = (char**)malloc((actual_count + 1) * sizeof(char*));
+            int result_index = 0;
+
+            for (int i = 0; i < temp_count; i++) {
+                char* line = temp_lines[i];
+                char* pos = line;
+                char* last_pos = line;
+                int found = 0;
+
+                // 查找并分割转义换行符
+                while ((pos = strstr(pos, "\\r\\n")) != NULL) {
+                    int len = pos - last_pos;
+                    char* part = (char*)malloc(len + 1);
+                    strncpy(part, last_pos, len);
+                    part[len] = '\0';
+                    result[result_index++] = part;
+                    pos += 4;
+                    last_pos = pos;
+                    found = 1;
+                }
+
+                pos = last_pos;
+                while ((pos = strstr(pos, "\\n")) != NULL) {
+                    int len = pos - last_pos;
+                    char* part = (char*)malloc(len + 1);
+                    strncpy(part, last_pos, len);
+                    part[len] = '\0';
+                    result[result_index++] = part;
+                    pos += 2;
+                    last_pos = pos;
+                    found = 1;
+                }
+
+                if (!found) {
+                    result[result_index++] = strdup(line);
+                }
+            }
+
+            result[result_index] = NULL;
+
+            // 释放临时数组
+            for (int i = 0; i < temp_count; i++) {
+                free(temp_lines[i]);
+            }
+            free(temp_lines);
+
+            *count = result_index;
+            return result;
+        }
+    }
+
+    // 默认按换行符分割
+    return split_lines(text, count);
+}
+
+int is_multi_lines_equal(char* lines[], int line_count, int start_index, char* compare_lines[], int compare_count) {
+    if (start_index < 0 || start_index >= line_count) return 0;
+    
+    if (start_index + compare_count > line_count) {
+        return 0;
+    }
+    
+    for (int i = 0; i < compare_count; i++) {
+        if (strcmp(lines[start_index + i], compare_lines[i]) != 0) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+int locate_multi_lines_forward(char* search_lines[], int search_count, 
+                               char* source_lines[], int source_count, 
+                               int source_start, int forward) {
+    if (search_count <= 0) return -1;
+    if (source_start < 0) source_start = 0;
+    
+    int range_start = -1;
+    int offset = 0;
+    
+    for (int i = source_start; i < source_count && i < source_start + forward; i++) {
+        if (strcmp(source_lines[i], search_lines[offset]) != 0) {
+            offset = 0;
+            range_start = -1;
+            continue;
+        } else {
+            offset++;
+            if (range_start == -1) range_start = i;
+        }
+        
+        if (offset == search_count) break;
+    }
+    
+    return (offset == search_count) ? range_start : -1;
+}
+
+int locate_multi_lines_backward(char* search_lines[], int search_count, 
+                                char* source_lines[], int source_count, 
+                                int source_start, int backward) {
+    if (search_count <= 0) return -1;
+    int range_start = -1;
+    int processed = 0;
+    int from_line_index = (source_start - backward < 0) ? 0 : source_start - backward;
+    
+    for (int i = source_start; i >= from_line_index; i--) {
+        if (strcmp(source_lines[i], search_lines[search_count - processed - 1]) != 0) {
+            processed = 0;
+            range_start = -1;
+            continue;
+        } else {
+            processed++;
+            range_start = i;
+        }
+        
+        if (processed == search_count) break;
+    }
+    
+    return (processed == search_count) ? range_start : -1;
+}
+
+// 锚点表的一项：查找文本中的一行及其在查找文本/文件中出现的次数
+typedef struct {
+    uint64_t hash;
+    int index;            // 在查找文本中的行下标
+    int search_hits;
+    int file_hits;
+    size_t file_offset;   // 在文件中最后一次出现的行首偏移
+    int file_line;
+} AnchorSlot;
+
+// 从行首偏移取出一行（不含换行符），返回下一行的偏移
+static size_t anchor_line_at(const char* data, size_t len, size_t pos, size_t* text_len) {
+    const char* end = (const char*)memchr(data + pos, '\n', len - pos);
+    size_t stop = (end != NULL) ? (size_t)(end - data) : len;
+    *text_len = stop - pos;
+    if (end != NULL && *text_len > 0 && data[stop - 1] == '\r') (*text_len)--;
+    return (end != NULL) ? stop + 1 : len;
+}
+
+static int anchor_line_equal(const char* data, size_t pos, size_t text_len, const char* line) {
+    return strlen(line) == text_len && memcmp(data + pos, line, text_len) == 0;
+}
+
+// 以锚点为基准逐行确认整段查找文本，锚点之前的行向前回溯
+static int anchor_verify(const char* data, size_t len, const AnchorSlot* anchor,
+                         char* search_lines[], int search_count) {
+    size_t pos = anchor->file_offset;
+    for (int i = anchor->index - 1; i >= 0; i--) {
+        if (pos == 0) return 0;
+        size_t eol = pos - 1;   // 上一行的\n
+        const char* prev = (eol > 0) ? (const char*)memrchr(data, '\n', eol) : NULL;
+        size_t start = (prev != NULL) ? (size_t)(prev - data) + 1 : 0;
+        size_t text_len = eol - start;
+        if (text_len > 0 && data[eol - 1] == '\r') text_len--;
+        if (!anchor_line_equal(data, start, text_len, search_lines[i])) return 0;
+        pos = start;
+    }
+
+    pos = anchor->file_offset;
+    for (int i = anchor->index; i < search_count; i++) {
+        if (pos >= len) return 0;
+        size_t text_len = 0;
+        size_t next = anchor_line_at(data, len, pos, &text_len);
+        if (!anchor_line_equal(data, pos, text_len, search_lines[i])) return 0;
+        pos = next;
+    }
+    return 1;
+}
+
+// 锚点定位（patience diff的唯一行匹配）：查找文本中只出现一次、在整个文件中也只出现一次的行
+// 确定了整段文本的位置，扫描文件一次即可找到任意远处的匹配，再逐行确认完整匹配。
+// 由于锚点在文件中唯一，确认通过的位置也是唯一的。返回0起始的行号，找不到时返回-1
+int locate_by_anchors(const char* data, size_t len, char* search_lines[], const uint64_t* search_hashes,
+                      int search_count) {
+    if (search_count <= 0 || data == NULL) return -1;
+
+    int capacity = 16;
+    while (capacity < search_count * 2) capacity *= 2;
+    AnchorSlot* slots = (AnchorSlot*)calloc(capacity, sizeof(AnchorSlot));
+    uint64_t length_mask[64];   // 候选行长度的位图，长度不符的行不必计算哈希
+    memset(length_mask, 0, sizeof(length_mask));
+    if (slots == NULL) return -1;
+
+    for (int i = 0; i < search_count; i++) {
+        size_t line_len = strlen(search_lines[i]);
+        if (line_len == 0) continue;   // 空行不作为锚点
+        uint64_t hash = (search_hashes != NULL) ? search_hashes[i] : hash_bytes(search_lines[i], line_len, 0);
+        int slot = (int)(hash & (capacity - 1));
+        while (slots[slot].search_hits > 0 &&
+               (slots[slot].hash != hash || strcmp(search_lines[slots[slot].index], search_lines[i]) != 0)) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (slots[slot].search_hits++ == 0) {
+            slots[slot].hash = hash;
+            slots[slot].index = i;
+        }
+        length_mask[(line_len & 4095) >> 6] |= 1ULL << (line_len & 63);
+    }
+
+    size_t pos = 0;
+    for (int line = 0; pos < len; line++) {
+        size_t text_len = 0;
+        size_t next = anchor_line_at(data, len, pos, &text_len);
+        if (text_len > 0 && (length_mask[(text_len & 4095) >> 6] & (1ULL << (text_len & 63)))) {
+            uint64_t hash = hash_bytes(data + pos, text_len, 0);
+            int slot = (int)(hash & (capacity - 1));
+            while (slots[slot].search_hits > 0) {
+                if (slots[slot].hash == hash &&
+                    anchor_line_equal(data, pos, text_len, search_lines[slots[slot].index])) {
+                    slots[slot].file_hits++;
+                    slots[slot].file_offset = pos;
+                    slots[slot].file_line = line;
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+        }
+        pos = next;
+    }
+
+    int result = -1;
+    for (int i = 0; i < capacity && result == -1; i++) {
+        const AnchorSlot* anchor = &slots[i];
+        if (anchor->search_hits != 1 || anchor->file_hits != 1) continue;
+        if (anchor->file_line < anchor->index) continue;
+        if (anchor_verify(data, len, anchor, search_lines, search_count)) {
+            result = anchor->file_line - anchor->index;
+        }
+    }
+
+    free(slots);
+    return result;
+}
+
+void free_string_array(char** array, int count) {
+    if (array == NULL) return;
+    
+    for (int i = 0; i < count; i++) {
+        if (array[i] != NULL) free(array[i]);
+    }
+    
+    free(array);
+}
+
+// 行扫描内核：每次取64字节，得到其中'\n'和'\r'的位图，换行计数、行首表、
+// 第n个换行符和\r\n压缩都在位图上完成，不再逐字节或逐行调用memchr。
+// 位图由AVX2、SSE2或可移植的标量实现（SWAR）生成，运行时按CPU选择，
+// 可用环境变量JSONDO_SIMD=scalar|sse2|avx2指定
+typedef struct {
+    uint64_t nl;
+    uint64_t cr;
+} ScanMasks;
+
+typedef struct {
+    const char* name;
+    size_t (*count_eol)(const char* data, size_t len, int prev_cr, size_t* crlfs);
+    size_t (*line_starts)(const char* data, size_t len, size_t* starts);
+    const char* (*nth_newline)(const char* data, size_t len, size_t n, size_t* seen);
+    size_t (*compact_crlf)(char* dst, const char* src, size_t len);
+} ScanKernels;
+
+#define SCAN_BLOCK 64
+#define SCAN_STARTS_SLACK 4
+#define SCAN_ONES 0x0101010101010101ULL
+#define SCAN_HIGHS 0x8080808080808080ULL
+
+// 8个字节中等于pattern对应字节的位置，结果为各字节的最高位（精确，没有误判）
+static inline uint64_t scan_swar_eq(uint64_t word, uint64_t pattern) {
+    uint64_t x = word ^ pattern;
+    return ~(((x & ~SCAN_HIGHS) + ~SCAN_HIGHS) | x) & SCAN_HIGHS;
+}
+
+// 将8个字节的最高位收集为8位位图（第k个字节对应第k位）
+static inline uint64_t scan_swar_gather(uint64_t highs) {
+    return ((highs >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+static inline ScanMasks scan_block_scalar(const char* p) {
+    ScanMasks masks = {0, 0};
+    for (int i = 0; i < SCAN_BLOCK / 8; i++) {
+        uint64_t word;
+        memcpy(&word, p + i * 8, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        masks.nl |= scan_swar_gather(scan_swar_eq(word, '\n' * SCAN_ONES)) << (i * 8);
+        masks.cr |= scan_swar_gather(scan_swar_eq(word, '\r' * SCAN_ONES)) << (i * 8);
+    }
+    return masks;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_SCAN_X86 1
+#define SCAN_TARGET_SSE2 __attribute__((target("sse2")))
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2,popcnt,bmi")))
+
+SCAN_TARGET_SSE2 static inline ScanMasks scan_block_sse2(const char* p) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    ScanMasks masks = {0, 0};
+    for (int i = 0; i < SCAN_BLOCK / 16; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i * 16));
+        masks.nl |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (i * 16);
+        masks.cr |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr)) << (i * 16);
+    }
+    return masks;
+}
+
+SCAN_TARGET_AVX2 static inline ScanMasks scan_block_avx2(const char* p) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    __m256i low = _mm256_loadu_si256((const __m256i*)p);
+    __m256i high = _mm256_loadu_si256((const __m256i*)(p + 32));
+    ScanMasks masks;
+    masks.nl = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, nl)) |
+               (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, nl)) << 32;
+    masks.cr = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, cr)) |
+               (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, cr)) << 32;
+    return masks;
+}
+#endif
+
+// 以下为与指令集无关的内核主体，分别内联到各指令集的版本中。
+// 末尾不足64字节时复制到补0的块中处理（'\0'不会被当作换行符）
+typedef ScanMasks (*ScanBlockFn)(const char* p);
+
+static inline __attribute__((always_inline))
+ScanMasks scan_block_at(const char* data, size_t len, size_t pos, ScanBlockFn classify) {
+    if (len - pos >= SCAN_BLOCK) return classify(data + pos);
+    char tail[SCAN_BLOCK];
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, data + pos, len - pos);
+    return classify(tail);
+}
+
+// 换行符个数；crlfs不为NULL时同时统计其中以\r\n结尾的个数，prev_cr为data之前的字节是否为'\r'
+static inline __attribute__((always_inline))
+size_t scan_count_eol_body(const char* data, size_t len, int prev_cr, size_t* crlfs, ScanBlockFn classify) {
+    size_t newlines = 0;
+    size_t pairs = 0;
+    uint64_t carry = prev_cr ? 1 : 0;
+    for (size_t pos = 0; pos < len; pos += SCAN_BLOCK) {
+        ScanMasks masks = scan_block_at(data, len, pos, classify);
+        newlines += __builtin_popcountll(masks.nl);
+        if (crlfs != NULL) {
+            pairs += __builtin_popcountll(masks.nl & ((masks.cr << 1) | carry));
+            carry = masks.cr >> 63;
+        }
+    }
+    if (crlfs != NULL) *crlfs = pairs;
+    return newlines;
+}
+
+// 依次写入每个换行符之后的偏移，返回写入的个数。
+// 每块先无条件写入4项再按实际个数前进，避免逐位循环的分支预测失败，
+// 因此starts需在换行符个数之外多留SCAN_STARTS_SLACK项
+static inline __attribute__((always_inline))
+size_t scan_line_starts_body(const char* data, size_t len, size_t* starts, ScanBlockFn classify) {
+    size_t count = 0;
+    for (size_t pos = 0; pos < len; pos += SCAN_BLOCK) {
+        uint64_t nl = scan_block_at(data, len, pos, classify).nl;
+        size_t found = __builtin_popcountll(nl);
+        size_t* out = starts + count;
+        for (int i = 0; i < 4; i++) {
+            out[i] = pos + __builtin_ctzll(nl | (1ULL << 63)) + 1;
+            nl &= nl - 1;
+        }
+        for (size_t i = 4; i < found; i++) {
+            out[i] = pos + __builtin_ctzll(nl) + 1;
+            nl &= nl - 1;
+        }
+        count += found;
+    }
+    return count;
+}
+
+// 第n个（从1开始）换行符的位置；不足n个时返回NULL，seen为实际找到的个数
+static inline __attribute__((always_inline))
+const char* scan_nth_newline_body(const char* data, size_t len, size_t n, size_t* seen, ScanBlockFn classify) {
+    size_t remaining = n;
+    for (size_t pos = 0; pos < len && remaining > 0; pos += SCAN_BLOCK) {
+        uint64_t nl = scan_block_at(data, len, pos, classify).nl;
+        size_t count = __builtin_popcountll(nl);
+        if (remaining <= count) {
+            while (--remaining > 0) nl &= nl - 1;
+            *seen = n;
+            return data + pos + __builtin_ctzll(nl);
+        }
+        remaining -= count;
+    }
+    *seen = n - remaining;
+    return NULL;
+}
+
+// 将\r\n压缩为\n，单独的\r保留；dst可以与src相同（原地压缩），返回压缩后的长度
+static inline __attribute__((always_inline))
+size_t scan_compact_crlf_body(char* dst, const char* src, size_t len, ScanBlockFn classify) {
+    size_t out = 0;
+    for (size_t pos = 0; pos < len; pos += SCAN_BLOCK) {
+        ScanMasks masks = scan_block_at(src, len, pos, classify);
+        size_t block = (len - pos < SCAN_BLOCK) ? len - pos : SCAN_BLOCK;
+        uint64_t next_nl = (pos + SCAN_BLOCK < len && src[pos + SCAN_BLOCK] == '\n') ? 1 : 0;
+        uint64_t drop = masks.cr & ((masks.nl >> 1) | (next_nl << 63));
+        size_t from = 0;
+        while (drop != 0) {
+            size_t at = __builtin_ctzll(drop);
+            memmove(dst + out, src + pos + from, at - from);
+            out += at - from;
+            from = at + 1;
+            drop &= drop - 1;
+        }
+        memmove(dst + out, src + pos + from, block - from);
+        out += block - from;
+    }
+    return out;
+}
+
+#define SCAN_DEFINE_KERNELS(isa, target)                                                              \
+    target static size_t scan_count_eol_##isa(const char* data, size_t len, int prev_cr, size_t* crlfs) { \
+        return scan_count_eol_body(data, len, prev_cr, crlfs, scan_block_##isa);                        \
+    }                                                                                                 \
+    target static size_t scan_line_starts_##isa(const char* data, size_t len, size_t* starts) {        \
+        return scan_line_starts_body(data, len, starts, scan_block_##isa);                              \
+    }                                                                                                 \
+    target static const char* scan_nth_newline_##isa(const char* data, size_t len, size_t n, size_t* seen) { \
+        return scan_nth_newline_body(data, len, n, seen, scan_block_##isa);                             \
+    }                                                                                                 \
+    target static size_t scan_compact_crlf_##isa(char* dst, const char* src, size_t len) {            \
+        return scan_compact_crlf_body(dst, src, len, scan_block_##isa);                                 \
+    }                                                                                                 \
+    static const ScanKernels scan_kernels_##isa = {                                                   \
+        #isa, scan_count_eol_##isa, scan_line_starts_##isa, scan_nth_newline_##isa, scan_compact_crlf_##isa \
+    };
+
+SCAN_DEFINE_KERNELS(scalar, )
+#ifdef HAVE_SCAN_X86
+SCAN_DEFINE_KERNELS(sse2, SCAN_TARGET_SSE2)
+SCAN_DEFINE_KERNELS(avx2, SCAN_TARGET_AVX2)
+#endif
+
+static const ScanKernels* scan_active = &scan_kernels_scalar;
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+// 按名称取得当前CPU支持的内核，不支持时返回NULL
+static const ScanKernels* scan_kernels_find(const char* name) {
+    if (strcmp(name, "scalar") == 0) return &scan_kernels_scalar;
+#ifdef HAVE_SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) return &scan_kernels_sse2;
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("bmi")) {
+        return &scan_kernels_avx2;
+    }
+#endif
+    return NULL;
+}
+
+static void scan_kernels_select(void) {
+    const char* name = getenv("JSONDO_SIMD");
+    const ScanKernels* kernels = (name != NULL) ? scan_kernels_find(name) : NULL;
+    if (kernels == NULL) kernels = scan_kernels_find("avx2");
+    if (kernels == NULL) kernels = scan_kernels_find("sse2");
+    if (kernels == NULL) kernels = &scan_kernels_scalar;
+    scan_active = kernels;
+}
+
+static inline const ScanKernels* scan_kernels(void) {
+    pthread_once(&scan_once, scan_kernels_select);
+    return scan_active;
+}
+
+const char* scan_kernel_name(void) {
+    return scan_kernels()->name;
+}
+
+// 切换内核（供基准测试比较各指令集），CPU不支持时返回0且不切换
+int scan_kernel_use(const char* name) {
+    scan_kernels();
+    const ScanKernels* kernels = scan_kernels_find(name);
+    if (kernels == NULL) return 0;
+    scan_active = kernels;
+    return 1;
+}
+
+size_t scan_count_newlines(const char* data, size_t len) {
+    return scan_kernels()->count_eol(data, len, 0, NULL);
+}
+
+size_t scan_count_eol(const char* data, size_t len, int prev_cr, size_t* crlfs) {
+    return scan_kernels()->count_eol(data, len, prev_cr, crlfs);
+}
+
+size_t scan_line_starts(const char* data, size_t len, size_t* starts) {
+    return scan_kernels()->line_starts(data, len, starts);
+}
+
+const char* scan_nth_newline(const char* data, size_t len, size_t n, size_t* seen) {
+    return scan_kernels()->nth_newline(data, len, n, seen);
+}
+
+size_t scan_compact_crlf(char* dst, const char* src, size_t len) {
+    return scan_kernels()->compact_crlf(dst, src, len);
+}
+
+// 构建行表：只记录每行在原始缓冲区中的起始偏移
+int line_table_build(LineTable* table, const char* data, size_t len) {
+    table->data = data;
+    table->len = len;
+    table->count = 0;
+    table->crlf_count = 0;
+    table->default_eol = NULL;
+
+    size_t crlfs = 0;
+    size_t newlines = scan_count_eol(data, len, 0, &crlfs);
+    table->starts = (size_t*)malloc((newlines + 1 + SCAN_STARTS_SLACK) * sizeof(size_t));
+    if (table->starts == NULL) return 0;
+
+    // 第一行从0开始，其余行从每个换行符之后开始；末尾换行之后不再算作新的一行
+    table->starts[0] = 0;
+    size_t count = scan_line_starts(data, len, table->starts + 1) + 1;
+    if (table->starts[count - 1] == len) count--;
+    table->count = (int)count;
+    table->crlf_count = (int)crlfs;
+    return 1;
+}
+
+void line_table_free(LineTable* table) {
+    free(table->starts);
+    table->starts = NULL;
+    table->count = 0;
+}
+
+// 本行的起始偏移，超出行数时为内容长度
+size_t line_table_start(const LineTable* table, int index) {
+    return (index < table->count) ? table->starts[index] : table->len;
+}
+
+// 下一行的起始偏移（即本行含换行符的结束位置）
+size_t line_table_next(const LineTable* table, int index) {
+    return (index + 1 < table->count) ? table->starts[index + 1] : table->len;
+}
+
+// 本行内容的结束偏移（不含换行符）
+size_t line_table_end(const LineTable* table, int index) {
+    return line_table_next(table, index) - strlen(line_table_eol(table, index));
+}
+
+// 本行使用的换行符："\r\n"、"\n"，最后一行无换行时为""
+const char* line_table_eol(const LineTable* table, int index) {
+    size_t next = line_table_next(table, index);
+    if (next == table->starts[index] || table->data[next - 1] != '\n') return "";
+    if (next - table->starts[index] >= 2 && table->data[next - 2] == '\r') return "\r\n";
+    return "\n";
+}
+
+// 文件的主要换行风格，用于新插入的行
+const char* line_table_default_eol(const LineTable* table) {
+    if (table->default_eol != NULL) return table->default_eol;
+    return (table->crlf_count * 2 > table->count) ? "\r\n" : "\n";
+}
+
+// 按行复制出不含换行符的字符串数组，供逐行比较使用
+char** line_table_to_lines(const LineTable* table) {
+    char** lines = (char**)malloc((table->count + 1) * sizeof(char*));
+    if (lines == NULL) return NULL;
+
+    for (int i = 0; i < table->count; i++) {
+        size_t start = table->starts[i];
+        size_t len = line_table_end(table, i) - start;
+        lines[i] = (char*)malloc(len + 1);
+        memcpy(lines[i], table->data + start, len);
+        lines[i][len] = '\0';
+    }
+    lines[table->count] = NULL;
+    return lines;
+}
+
+// 在规范化视图上比较：双方的\r\n均视为\n，返回匹配所占的原始字节数
+static int norm_match_at(const char* data, size_t len, size_t pos,
+                         const char* pattern, size_t pattern_len, size_t* matched_len) {
+    size_t i = pos, j = 0;
+    while (j < pattern_len) {
+        if (i >= len) return 0;
+
+        char a = data[i];
+        size_t step_a = 1;
+        if (a == '\r' && i + 1 < len && data[i + 1] == '\n') {
+            a = '\n';
+            step_a = 2;
+        }
+
+        char b = pattern[j];
+        size_t step_b = 1;
+        if (b == '\r' && j + 1 < pattern_len && pattern[j + 1] == '\n') {
+            b = '\n';
+            step_b = 2;
+        }
+
+        if (a != b) return 0;
+        i += step_a;
+        j += step_b;
+    }
+
+    *matched_len = i - pos;
+    return 1;
+}
+
+// 换行规范化视图上的查找：相当于在str_replace(data, "\r\n", "\n")中查找pattern，
+// 但不复制缓冲区，直接返回原始内容中的匹配位置
+const char* norm_find(const char* data, size_t len, size_t from, const char* pattern, size_t* matched_len) {
+    size_t pattern_len = strlen(pattern);
+    if (pattern_len == 0) {
+        *matched_len = 0;
+        return (from <= len) ? data + from : NULL;
+    }
+
+    char first = (pattern[0] == '\r' && pattern_len > 1 && pattern[1] == '\n') ? '\n' : pattern[0];
+    size_t pos = from;
+    while (pos < len) {
+        const char* hit = memchr(data + pos, first, len - pos);
+        if (hit == NULL) return NULL;
+
+        size_t start = hit - data;
+        // 规范化后的\n对应原始的\r\n时，匹配从\r开始
+        if (first == '\n' && start > from && data[start - 1] == '\r') start--;
+
+        if (norm_match_at(data, len, start, pattern, pattern_len, matched_len)) {
+            return data + start;
+        }
+        pos = hit - data + 1;
+    }
+    return NULL;
+}
+
+// 查找线程数：CPU核数，可用环境变量JSONDO_THREADS指定
+static int parallel_thread_count(void) {
+    const char* value = getenv("JSONDO_THREADS");
+    long count = (value != NULL) ? atol(value) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) count = 1;
+    if (count > PARALLEL_MAX_THREADS) count = PARALLEL_MAX_THREADS;
+    return (int)count;
+}
+
+static void* chunk_search_worker(void* arg) {
+    ChunkSearch* search = (ChunkSearch*)arg;
+    for (;;) {
+        int chunk = __atomic_fetch_add(&search->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= search->chunk_count) break;
+
+        size_t begin = search->from + (size_t)chunk * search->chunk_size;
+        size_t end = (search->len - begin > search->chunk_size) ? begin + search->chunk_size : search->len;
+        if (search->pattern == NULL) {
+            search->results[chunk] = scan_count_newlines(search->data + begin, end - begin);
+            continue;
+        }
+        if (chunk > __atomic_load_n(&search->best_chunk, __ATOMIC_RELAXED)) continue;
+
+        // 起点在end之前的匹配最多占用2倍模式长度的原始字节，多读1字节以正确识别末尾的\r\n
+        size_t overlap = 2 * search->pattern_len + 1;
+        size_t limit = (search->len - end > overlap) ? end + overlap : search->len;
+        size_t matched_len = 0;
+        const char* hit = norm_find(search->data, limit, begin, search->pattern, &matched_len);
+        if (hit == NULL || (size_t)(hit - search->data) >= end) continue;
+
+        search->results[chunk] = hit - search->data;
+        search->matched_lens[chunk] = matched_len;
+        int best = __atomic_load_n(&search->best_chunk, __ATOMIC_RELAXED);
+        while (chunk < best &&
+               !__atomic_compare_exchange_n(&search->best_chunk, &best, chunk, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+    return NULL;
+}
+
+// 将[from, len)分块后由多个线程处理，返回0表示应退回单线程处理
+static int chunk_search_run(ChunkSearch* search) {
+    // 先判断大小：取CPU核数需要读取sysfs，小缓冲区不必付出这一开销
+    size_t span = search->len - search->from;
+    if (span < PARALLEL_SEARCH_MIN) return 0;
+    int threads = parallel_thread_count();
+    if (threads < 2) return 0;
+
+    // 分块数为线程数的数倍，找到匹配后其后的分块可以尽早跳过
+    size_t chunk_size = span / ((size_t)threads * 4);
+    if (chunk_size < PARALLEL_CHUNK_MIN) chunk_size = PARALLEL_CHUNK_MIN;
+    search->chunk_size = chunk_size;
+    search->chunk_count = (int)((span + chunk_size - 1) / chunk_size);
+    search->next_chunk = 0;
+    search->best_chunk = search->chunk_count;
+    search->results = (size_t*)malloc(search->chunk_count * sizeof(size_t));
+    search->matched_lens = (size_t*)malloc(search->chunk_count * sizeof(size_t));
+    if (search->results == NULL || search->matched_lens == NULL) {
+        free(search->results);
+        free(search->matched_lens);
+        return 0;
+    }
+    for (int i = 0; i < search->chunk_count; i++) search->results[i] = SIZE_MAX;
+
+    if (threads > search->chunk_count) threads = search->chunk_count;
+    pthread_t workers[PARALLEL_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, chunk_search_worker, search) == 0) {
+        started++;
+    }
+    // 当前线程同样参与处理，线程创建失败时由它完成剩余分块
+    chunk_search_worker(search);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    return 1;
+}
+
+// 与norm_find相同，大文件时分块并行查找
+const char* parallel_find(const char* data, size_t len, size_t from, const char* pattern, size_t* matched_len) {
+    ChunkSearch search = {0};
+    search.data = data;
+    search.len = len;
+    search.from = from;
+    search.pattern = pattern;
+    search.pattern_len = strlen(pattern);
+    if (from >= len || search.pattern_len == 0 || !chunk_search_run(&search)) {
+        return norm_find(data, len, from, pattern, matched_len);
+    }
+
+    const char* found = NULL;
+    if (search.best_chunk < search.chunk_count) {
+        found = data + search.results[search.best_chunk];
+        *matched_len = search.matched_lens[search.best_chunk];
+    }
+    free(search.results);
+    free(search.matched_lens);
+    return found;
+}
+
+// 统计data前len字节中的换行符数量，大文件时分块并行统计
+size_t parallel_count_newlines(const char* data, size_t len) {
+    ChunkSearch search = {0};
+    search.data = data;
+    search.len = len;
+    if (!chunk_search_run(&search)) {
+        return scan_count_newlines(data, len);
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < search.chunk_count; i++) {
+        count += search.results[i];
+    }
+    free(search.results);
+    free(search.matched_lens);
+    return count;
+}
+
+// 推断指定位置所在行的换行符；位于无换行的最后一行时，取之前最近一行的风格
+const char* detect_eol_at(const char* data, size_t len, size_t pos) {
+    const char* nl = memchr(data + pos, '\n', len - pos);
+    if (nl == NULL) {
+        size_t i = pos;
+        while (i > 0 && data[i - 1] != '\n') i--;
+        if (i == 0) return "\n";
+        nl = data + i - 1;
+    }
+    return (nl > data && nl[-1] == '\r') ? "\r\n" : "\n";
+}
+
+// 追加文本，并将其中的换行符（\n或\r\n）统一转换为eol
+void byte_buffer_append_eol(ByteBuffer* buffer, const char* text, size_t len, const char* eol) {
+    // 目标为\n时只需去掉\r\n中的\r：整段复制后原地压缩
+    if (strcmp(eol, "\n") == 0) {
+        size_t offset = byte_buffer_append(buffer, text, len, 1);
+        buffer->len = offset + scan_compact_crlf(buffer->data + offset, buffer->data + offset, len);
+        return;
+    }
+
+    size_t eol_len = strlen(eol);
+    const char* p = text;
+    const char* end = text + len;
+
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            byte_buffer_append(buffer, p, end - p, 1);
+            break;
+        }
+        const char* segment_end = (nl > p && nl[-1] == '\r') ? nl - 1 : nl;
+        byte_buffer_append(buffer, p, segment_end - p, 1);
+        byte_buffer_append(buffer, eol, eol_len, 1);
+        p = nl + 1;
+    }
+}
+
+// 按字节区间替换：[begin, end)之外的原始字节保持不变，返回以\0结尾的新内容
+char* splice_bytes(const char* data, size_t len, size_t begin, size_t end,
+                   const char* insert, const char* eol, size_t* out_len) {
+    size_t insert_len = strlen(insert);
+    ByteBuffer buffer = {0};
+    buffer.capacity = len - (end - begin) + insert_len * 2 + 1;
+    buffer.data = (char*)malloc(buffer.capacity);
+    if (buffer.data == NULL) return NULL;
+
+    byte_buffer_append(&buffer, data, begin, 1);
+    byte_buffer_append_eol(&buffer, insert, insert_len, eol);
+    byte_buffer_append(&buffer, data + end, len - end, 1);
+    byte_buffer_append(&buffer, "", 1, 1);
+
+    *out_len = buffer.len - 1;
+    return buffer.data;
+}
+
+// 按行区间替换，结果追加到buffer（不含结尾的\0）：[from_line, to_line)替换为insert_lines，
+// 或insert_lines为NULL时替换为insert_text中的insert_count行（已去掉末尾换行，行间的\n或\r\n按新的换行风格写入）。
+// 新行沿用被替换位置的换行风格，区间之外按原始字节保留
+static void splice_lines_into(ByteBuffer* buffer, const LineTable* table, int from_line, int to_line,
+                              char* insert_lines[], const char* insert_text, size_t text_len, int insert_count) {
+    if (from_line < 0) from_line = 0;
+    if (to_line < from_line) to_line = from_line;
+
+    size_t begin = (from_line < table->count) ? table->starts[from_line] : table->len;
+    size_t end = (to_line < table->count) ? table->starts[to_line] : table->len;
+
+    const char* eol = line_table_default_eol(table);
+    if (from_line < table->count && line_table_eol(table, from_line)[0] != '\0') {
+        eol = line_table_eol(table, from_line);
+    }
+    // 替换区间延伸到没有换行结尾的最后一行时，最后插入的行同样不加换行
+    const char* last_eol = eol;
+    if (to_line >= table->count && table->count > 0 && end == table->len &&
+        line_table_eol(table, table->count - 1)[0] == '\0') {
+        last_eol = "";
+    }
+
+    byte_buffer_append(buffer, table->data, begin, 1);
+    // 在没有换行结尾的文件末尾追加时，先补上换行
+    if (begin == table->len && begin > 0 && table->data[begin - 1] != '\n' && insert_count > 0) {
+        byte_buffer_append(buffer, eol, strlen(eol), 1);
+        last_eol = "";
+    }
+    if (insert_lines != NULL) {
+        for (int i = 0; i < insert_count; i++) {
+            const char* line_eol = (i == insert_count - 1) ? last_eol : eol;
+            byte_buffer_append(buffer, insert_lines[i], strlen(insert_lines[i]), 1);
+            byte_buffer_append(buffer, line_eol, strlen(line_eol), 1);
+        }
+    } else if (insert_count > 0) {
+        byte_buffer_append_eol(buffer, insert_text, text_len, eol);
+        byte_buffer_append(buffer, last_eol, strlen(last_eol), 1);
+    }
+    byte_buffer_append(buffer, table->data + end, table->len - end, 1);
+}
+
+char* splice_lines(const LineTable* table, int from_line, int to_line,
+                   char* insert_lines[], int insert_count, size_t* out_len) {
+    ByteBuffer buffer = {0};
+    splice_lines_into(&buffer, table, from_line, to_line, insert_lines, NULL, 0, insert_count);
+    byte_buffer_append(&buffer, "", 1, 1);
+
+    *out_len = buffer.len - 1;
+    return buffer.data;
+}
+
+// 与splice_lines(split_lines(text))结果相同，但直接将原始文本追加到buffer，不切分、不逐行复制，
+// 用于大段的替换内容；返回插入的行数
+int splice_line_text(ByteBuffer* buffer, const LineTable* table, int from_line, int to_line, const char* text) {
+    // 与split_lines一致：末尾的换行不产生额外的空行，最后一行末尾的\r不保留
+    size_t len = strlen(text);
+    int count = (len > 0) ? 1 : 0;
+    if (len > 0 && text[len - 1] == '\n') len--;
+    if (len > 0 && text[len - 1] == '\r') len--;
+    count += (int)scan_count_newlines(text, len);
+
+    splice_lines_into(buffer, table, from_line, to_line, NULL, text, len, count);
+    return count;
+}
+
+// FNV-1a 64位哈希
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t hash = 14695981039346656037ULL ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// 文件内容哈希：4路并行、每次处理8字节，用于大文件时比hash_bytes快得多
+static uint64_t hash_mix(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    return hash ^ (hash >> 32);
+}
+
+uint64_t hash_content(const char* data, size_t len) {
+    uint64_t lanes[4] = {0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL};
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        uint64_t words[4];
+        memcpy(words, data + i, 32);
+        for (int lane = 0; lane < 4; lane++) {
+            lanes[lane] = hash_mix(lanes[lane], words[lane]);
+        }
+    }
+    uint64_t hash = hash_mix(len, lanes[0]);
+    for (int lane = 1; lane < 4; lane++) {
+        hash = hash_mix(hash, lanes[lane]);
+    }
+    for (; i < len; i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, (len - i < 8) ? len - i : 8);
+        hash = hash_mix(hash, word);
+    }
+    return hash_mix(hash, 0x94d049bb133111ebULL);
+}
+
+void line_delta_init(LineDeltaMap* map) {
+    map->tree = NULL;
+    map->points = NULL;
+    map->size = 0;
+    map->abs_total = 0;
+    map->dead = NULL;
+    map->dead_count = 0;
+    map->dead_capacity = 0;
+}
+
+void line_delta_free(LineDeltaMap* map) {
+    free(map->tree);
+    free(map->points);
+    free(map->dead);
+    line_delta_init(map);
+}
+
+// 在原始行号line处累加delta：原始行号>=line的行整体移动delta行
+void line_delta_add(LineDeltaMap* map, int line, int delta) {
+    if (line < 1 || delta == 0) return;
+
+    if (line > map->size) {
+        // 扩容后按单点增量重建Fenwick树
+        int size = (map->size > 0) ? map->size : 1024;
+        while (size < line) size *= 2;
+        map->points = (int*)realloc(map->points, (size + 1) * sizeof(int));
+        memset(map->points + map->size + 1, 0, (size - map->size) * sizeof(int));
+        free(map->tree);
+        map->tree = (int*)calloc(size + 1, sizeof(int));
+        map->size = size;
+        for (int i = 1; i <= size; i++) {
+            if (map->points[i] == 0) continue;
+            for (int j = i; j <= size; j += j & -j) map->tree[j] += map->points[i];
+        }
+    }
+
+    map->points[line] += delta;
+    map->abs_total += (delta > 0) ? delta : -delta;
+    for (int i = line; i <= map->size; i += i & -i) {
+        map->tree[i] += delta;
+    }
+}
+
+// 原始行号<=line的所有增量之和
+int line_delta_prefix(const LineDeltaMap* map, int line) {
+    if (line > map->size) line = map->size;
+    int sum = 0;
+    for (int i = line; i > 0; i -= i & -i) {
+        sum += map->tree[i];
+    }
+    return sum;
+}
+
+// 标记原始行区间[begin, end)已被删除，与之重叠的区间合并（相邻的区间各自保留删除位置）
+static void line_delta_kill(LineDeltaMap* map, int begin, int end) {
+    if (begin >= end) return;
+
+    int first = 0;
+    while (first < map->dead_count && map->dead[first * 2 + 1] <= begin) first++;
+    int last = first;
+    while (last < map->dead_count && map->dead[last * 2] < end) {
+        if (map->dead[last * 2] < begin) begin = map->dead[last * 2];
+        if (map->dead[last * 2 + 1] > end) end = map->dead[last * 2 + 1];
+        last++;
+    }
+
+    if (first == last && map->dead_count == map->dead_capacity) {
+        map->dead_capacity = (map->dead_capacity > 0) ? map->dead_capacity * 2 : 16;
+        map->dead = (int*)realloc(map->dead, map->dead_capacity * 2 * sizeof(int));
+    }
+    int removed = last - first;
+    if (removed != 1) {
+        memmove(map->dead + (first + 1) * 2, map->dead + last * 2, (map->dead_count - last) * 2 * sizeof(int));
+        map->dead_count += 1 - removed;
+    }
+    map->dead[first * 2] = begin;
+    map->dead[first * 2 + 1] = end;
+}
+
+// 原始行号 -> 当前行号（非正数的行号表示未指定，原样返回）；
+// 已删除的行归并到删除位置（所在删除区间的起始行），保证换算结果随原始行号单调不减
+int line_delta_translate(const LineDeltaMap* map, int line) {
+    if (map == NULL || (map->size == 0 && map->dead_count == 0) || line <= 0) return line;
+
+    int lo = 0, hi = map->dead_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (map->dead[mid * 2] <= line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0 && line < map->dead[(lo - 1) * 2 + 1]) line = map->dead[(lo - 1) * 2];
+
+    int translated = line + line_delta_prefix(map, line);
+    return (translated < 1) ? 1 : translated;
+}
+
+// 当前行号 -> 原始行号：二分查找第一个换算后不小于line的原始行号
+int line_delta_inverse(const LineDeltaMap* map, int line) {
+    if (map == NULL || (map->size == 0 && map->dead_count == 0) || line <= 0) return line;
+
+    int lo = 1, hi = line + map->abs_total + 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (line_delta_translate(map, mid) >= line) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// 记录一次编辑：当前行区间[line, line + deleted)被替换为inserted行。
+// 区间内的原始行与新内容逐行对应，多出的原始行标记为已删除；区间之后的原始行移动 inserted - deleted 行
+void line_delta_record(LineDeltaMap* map, const EditResult* edit) {
+    if (edit->line <= 0) return;
+    int end = line_delta_inverse(map, edit->line + edit->deleted);
+    if (edit->deleted > edit->inserted) {
+        int begin = line_delta_inverse(map, edit->line + edit->inserted);
+        line_delta_kill(map, begin, end);
+        map->abs_total += end - begin;
+    }
+    line_delta_add(map, end, edit->inserted - edit->deleted);
+}
+
+// 获取（或创建）指定路径的文件状态，开放寻址哈希表；
+// 各状态单独分配，扩容时地址保持不变
+FileState* file_state_get(FileStateTable* table, const char* path) {
+    if ((table->count + 1) * 2 > table->capacity) {
+        int capacity = (table->capacity > 0) ? table->capacity * 2 : 16;
+        FileState** entries = (FileState**)calloc(capacity, sizeof(FileState*));
+        if (entries == NULL) return NULL;
+        for (int i = 0; i < table->capacity; i++) {
+            if (table->entries[i] == NULL) continue;
+            uint64_t h = hash_bytes(table->entries[i]->path, strlen(table->entries[i]->path), 0);
+            int slot = (int)(h & (capacity - 1));
+            while (entries[slot] != NULL) slot = (slot + 1) & (capacity - 1);
+            entries[slot] = table->entries[i];
+        }
+        free(table->entries);
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+
+    uint64_t h = hash_bytes(path, strlen(path), 0);
+    int slot = (int)(h & (table->capacity - 1));
+    while (table->entries[slot] != NULL) {
+        if (strcmp(table->entries[slot]->path, path) == 0) return table->entries[slot];
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    FileState* state = (FileState*)calloc(1, sizeof(FileState));
+    if (state == NULL) return NULL;
+    state->path = strdup(path);
+    state->fd = -1;
+    state->mode = 0644;
+    state->owner = table;
+    line_delta_init(&state->deltas);
+    table->entries[slot] = state;
+    table->count++;
+    return state;
+}
+
+void file_state_table_free(FileStateTable* table) {
+    io_ring_destroy(table->ring);
+    for (int i = 0; i < table->capacity; i++) {
+        FileState* state = table->entries[i];
+        if (state == NULL) continue;
+        if (state->fd >= 0) close(state->fd);
+        free(state->path);
+        free(state->content);
+        free(state->original);
+        free(state->replay_chain);
+        line_index_free(state->line_index);
+        line_delta_free(&state->deltas);
+        free(state);
+    }
+    ledger_free(table->ledger);
+    free(table->entries);
+    free(table->queue);
+    memset(table, 0, sizeof(*table));
+}
+
+// 开始新的批次：行号偏移只在一个命令文件内有效；缓存的内容需重新校验，
+// 缓存总量超过上限时全部丢弃
+void file_state_table_begin_batch(FileStateTable* table) {
+    size_t cached = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i] != NULL) cached += table->entries[i]->len;
+    }
+
+    for (int i = 0; i < table->capacity; i++) {
+        FileState* file = table->entries[i];
+        if (file == NULL) continue;
+        line_delta_free(&file->deltas);
+        file->verified = 0;
+        free(file->replay_chain);
+        file->replay_chain = NULL;
+        file->replay_built = 0;
+        file->ledger_pending = 0;
+        if (file->status != FILE_LOADED || cached > WATCH_CACHE_LIMIT) {
+            free(file->content);
+            file->content = NULL;
+            file->len = 0;
+            file->hash_valid = 0;
+            line_index_free(file->line_index);
+            file->line_index = NULL;
+            file->status = FILE_UNLOADED;
+        }
+    }
+    table->queue_len = 0;
+    table->queue_pos = 0;
+    table->last_modified = NULL;
+    table->run_dir[0] = '\0';
+}
+
+// 读取命令的目标文件路径（与参数解析相同，去除首尾空白），用于预读
+int command_target_path(cJSON* command, char* path, size_t size) {
+    cJSON* args_item = cJSON_GetObjectItem(command, "args");
+    cJSON* file_item = cJSON_GetObjectItem(args_item, "file");
+    if (file_item == NULL || !cJSON_IsString(file_item)) return 0;
+
+    char* temp_file = strdup(file_item->valuestring);
+    path[0] = '\0';
+    strncat(path, trim(temp_file), size - 1);
+    free(temp_file);
+    return 1;
+}
+
+// 打开文件并分配读缓冲区，返回0表示文件不存在或无法读取
+static int file_open_for_read(FileState* file) {
+    file->fd = open(file->path, O_RDONLY);
+    if (file->fd < 0) {
+        file->status = FILE_MISSING;
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(file->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(file->fd);
+        file->fd = -1;
+        file->status = FILE_FAILED;
+        return 0;
+    }
+
+    file->mode = st.st_mode & 07777;
+    file->stamp = st;
+    file->verified = 1;
+    file->len = (size_t)st.st_size;
+    file->content = (char*)malloc(file->len + 1);
+    if (file->content == NULL) {
+        close(file->fd);
+        file->fd = -1;
+        file->status = FILE_FAILED;
+        return 0;
+    }
+    return 1;
+}
+
+// 同步读完剩余部分并结束加载
+static void file_finish_read(FileState* file, size_t done) {
+    while (done < file->len) {
+        ssize_t n = pread(file->fd, file->content + done, file->len - done, (off_t)done);
+        if (n < 0) {
+            free(file->content);
+            file->content = NULL;
+            file->status = FILE_FAILED;
+            close(file->fd);
+            file->fd = -1;
+            return;
+        }
+        if (n == 0) {
+            file->len = done;  // 读取期间文件被截短
+            break;
+        }
+        done += (size_t)n;
+    }
+
+    file->content[file->len] = '\0';
+    file->status = FILE_LOADED;
+    close(file->fd);
+    file->fd = -1;
+}
+
+#ifdef HAVE_IO_URING
+static int io_uring_enter_syscall(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// 取一个空闲的提交项；队列已满时返回NULL
+static struct io_uring_sqe* io_ring_get_sqe(IoRing* ring) {
+    if (ring->inflight + ring->to_submit >= ring->entries) return NULL;
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return sqe;
+}
+
+// 处理一个完成项
+static void io_job_complete(IoJob* job, int res) {
+    if (job->kind == IO_JOB_READ) {
+        FileState* file = job->file;
+        if (res < 0) {
+            // 异步读取失败时退回同步读取
+            file_finish_read(file, 0);
+        } else {
+            file_finish_read(file, (size_t)res);
+        }
+        free(job);
+        return;
+    }
+
+    // 写入不完整时由file_state_flush同步补写剩余部分
+    if (res < 0) {
+        job->failed = 1;
+    } else {
+        job->done += (size_t)res;
+    }
+}
+
+// 提交已准备的请求并收取完成项；wait为1时至少等待一个完成
+static void io_ring_pump(IoRing* ring, int wait) {
+    unsigned min_complete = (wait && ring->inflight + ring->to_submit > 0) ? 1 : 0;
+    if (ring->to_submit > 0 || min_complete > 0) {
+        int submitted = io_uring_enter_syscall(ring->fd, ring->to_submit, min_complete,
+                                               min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted > 0) {
+            ring->inflight += (unsigned)submitted;
+            ring->to_submit -= (unsigned)submitted;
+        }
+    }
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        if (cqe->user_data != 0) {
+            io_job_complete((IoJob*)(uintptr_t)cqe->user_data, cqe->res);
+        }
+        ring->inflight--;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+// 尽可能多地提交排队中的预读
+static void file_submit_prefetch(FileStateTable* table) {
+#ifdef HAVE_IO_URING
+    IoRing* ring = table->ring;
+    while (table->queue_pos < table->queue_len) {
+        FileState* file = table->queue[table->queue_pos];
+        if (file->status != FILE_QUEUED) {
+            table->queue_pos++;
+            continue;
+        }
+
+        struct io_uring_sqe* sqe = io_ring_get_sqe(ring);
+        if (sqe == NULL) break;
+        table->queue_pos++;
+
+        IoJob* job = (IoJob*)calloc(1, sizeof(IoJob));
+        if (job == NULL || !file_open_for_read(file)) {
+            free(job);
+            // 已占用的提交项改为空操作
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = 0;
+            continue;
+        }
+
+        job->kind = IO_JOB_READ;
+        job->file = file;
+        file->status = FILE_PENDING;
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = file->fd;
+        sqe->addr = (uint64_t)(uintptr_t)file->content;
+        sqe->len = (unsigned)((file->len > 0x7ffff000u) ? 0x7ffff000u : file->len);
+        sqe->off = 0;
+        sqe->user_data = (uint64_t)(uintptr_t)job;
+    }
+    io_ring_pump(ring, 0);
+#else
+    (void)table;
+#endif
+}
+
+// 预读文件：加入队列并提交，读取与前面命令的查找并行进行
+void file_prefetch(FileStateTable* table, const char* path) {
+    if (table->ring == NULL) return;
+
+    FileState* file = file_state_get(table, path);
+    if (file == NULL) return;
+    file_state_verify(file);
+    if (file->status != FILE_UNLOADED) return;
+
+    if (table->queue_len == table->queue_capacity) {
+        int capacity = (table->queue_capacity > 0) ? table->queue_capacity * 2 : 64;
+        FileState** queue = (FileState**)realloc(table->queue, capacity * sizeof(FileState*));
+        if (queue == NULL) return;
+        table->queue = queue;
+        table->queue_capacity = capacity;
+    }
+    file->status = FILE_QUEUED;
+    table->queue[table->queue_len++] = file;
+    file_submit_prefetch(table);
+}
+
+// 缓存的内容在本批次第一次使用前与磁盘上的文件比对，文件被外部修改过则丢弃
+void file_state_verify(FileState* file) {
+    if (file->verified || file->status != FILE_LOADED) return;
+    file->verified = 1;
+
+    struct stat st;
+    if (stat(file->path, &st) == 0 && st.st_ino == file->stamp.st_ino && st.st_dev == file->stamp.st_dev &&
+        st.st_size == file->stamp.st_size &&
+        st.st_mtim.tv_sec == file->stamp.st_mtim.tv_sec && st.st_mtim.tv_nsec == file->stamp.st_mtim.tv_nsec) {
+        return;
+    }
+    free(file->content);
+    file->content = NULL;
+    file->len = 0;
+    file->hash_valid = 0;
+    line_index_free(file->line_index);
+    file->line_index = NULL;
+    file->status = FILE_UNLOADED;
+}
+
+// 取得文件当前内容：等待预读完成，未预读时同步读取
+// 内存模式：复制调用者的缓冲区作为当前内容（以\0结尾），不访问磁盘
+static const char* file_state_load_buffer(FileState* file, size_t* len) {
+    FileStateTable* table = file->owner;
+    if (file->status == FILE_UNLOADED) {
+        file->status = FILE_MISSING;
+        for (int i = 0; i < table->buffer_count; i++) {
+            const JsondoBuffer* buffer = &table->buffers[i];
+            if (buffer->name == NULL || strcmp(buffer->name, file->path) != 0) continue;
+
+            file->content = (char*)malloc(buffer->len + 1);
+            if (file->content == NULL) {
+                file->status = FILE_FAILED;
+                break;
+            }
+            if (buffer->len > 0) memcpy(file->content, buffer->data, buffer->len);
+            file->content[buffer->len] = '\0';
+            file->len = buffer->len;
+            file->status = FILE_LOADED;
+            file->verified = 1;
+            break;
+        }
+    }
+
+    if (file->status != FILE_LOADED) return NULL;
+    *len = file->len;
+    return file->content;
+}
+
+const char* file_state_load(FileState* file, size_t* len) {
+    if (file->owner->buffers != NULL) return file_state_load_buffer(file, len);
+    file_state_verify(file);
+#ifdef HAVE_IO_URING
+    FileStateTable* table = file->owner;
+    while (file->status == FILE_PENDING && table->ring != NULL) {
+        io_ring_pump(table->ring, 1);
+        file_submit_prefetch(table);
+    }
+#endif
+    if (file->status == FILE_UNLOADED || file->status == FILE_QUEUED) {
+        if (file_open_for_read(file)) {
+            file_finish_read(file, 0);
+        }
+    }
+
+    if (file->status != FILE_LOADED) return NULL;
+    *len = file->len;
+    return file->content;
+}
+
+// 以编辑结果替换文件内容：第一次修改时保留原内容用于备份，写回推迟到批次结束。
+// [begin, end)为原内容中被替换的字节区间，区间之前和之后的字节在新内容中原样保留
+void file_state_replace(FileState* file, char* content, size_t len, size_t begin, size_t end) {
+    if (file->line_index != NULL) {
+        line_index_update(file->line_index, file->content, file->len, content, len, begin, end);
+    }
+    if (!file->dirty) {
+        file->original = file->content;
+        file->original_len = file->len;
+        file->dirty = 1;
+        file_state_backup(file);
+    } else {
+        free(file->content);
+    }
+    file->content = content;
+    file->len = len;
+    file->hash_valid = 0;
+    file->owner->last_modified = file;
+}
+
+// 锁文件的键：目标文件的绝对路径（文件尚不存在时解析其所在目录），
+// 与写回时的realpath一致，经不同路径或符号链接访问同一文件时取得同一把锁
+static uint64_t file_lock_key(const char* path) {
+    char resolved[MAX_PATH_LEN * 2];
+    char* real = realpath(path, NULL);
+    if (real == NULL) {
+        char dir[MAX_PATH_LEN];
+        const char* slash = strrchr(path, '/');
+        const char* name = (slash != NULL) ? slash + 1 : path;
+        if (slash == NULL) {
+            snprintf(dir, sizeof(dir), ".");
+        } else if (slash == path) {
+            snprintf(dir, sizeof(dir), "/");
+        } else {
+            snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+        }
+        char* real_dir = realpath(dir, NULL);
+        snprintf(resolved, sizeof(resolved), "%s/%s", (real_dir != NULL) ? real_dir : dir, name);
+        free(real_dir);
+    } else {
+        snprintf(resolved, sizeof(resolved), "%s", real);
+        free(real);
+    }
+    return hash_bytes(resolved, strlen(resolved), 0);
+}
+
+static int file_lock_compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// 对本批次的所有目标文件加写锁（OFD锁，随描述符关闭释放）。
+// 所有进程都按锁键的顺序加锁，避免相互等待形成死锁；不同目标文件的锁互不影响
+int file_lock_acquire(FileLockSet* locks, char** paths, int count) {
+    locks->fds = NULL;
+    locks->count = 0;
+    if (count <= 0) return 1;
+
+    uint64_t* keys = (uint64_t*)malloc(count * sizeof(uint64_t));
+    locks->fds = (int*)malloc(count * sizeof(int));
+    if (keys == NULL || locks->fds == NULL) {
+        free(keys);
+        free(locks->fds);
+        locks->fds = NULL;
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        keys[i] = file_lock_key(paths[i]);
+    }
+    qsort(keys, count, sizeof(uint64_t), file_lock_compare);
+
+    mkdir(LOCK_DIR, 0755);
+    int success = 1;
+    for (int i = 0; i < count && success; i++) {
+        if (i > 0 && keys[i] == keys[i - 1]) continue;
+
+        char lock_path[MAX_PATH_LEN];
+        snprintf(lock_path, sizeof(lock_path), "%s/%016llx.lock", LOCK_DIR, (unsigned long long)keys[i]);
+        int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            report("Failed to open lock file: %s\n", lock_path);
+            success = 0;
+            break;
+        }
+
+        struct flock lock;
+        memset(&lock, 0, sizeof(lock));
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+#ifdef F_OFD_SETLKW
+        int set_lock = F_OFD_SETLK;
+        int set_lock_wait = F_OFD_SETLKW;
+#else
+        int set_lock = F_SETLK;
+        int set_lock_wait = F_SETLKW;
+#endif
+        if (fcntl(fd, set_lock, &lock) != 0) {
+            report_text("Waiting for lock: %s\n", lock_path);
+            int result;
+            while ((result = fcntl(fd, set_lock_wait, &lock)) != 0 && errno == EINTR) {
+            }
+            if (result != 0) {
+                report("Failed to lock: %s\n", lock_path);
+                close(fd);
+                success = 0;
+                break;
+            }
+        }
+        locks->fds[locks->count++] = fd;
+    }
+
+    free(keys);
+    if (!success) file_lock_release(locks);
+    return success;
+}
+
+void file_lock_release(FileLockSet* locks) {
+    for (int i = 0; i < locks->count; i++) {
+        close(locks->fds[i]);
+    }
+    free(locks->fds);
+    locks->fds = NULL;
+    locks->count = 0;
+}
+
+static int run_name_compare(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// 删除运行目录（其中只有备份文件和applied.json）
+static void remove_run_dir(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir == NULL) return;
+    struct dirent* entry;
+    char file_path[MAX_PATH_LEN * 2];
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        unlink(file_path);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+// 只保留最近的运行目录（按名称中的时间排序），数量由环境变量JSONDO_KEEP_RUNS指定，默认20，0表示不清理。
+// 清理时对.jsondo/locks/runs.lock加锁，其他进程正在清理时直接跳过
+static void prune_runs(void) {
+    const char* value = getenv("JSONDO_KEEP_RUNS");
+    long keep = (value != NULL) ? atol(value) : RUNS_KEEP_DEFAULT;
+    if (keep <= 0) return;
+
+    mkdir(LOCK_DIR, 0755);
+    int lock_fd = open(LOCK_DIR "/runs.lock", O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) return;
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+#ifdef F_OFD_SETLK
+    int set_lock = F_OFD_SETLK;
+#else
+    int set_lock = F_SETLK;
+#endif
+    if (fcntl(lock_fd, set_lock, &lock) != 0) {
+        close(lock_fd);
+        return;
+    }
+
+    DIR* dir = opendir(RUNS_DIR);
+    char** names = NULL;
+    int count = 0, capacity = 0;
+    struct dirent* entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        if (count == capacity) {
+            capacity = (capacity > 0) ? capacity * 2 : 64;
+            char** grown = (char**)realloc(names, capacity * sizeof(char*));
+            if (grown == NULL) break;
+            names = grown;
+        }
+        names[count] = strdup(entry->d_name);
+        if (names[count] != NULL) count++;
+    }
+    if (dir != NULL) closedir(dir);
+
+    if (count > keep) {
+        qsort(names, count, sizeof(char*), run_name_compare);
+        time_t now = time(NULL);
+        char path[MAX_PATH_LEN];
+        for (int i = 0; i < count - keep; i++) {
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", RUNS_DIR, names[i]);
+            if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode) || now - st.st_mtime < RUNS_PRUNE_MIN_AGE) continue;
+            remove_run_dir(path);
+        }
+    }
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+    close(lock_fd);
+}
+
+// 创建本批次的备份目录.jsondo/runs/<时间>-<进程号>-<序号>，同时运行的进程互不覆盖；
+// 创建后清理超出保留数量的旧运行目录
+const char* file_state_run_dir(FileStateTable* table) {
+    static int run_sequence = 0;
+    if (table->run_dir[0] != '\0') return table->run_dir;
+
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+    mkdir(RUNS_DIR, 0755);
+    for (int attempt = 0; attempt < 100; attempt++) {
+        snprintf(table->run_dir, sizeof(table->run_dir), "%s/%s-%d-%d",
+                 RUNS_DIR, stamp, (int)getpid(), __atomic_fetch_add(&run_sequence, 1, __ATOMIC_RELAXED));
+        if (mkdir(table->run_dir, 0755) == 0) {
+            prune_runs();
+            return table->run_dir;
+        }
+        if (errno != EEXIST) break;
+    }
+    report("Failed to create run directory: %s\n", table->run_dir);
+    table->run_dir[0] = '\0';
+    return NULL;
+}
+
+// 备份文件名：目标路径中的'/'和'%'转义后作为单个文件名，过长时改用路径哈希
+static void backup_file_name(const char* path, char* name, size_t size) {
+    size_t len = 0;
+    for (const char* p = path; *p != '\0' && len + 4 < size; p++) {
+        if (*p == '/' || *p == '%') {
+            len += snprintf(name + len, size - len, "%%%02X", (unsigned char)*p);
+        } else {
+            name[len++] = *p;
+        }
+    }
+    name[len] = '\0';
+    if (len > 200) {
+        snprintf(name, size, "%016llx", (unsigned long long)hash_bytes(path, strlen(path), 0));
+    }
+}
+
+// 使用io_uring时，文件第一次修改后立即提交原内容的备份写入，与后续命令的查找重叠执行；
+// 队列已满时只打开备份文件，写回时再补写
+void file_state_backup(FileState* file) {
+#ifdef HAVE_IO_URING
+    IoRing* ring = file->owner->ring;
+    if (ring == NULL || file->backup != NULL) return;
+    const char* run_dir = file_state_run_dir(file->owner);
+    if (run_dir == NULL) return;
+
+    char name[MAX_PATH_LEN];
+    char backup_path[MAX_PATH_LEN * 2];
+    backup_file_name(file->path, name, sizeof(name));
+    snprintf(backup_path, sizeof(backup_path), "%s/%s", run_dir, name);
+    IoJob* job = (IoJob*)calloc(1, sizeof(IoJob));
+    if (job == NULL) return;
+    job->kind = IO_JOB_WRITE;
+    job->file = file;
+    job->data = file->original;
+    job->len = file->original_len;
+    job->fd = open(backup_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (job->fd < 0) {
+        free(job);
+        return;
+    }
+    file->backup = job;
+
+    struct io_uring_sqe* sqe = (job->len > 0) ? io_ring_get_sqe(ring) : NULL;
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = job->fd;
+    sqe->addr = (uint64_t)(uintptr_t)job->data;
+    sqe->len = (unsigned)((job->len > 0x7ffff000u) ? 0x7ffff000u : job->len);
+    sqe->off = 0;
+    sqe->user_data = (uint64_t)(uintptr_t)job;
+    io_ring_pump(ring, 0);
+#else
+    (void)file;
+#endif
+}
+
+// 将.jsondo下的jsondo.lastbackup/jsondo.lastApplied指向最近一次运行的文件：
+// 先创建临时符号链接再rename替换，并发运行时只会指向某次完整的运行
+static void update_last_link(const char* link_path, const char* target) {
+    char temp[MAX_PATH_LEN];
+    snprintf(temp, sizeof(temp), "%s.%d.tmp", link_path, (int)getpid());
+    // 链接目标相对于.jsondo目录
+    const char* relative = (strncmp(target, ".jsondo/", 8) == 0) ? target + 8 : target;
+    unlink(temp);
+    if (symlink(relative, temp) != 0 || rename(temp, link_path) != 0) {
+        unlink(temp);
+    }
+}
+
+// 成功执行后将命令文件复制到本批次的备份目录
+void record_applied(FileStateTable* table, const char* command_file) {
+    const char* run_dir = file_state_run_dir(table);
+    if (run_dir == NULL) return;
+
+    char applied_path[MAX_PATH_LEN * 2];
+    snprintf(applied_path, sizeof(applied_path), "%s/applied.json", run_dir);
+    if (copy_file(command_file, applied_path)) {
+        update_last_link(".jsondo/jsondo.lastApplied", applied_path);
+    }
+}
+
+// 内存模式的写回：修改后的内容直接交给对应缓冲区的output（不复制）
+static int file_state_flush_buffers(FileStateTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        FileState* file = table->entries[i];
+        if (file == NULL || !file->dirty) continue;
+
+        for (int j = 0; j < table->buffer_count; j++) {
+            JsondoBuffer* buffer = &table->buffers[j];
+            if (buffer->name == NULL || strcmp(buffer->name, file->path) != 0) continue;
+            free(buffer->output);
+            buffer->output = file->content;
+            buffer->output_len = file->len;
+            file->content = NULL;
+            file->len = 0;
+            file->status = FILE_UNLOADED;
+            break;
+        }
+        free(file->original);
+        file->original = NULL;
+        file->original_len = 0;
+        file->dirty = 0;
+    }
+    table->last_modified = NULL;
+    return 1;
+}
+
+// 写回本批次修改过的文件：先写临时文件（io_uring批量提交），全部完成后再逐个rename，
+// 同时将修改前的原内容写入本批次的备份目录
+int file_state_flush(FileStateTable* table) {
+    if (table->buffers != NULL) return file_state_flush_buffers(table);
+
+    // 账本记录先于文件写入：写回中断时文件仍是执行前的内容，重放不会误跳过
+    for (int i = 0; i < table->capacity && table->ledger != NULL; i++) {
+        if (table->entries[i] != NULL) ledger_seal(table->ledger, table->entries[i]);
+    }
+    ledger_commit(table->ledger);
+
+    int job_count = 0;
+    IoJob* jobs = (IoJob*)calloc(table->count * 2 + 1, sizeof(IoJob));
+    char** temp_paths = (char**)calloc(table->count + 1, sizeof(char*));
+    char** target_paths = (char**)calloc(table->count + 1, sizeof(char*));
+    if (jobs == NULL || temp_paths == NULL || target_paths == NULL) {
+        free(jobs);
+        free(temp_paths);
+        free(target_paths);
+        return 0;
+    }
+
+    for (int i = 0; i < table->capacity; i++) {
+        FileState* file = table->entries[i];
+        if (file == NULL || !file->dirty) continue;
+
+        // 通过符号链接修改时写入链接指向的文件
+        char* target = realpath(file->path, NULL);
+        if (target == NULL) target = strdup(file->path);
+        size_t temp_size = strlen(target) + 16;
+        char* temp = (char*)malloc(temp_size);
+        snprintf(temp, temp_size, "%s.jsondo.tmp", target);
+
+        IoJob* job = &jobs[job_count];
+        job->kind = IO_JOB_WRITE;
+        job->file = file;
+        job->data = file->content;
+        job->len = file->len;
+        job->fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, file->mode);
+        job->failed = (job->fd < 0);
+        temp_paths[job_count] = temp;
+        target_paths[job_count] = target;
+        job_count++;
+    }
+
+    // 每个修改过的文件的原内容写入本批次的备份目录，与目标文件的写入一起提交；
+    // 已在第一次修改时提交的备份先收取结果，未写完的部分随后补写
+#ifdef HAVE_IO_URING
+    while (table->ring != NULL && table->ring->inflight + table->ring->to_submit > 0) {
+        io_ring_pump(table->ring, 1);
+    }
+#endif
+    int total_jobs = job_count;
+    char last_backup[MAX_PATH_LEN * 2] = "";
+    const char* run_dir = (job_count > 0) ? file_state_run_dir(table) : NULL;
+    for (int i = 0; i < job_count && run_dir != NULL; i++) {
+        FileState* file = jobs[i].file;
+        if (file->original == NULL) continue;
+
+        char name[MAX_PATH_LEN];
+        char backup_path[MAX_PATH_LEN * 2];
+        backup_file_name(file->path, name, sizeof(name));
+        snprintf(backup_path, sizeof(backup_path), "%s/%s", run_dir, name);
+        if (file == table->last_modified) {
+            snprintf(last_backup, sizeof(last_backup), "%s", backup_path);
+        }
+
+        IoJob* backup = &jobs[total_jobs++];
+        if (file->backup != NULL) {
+            *backup = *file->backup;
+            free(file->backup);
+            file->backup = NULL;
+            continue;
+        }
+        backup->kind = IO_JOB_WRITE;
+        backup->data = file->original;
+        backup->len = file->original_len;
+        backup->fd = open(backup_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        backup->failed = (backup->fd < 0);
+    }
+
+#ifdef HAVE_IO_URING
+    if (table->ring != NULL) {
+        IoRing* ring = table->ring;
+        for (int i = 0; i < total_jobs; i++) {
+            if (jobs[i].failed || jobs[i].done >= jobs[i].len) continue;
+            struct io_uring_sqe* sqe;
+            while ((sqe = io_ring_get_sqe(ring)) == NULL) {
+                io_ring_pump(ring, 1);
+            }
+            size_t remaining = jobs[i].len - jobs[i].done;
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = jobs[i].fd;
+            sqe->addr = (uint64_t)(uintptr_t)(jobs[i].data + jobs[i].done);
+            sqe->len = (unsigned)((remaining > 0x7ffff000u) ? 0x7ffff000u : remaining);
+            sqe->off = jobs[i].done;
+            sqe->user_data = (uint64_t)(uintptr_t)&jobs[i];
+        }
+        while (ring->inflight + ring->to_submit > 0) {
+            io_ring_pump(ring, 1);
+        }
+    }
+#endif
+
+    // 同步补写（无io_uring或部分写入时）
+    for (int i = 0; i < total_jobs; i++) {
+        IoJob* job = &jobs[i];
+        while (!job->failed && job->done < job->len) {
+            ssize_t n = pwrite(job->fd, job->data + job->done, job->len - job->done, (off_t)job->done);
+            if (n <= 0) {
+                job->failed = 1;
+                break;
+            }
+            job->done += (size_t)n;
+        }
+        if (job->fd >= 0) close(job->fd);
+    }
+
+    int success = 1;
+    for (int i = 0; i < job_count; i++) {
+        FileState* file = jobs[i].file;
+        if (jobs[i].failed || rename(temp_paths[i], target_paths[i]) != 0) {
+            report("  Failed to write file: %s\n", file->path);
+            unlink(temp_paths[i]);
+            success = 0;
+            file->verified = 0;
+            memset(&file->stamp, 0, sizeof(file->stamp));
+            line_index_free(file->line_index);
+            file->line_index = NULL;
+        } else if (stat(file->path, &file->stamp) != 0) {
+            memset(&file->stamp, 0, sizeof(file->stamp));
+        }
+        free(file->original);
+        file->original = NULL;
+        file->original_len = 0;
+        file->dirty = 0;
+        free(temp_paths[i]);
+        free(target_paths[i]);
+    }
+    table->last_modified = NULL;
+    if (last_backup[0] != '\0') {
+        update_last_link(".jsondo/jsondo.lastbackup", last_backup);
+    }
+
+    // 写回后的文件状态已更新，保存新建或更新过的行号索引
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i] != NULL) file_state_save_line_index(table->entries[i]);
+    }
+
+    free(jobs);
+    free(temp_paths);
+    free(target_paths);
+    return success;
+}
+
+// 创建io_uring；内核不支持或设置了JSONDO_IO=sync时返回NULL，使用同步读写
+IoRing* io_ring_create(unsigned entries) {
+#ifdef HAVE_IO_URING
+    const char* mode = getenv("JSONDO_IO");
+    if (mode != NULL && strcmp(mode, "sync") == 0) return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) return NULL;
+
+    IoRing* ring = (IoRing*)calloc(1, sizeof(IoRing));
+    if (ring == NULL) {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(fd);
+            free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    char* sq = (char*)ring->sq_ring;
+    char* cq = (char*)ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+#else
+    (void)entries;
+    return NULL;
+#endif
+}
+
+void io_ring_destroy(IoRing* ring) {
+    if (ring == NULL) return;
+#ifdef HAVE_IO_URING
+    // 等待所有未完成的请求，避免内核继续写入已释放的缓冲区
+    while (ring->inflight + ring->to_submit > 0) {
+        io_ring_pump(ring, 1);
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+#endif
+    free(ring);
+}
+
+// 追加数据到缓冲区，返回按align对齐后的起始偏移
+size_t byte_buffer_append(ByteBuffer* buffer, const void* data, size_t len, size_t align) {
+    size_t offset = (buffer->len + align - 1) & ~(align - 1);
+    if (offset + len > buffer->capacity) {
+        size_t capacity = (buffer->capacity > 0) ? buffer->capacity : 4096;
+        while (capacity < offset + len) capacity *= 2;
+        buffer->data = (char*)realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    if (offset > buffer->len) memset(buffer->data + buffer->len, 0, offset - buffer->len);
+    if (len > 0) memcpy(buffer->data + offset, data, len);
+    buffer->len = offset + len;
+    return offset;
+}
+
+// 是否将行号索引保存到.jsondo/index/（JSONDO_INDEX=on）
+static int line_index_persistent(void) {
+    const char* mode = getenv("JSONDO_INDEX");
+    return mode != NULL && strcmp(mode, "on") == 0;
+}
+
+static int line_index_reserve(LineIndex* index, int64_t count) {
+    if (count <= index->capacity) return 1;
+    int64_t capacity = (index->capacity > 0) ? index->capacity : 64;
+    while (capacity < count) capacity *= 2;
+    LineIndexEntry* entries = (LineIndexEntry*)realloc(index->entries, capacity * sizeof(LineIndexEntry));
+    if (entries == NULL) return 0;
+    index->entries = entries;
+    index->capacity = capacity;
+    return 1;
+}
+
+static void line_index_push(LineIndex* index, int64_t line, uint64_t offset) {
+    if (!line_index_reserve(index, index->header.entry_count + 1)) return;
+    index->entries[index->header.entry_count].line = line;
+    index->entries[index->header.entry_count].offset = offset;
+    index->header.entry_count++;
+}
+
+// 统计[begin, end)中的换行符，以及其中以\r\n结尾的换行符
+static void line_index_count(const char* data, size_t begin, size_t end, int64_t* newlines, int64_t* crlfs) {
+    if (end <= begin) return;
+    size_t pairs = 0;
+    *newlines += scan_count_eol(data + begin, end - begin, begin > 0 && data[begin - 1] == '\r', &pairs);
+    *crlfs += pairs;
+}
+
+// 一次扫描建立索引
+LineIndex* line_index_build(const char* data, size_t len) {
+    LineIndex* index = (LineIndex*)calloc(1, sizeof(LineIndex));
+    if (index == NULL) return NULL;
+    memcpy(index->header.magic, LINE_INDEX_MAGIC, 8);
+    index->header.version = LINE_INDEX_VERSION;
+    index->header.stride = LINE_INDEX_STRIDE;
+    index->header.size = len;
+
+    size_t crlfs = 0;
+    index->header.newline_count = scan_count_eol(data, len, 0, &crlfs);
+    index->header.crlf_count = crlfs;
+
+    // 每隔LINE_INDEX_STRIDE个换行符记录一项
+    if (len > 0) line_index_push(index, 0, 0);
+    const char* p = data;
+    const char* end = data + len;
+    int64_t line = 0;
+    while (p < end) {
+        size_t seen = 0;
+        const char* nl = scan_nth_newline(p, end - p, LINE_INDEX_STRIDE, &seen);
+        if (nl == NULL) break;
+        line += LINE_INDEX_STRIDE;
+        p = nl + 1;
+        if (p < end) line_index_push(index, line, p - data);
+    }
+    return index;
+}
+
+void line_index_free(LineIndex* index) {
+    if (index == NULL) return;
+    free(index->entries);
+    free(index);
+}
+
+// 行数与line_table_build一致：末尾没有换行的最后一行同样计入
+int line_index_line_count(const LineIndex* index, const char* data, size_t len) {
+    return (int)index->header.newline_count + ((len > 0 && data[len - 1] != '\n') ? 1 : 0);
+}
+
+const char* line_index_default_eol(const LineIndex* index, const char* data, size_t len) {
+    return (index->header.crlf_count * 2 > line_index_line_count(index, data, len)) ? "\r\n" : "\n";
+}
+
+// 最后一个行号不大于line的索引项
+static int64_t line_index_find(const LineIndex* index, int64_t line) {
+    int64_t low = 0, high = index->header.entry_count - 1, found = -1;
+    while (low <= high) {
+        int64_t mid = low + (high - low) / 2;
+        if (index->entries[mid].line <= line) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+// 第line行（从0开始）的起始偏移：从最近的索引项向后数换行符，超出文件末尾时返回len
+size_t line_index_seek(const LineIndex* index, const char* data, size_t len, int line) {
+    if (line <= 0) return 0;
+    int64_t entry = line_index_find(index, line);
+    if (entry < 0) return len;
+
+    int64_t current = index->entries[entry].line;
+    if (current >= line) return index->entries[entry].offset;
+    size_t offset = index->entries[entry].offset;
+    size_t seen = 0;
+    const char* nl = scan_nth_newline(data + offset, len - offset, line - current, &seen);
+    return (nl != NULL) ? (size_t)(nl - data) + 1 : len;
+}
+
+// 编辑后增量更新：[begin, end)为旧内容中被替换的字节区间（由编辑命令给出，不再比较整个内容），
+// 前缀中的索引项不变，后缀中的平移，区间内的按新内容重新生成
+void line_index_update(LineIndex* index, const char* old_data, size_t old_len, const char* new_data, size_t new_len,
+                       size_t begin, size_t end) {
+    size_t prefix = begin;
+    size_t suffix = old_len - end;
+    size_t old_end = end;
+    size_t new_end = new_len - suffix;
+
+    // 后缀第一个字节处的换行符可能因前一个字节改变而变为（或不再是）\r\n，一并统计
+    int64_t old_newlines = 0, old_crlfs = 0, new_newlines = 0, new_crlfs = 0;
+    line_index_count(old_data, prefix, (old_end < old_len) ? old_end + 1 : old_len, &old_newlines, &old_crlfs);
+    line_index_count(new_data, prefix, (new_end < new_len) ? new_end + 1 : new_len, &new_newlines, &new_crlfs);
+    int64_t line_delta = new_newlines - old_newlines;
+
+    LineIndex updated = *index;
+    updated.entries = NULL;
+    updated.capacity = 0;
+    updated.header.entry_count = 0;
+
+    // 前缀：行首不超过prefix的索引项保持不变
+    int64_t i = 0;
+    int64_t last_line = -1;
+    for (; i < index->header.entry_count && index->entries[i].offset <= prefix; i++) {
+        line_index_push(&updated, index->entries[i].line, index->entries[i].offset);
+        last_line = index->entries[i].line;
+    }
+    if (new_len > 0 && updated.header.entry_count == 0) {
+        line_index_push(&updated, 0, 0);
+        last_line = 0;
+    }
+
+    // 替换区间：新内容(prefix, new_end]中的行首按间隔补充索引项
+    if (updated.header.entry_count > 0) {
+        const LineIndexEntry* anchor = &updated.entries[updated.header.entry_count - 1];
+        int64_t line = anchor->line;
+        int64_t ignored = 0;
+        line_index_count(new_data, anchor->offset, prefix, &line, &ignored);
+        const char* p = new_data + prefix;
+        const char* end = new_data + new_end;
+        while ((p = memchr(p, '\n', end - p)) != NULL) {
+            p++;
+            line++;
+            if (line - last_line >= LINE_INDEX_STRIDE && (size_t)(p - new_data) < new_len) {
+                line_index_push(&updated, line, p - new_data);
+                last_line = line;
+            }
+        }
+    }
+
+    // 后缀：跳过区间内被替换的索引项，其余平移
+    for (; i < index->header.entry_count; i++) {
+        if (index->entries[i].offset <= old_end) continue;
+        int64_t line = index->entries[i].line + line_delta;
+        if (line <= last_line) continue;
+        line_index_push(&updated, line, index->entries[i].offset - old_len + new_len);
+        last_line = line;
+    }
+
+    updated.header.newline_count += line_delta;
+    updated.header.crlf_count += new_crlfs - old_crlfs;
+    updated.header.size = new_len;
+    free(index->entries);
+    *index = updated;
+    index->dirty = 1;
+}
+
+static void line_index_path(const char* path, char* out, size_t size) {
+    char* target = realpath(path, NULL);
+    const char* key = (target != NULL) ? target : path;
+    snprintf(out, size, "%s/%016llx.idx", LINE_INDEX_DIR,
+             (unsigned long long)hash_bytes(key, strlen(key), 0));
+    free(target);
+}
+
+// 加载索引文件，与文件当前状态不符时返回NULL
+static LineIndex* line_index_load(FileState* file) {
+    char path[MAX_PATH_LEN];
+    line_index_path(file->path, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    LineIndex* index = (LineIndex*)calloc(1, sizeof(LineIndex));
+    if (index == NULL) {
+        close(fd);
+        return NULL;
+    }
+    LineIndexHeader* header = &index->header;
+    struct stat st;
+    int valid = fstat(fd, &st) == 0 &&
+                pread(fd, header, sizeof(*header), 0) == (ssize_t)sizeof(*header) &&
+                memcmp(header->magic, LINE_INDEX_MAGIC, 8) == 0 &&
+                header->version == LINE_INDEX_VERSION && header->stride == LINE_INDEX_STRIDE &&
+                header->size == (uint64_t)file->stamp.st_size && header->size == file->len &&
+                header->mtime_sec == (int64_t)file->stamp.st_mtim.tv_sec &&
+                header->mtime_nsec == (int64_t)file->stamp.st_mtim.tv_nsec &&
+                header->dev == (uint64_t)file->stamp.st_dev && header->ino == (uint64_t)file->stamp.st_ino &&
+                header->entry_count >= 0 &&
+                (uint64_t)st.st_size == sizeof(*header) + header->entry_count * sizeof(LineIndexEntry);
+    // 内容哈希已经计算过时（例如账本需要）一并校验
+    if (valid && file->hash_valid && header->hash != file->hash) valid = 0;
+    if (valid) {
+        size_t size = header->entry_count * sizeof(LineIndexEntry);
+        index->entries = (LineIndexEntry*)malloc(size + 1);
+        index->capacity = header->entry_count;
+        valid = index->entries != NULL &&
+                pread(fd, index->entries, size, sizeof(*header)) == (ssize_t)size;
+    }
+    close(fd);
+
+    if (!valid) {
+        line_index_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+// 取得文件的行号索引：优先使用有效的索引文件，否则扫描当前内容建立
+LineIndex* file_state_line_index(FileState* file) {
+    if (file->line_index != NULL) return file->line_index;
+
+    size_t len = 0;
+    const char* content = file_state_load(file, &len);
+    if (content == NULL) return NULL;
+
+    int persistent = line_index_persistent() && file->owner->buffers == NULL;
+    if (persistent && !file->dirty) {
+        file->line_index = line_index_load(file);
+    }
+    if (file->line_index == NULL) {
+        file->line_index = line_index_build(content, len);
+        if (file->line_index != NULL) file->line_index->dirty = persistent;
+    }
+    return file->line_index;
+}
+
+// 写回后保存索引（先写临时文件再rename），记录当前的文件状态和内容哈希
+void file_state_save_line_index(FileState* file) {
+    LineIndex* index = file->line_index;
+    if (index == NULL || !index->dirty || !line_index_persistent()) return;
+    index->dirty = 0;
+    if (file->stamp.st_ino == 0 || file->status != FILE_LOADED) return;
+
+    uint64_t hash = 0;
+    if (!file_state_hash(file, &hash)) return;
+    index->header.size = file->len;
+    index->header.mtime_sec = file->stamp.st_mtim.tv_sec;
+    index->header.mtime_nsec = file->stamp.st_mtim.tv_nsec;
+    index->header.dev = file->stamp.st_dev;
+    index->header.ino = file->stamp.st_ino;
+    index->header.hash = hash;
+
+    char path[MAX_PATH_LEN];
+    char temp[MAX_PATH_LEN + 8];
+    mkdir(LINE_INDEX_DIR, 0755);
+    line_index_path(file->path, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    size_t size = index->header.entry_count * sizeof(LineIndexEntry);
+    int success = write(fd, &index->header, sizeof(index->header)) == (ssize_t)sizeof(index->header) &&
+                  (size == 0 || write(fd, index->entries, size) == (ssize_t)size);
+    close(fd);
+    if (!success || rename(temp, path) != 0) unlink(temp);
+}
+
+// 当前内容的哈希，按需计算并缓存到内容改变为止
+int file_state_hash(FileState* file, uint64_t* hash) {
+    if (!file->hash_valid) {
+        size_t len = 0;
+        const char* content = file_state_load(file, &len);
+        if (content == NULL) return 0;
+        file->hash = hash_content(content, len);
+        file->hash_valid = 1;
+    }
+    *hash = file->hash;
+    return 1;
+}
+
+static uint64_t hash_text_arg(const TextArg* arg, uint64_t seed) {
+    const char* text = (arg->text != NULL) ? arg->text : "";
+    size_t len = strlen(text);
+    seed = hash_bytes(&len, sizeof(len), seed);
+    return hash_bytes(text, len, seed);
+}
+
+// 命令的哈希：不含标题，JSON命令文件与执行计划中的同一条命令哈希相同
+uint64_t command_spec_key(const CommandSpec* spec) {
+    const char* file = command_spec_file(spec);
+    int32_t values[6] = {spec->call, 0, 0, 0, 0, 0};
+    uint64_t hash = hash_bytes(file, strlen(file) + 1, 0);
+
+    if (spec->call == CALL_REPLACE_BY_CONTENT) {
+        const ReplaceByContentArgs* args = &spec->args.content;
+        values[1] = args->startLine;
+        values[3] = args->backward_scan_limit;
+        values[4] = args->forward_scan_limit;
+        hash = hash_text_arg(&args->old_str, hash);
+        hash = hash_text_arg(&args->new_str, hash);
+    } else if (spec->call == CALL_REPLACE_BLOCK) {
+        const ReplaceBlockArgs* args = &spec->args.block;
+        values[1] = args->startLine;
+        hash = hash_text_arg(&args->header, hash);
+        hash = hash_text_arg(&args->new_str, hash);
+    } else if (spec->call == CALL_APPLY_PATCH) {
+        // 按文件段识别：同一补丁中各文件的部分分别记录
+        const ApplyPatchArgs* args = &spec->args.patch;
+        size_t section_len = args->section_end - args->section_begin;
+        values[3] = args->backward_scan_limit;
+        values[4] = args->forward_scan_limit;
+        hash = hash_bytes(&section_len, sizeof(section_len), hash);
+        hash = hash_bytes(args->patch.text + args->section_begin, section_len, hash);
+    } else if (spec->call == CALL_INSERT_LINES || spec->call == CALL_DELETE_LINES || spec->call == CALL_APPEND) {
+        const LineEditArgs* args = &spec->args.lines;
+        values[1] = args->startLine;
+        values[2] = args->endLine;
+        values[3] = args->backward_scan_limit;
+        values[4] = args->forward_scan_limit;
+        hash = hash_text_arg(&args->new_str, hash);
+        hash = hash_text_arg(&args->guard, hash);
+    } else {
+        const ReplaceByLinesArgs* args = &spec->args.range;
+        values[1] = args->startLine;
+        values[2] = args->endLine;
+        values[3] = args->backward_scan_limit;
+        values[4] = args->forward_scan_limit;
+        hash = hash_text_arg(&args->new_str, hash);
+        hash = hash_text_arg(&args->startLine_str, hash);
+        hash = hash_text_arg(&args->endLine_str, hash);
+    }
+    return hash_bytes(values, sizeof(values), hash);
+}
+
+static uint64_t ledger_record_key(uint64_t path_hash, uint64_t pre_hash, uint64_t command_key) {
+    uint64_t values[3] = {path_hash, pre_hash, command_key};
+    return hash_bytes(values, sizeof(values), 0);
+}
+
+// 批次中间状态的标识：由上一状态和命令推出，不对文件内容计算哈希
+static uint64_t ledger_chain_state(uint64_t record_key) {
+    return hash_bytes(&record_key, sizeof(record_key), 2);
+}
+
+static uint64_t ledger_post_key(uint64_t path_hash, uint64_t post_hash) {
+    uint64_t values[2] = {path_hash, post_hash};
+    return hash_bytes(values, sizeof(values), 1);
+}
+
+// 将记录加入索引，相同key的旧记录被新记录覆盖
+static void ledger_index_insert(int* index, int capacity, uint64_t key, int record,
+                                const LedgerRecord* records, int by_post) {
+    int slot = (int)(key & (capacity - 1));
+    while (index[slot] != 0) {
+        const LedgerRecord* other = &records[index[slot] - 1];
+        uint64_t other_key = by_post ? ledger_post_key(other->path_hash, other->post_hash) : other->key;
+        if (other_key == key) break;
+        slot = (slot + 1) & (capacity - 1);
+    }
+    index[slot] = record + 1;
+}
+
+static void ledger_index_add(Ledger* ledger, int record) {
+    if ((ledger->count) * 2 > ledger->index_capacity) {
+        int capacity = (ledger->index_capacity > 0) ? ledger->index_capacity : 1024;
+        while (ledger->count * 2 > capacity) capacity *= 2;
+        free(ledger->by_key);
+        free(ledger->by_post);
+        ledger->by_key = (int*)calloc(capacity, sizeof(int));
+        ledger->by_post = (int*)calloc(capacity, sizeof(int));
+        ledger->index_capacity = capacity;
+        for (int i = 0; i < record; i++) {
+            const LedgerRecord* r = &ledger->records[i];
+            ledger_index_insert(ledger->by_key, capacity, r->key, i, ledger->records, 0);
+            ledger_index_insert(ledger->by_post, capacity, ledger_post_key(r->path_hash, r->post_hash), i,
+                                ledger->records, 1);
+        }
+    }
+    const LedgerRecord* r = &ledger->records[record];
+    ledger_index_insert(ledger->by_key, ledger->index_capacity, r->key, record, ledger->records, 0);
+    ledger_index_insert(ledger->by_post, ledger->index_capacity, ledger_post_key(r->path_hash, r->post_hash), record,
+                        ledger->records, 1);
+}
+
+static const LedgerRecord* ledger_find(const Ledger* ledger, const int* index, uint64_t key, int by_post) {
+    if (ledger->index_capacity == 0) return NULL;
+    int slot = (int)(key & (ledger->index_capacity - 1));
+    while (index[slot] != 0) {
+        const LedgerRecord* r = &ledger->records[index[slot] - 1];
+        uint64_t other_key = by_post ? ledger_post_key(r->path_hash, r->post_hash) : r->key;
+        if (other_key == key) return r;
+        slot = (slot + 1) & (ledger->index_capacity - 1);
+    }
+    return NULL;
+}
+
+static int ledger_append(Ledger* ledger, const LedgerRecord* record) {
+    if (ledger->count == ledger->capacity) {
+        int capacity = (ledger->capacity > 0) ? ledger->capacity * 2 : 256;
+        LedgerRecord* records = (LedgerRecord*)realloc(ledger->records, capacity * sizeof(LedgerRecord));
+        if (records == NULL) return 0;
+        ledger->records = records;
+        ledger->capacity = capacity;
+    }
+    ledger->records[ledger->count] = *record;
+    ledger->count++;
+    return 1;
+}
+
+// 将尚未加入索引的记录加入索引
+static void ledger_index_pending(Ledger* ledger) {
+    while (ledger->indexed < ledger->count) {
+        ledger_index_add(ledger, ledger->indexed);
+        ledger->indexed++;
+    }
+}
+
+// 对.jsondo/locks/ledger.lock加锁（读取时共享，写入时独占），返回锁文件描述符，失败返回-1。
+// 账本重建时会改写整个文件，锁放在单独的文件上
+static int ledger_lock(short type) {
+    mkdir(LOCK_DIR, 0755);
+    int fd = open(LOCK_DIR "/ledger.lock", O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+#ifdef F_OFD_SETLKW
+    int set_lock_wait = F_OFD_SETLKW;
+#else
+    int set_lock_wait = F_SETLKW;
+#endif
+    int result;
+    while ((result = fcntl(fd, set_lock_wait, &lock)) != 0 && errno == EINTR) {
+    }
+    if (result != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 加载账本；设置JSONDO_LEDGER=off时不使用账本，返回NULL
+Ledger* ledger_open(FileStateTable* table) {
+    if (table->buffers != NULL) return NULL;   // 内存模式不使用账本
+    if (table->ledger == NULL) {
+        table->ledger = (Ledger*)calloc(1, sizeof(Ledger));
+        if (table->ledger == NULL) return NULL;
+        const char* mode = getenv("JSONDO_LEDGER");
+        table->ledger->disabled = (mode != NULL && strcmp(mode, "off") == 0);
+        if (table->ledger->disabled) return NULL;
+
+        // 账本格式不符时忽略原有内容，下次写入时重建
+        size_t size = 0;
+        char* data = NULL;
+        int lock_fd = ledger_lock(F_RDLCK);
+        int fd = open(LEDGER_PATH, O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(LedgerHeader)) {
+            size = (size_t)st.st_size;
+            data = (char*)malloc(size);
+            if (data != NULL && pread(fd, data, size, 0) != (ssize_t)size) {
+                free(data);
+                data = NULL;
+            }
+        }
+        if (fd >= 0) close(fd);
+        if (lock_fd >= 0) close(lock_fd);
+
+        const LedgerHeader* header = (const LedgerHeader*)data;
+        if (data != NULL && memcmp(header->magic, LEDGER_MAGIC, 8) == 0 &&
+            header->version == LEDGER_VERSION && header->record_size == sizeof(LedgerRecord)) {
+            // 末尾不完整的记录（写入中断）直接忽略
+            size_t count = (size - sizeof(LedgerHeader)) / sizeof(LedgerRecord);
+            for (size_t i = 0; i < count; i++) {
+                LedgerRecord record;
+                memcpy(&record, data + sizeof(LedgerHeader) + i * sizeof(LedgerRecord), sizeof(record));
+                ledger_append(table->ledger, &record);
+            }
+        }
+        table->ledger->committed = table->ledger->count;
+        ledger_index_pending(table->ledger);
+        free(data);
+    }
+    return table->ledger->disabled ? NULL : table->ledger;
+}
+
+void ledger_free(Ledger* ledger) {
+    if (ledger == NULL) return;
+    free(ledger->records);
+    free(ledger->by_key);
+    free(ledger->by_post);
+    free(ledger);
+}
+
+// 回溯时经过的哈希集合（开放寻址，0表示空位），已存在时返回0
+static int ledger_seen_insert(uint64_t* slots, int capacity, uint64_t hash) {
+    if (hash == 0) hash = 1;
+    int slot = (int)(hash & (capacity - 1));
+    while (slots[slot] != 0) {
+        if (slots[slot] == hash) return 0;
+        slot = (slot + 1) & (capacity - 1);
+    }
+    slots[slot] = hash;
+    return 1;
+}
+
+// 从当前内容哈希沿账本记录回溯，得到该文件经过的内容哈希链（从早到晚）。
+// 内容往复变化（如x=1改为x=2后又改回）时记录成环，回溯到重复的哈希即停止，
+// 链中每个状态只出现一次，之前绕过的命令不会被当作已执行
+static void ledger_build_chain(const Ledger* ledger, FileState* file, uint64_t path_hash, uint64_t hash) {
+    int capacity = 16;
+    int seen_capacity = 32;
+    int len = 0;
+    uint64_t* chain = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    uint64_t* seen = (uint64_t*)calloc(seen_capacity, sizeof(uint64_t));
+    if (chain == NULL || seen == NULL) {
+        free(chain);
+        free(seen);
+        return;
+    }
+    chain[len++] = hash;
+    ledger_seen_insert(seen, seen_capacity, hash);
+
+    for (;;) {
+        const LedgerRecord* r = ledger_find(ledger, ledger->by_post, ledger_post_key(path_hash, hash), 1);
+        if (r == NULL || !ledger_seen_insert(seen, seen_capacity, r->pre_hash)) break;
+        hash = r->pre_hash;
+        if (len == capacity) {
+            capacity *= 2;
+            uint64_t* grown = (uint64_t*)realloc(chain, capacity * sizeof(uint64_t));
+            if (grown == NULL) break;
+            chain = grown;
+        }
+        chain[len++] = hash;
+        if (len * 2 > seen_capacity) {
+            // 扩容后按链重建集合
+            seen_capacity *= 2;
+            free(seen);
+            seen = (uint64_t*)calloc(seen_capacity, sizeof(uint64_t));
+            if (seen == NULL) break;
+            for (int i = 0; i < len; i++) ledger_seen_insert(seen, seen_capacity, chain[i]);
+        }
+    }
+    free(seen);
+
+    for (int i = 0; i < len / 2; i++) {
+        uint64_t tmp = chain[i];
+        chain[i] = chain[len - 1 - i];
+        chain[len - 1 - i] = tmp;
+    }
+    file->replay_chain = chain;
+    file->replay_len = len;
+}
+
+// 判断命令是否已经执行过：账本中存在以链上某个状态为执行前内容、
+// 以链上下一个状态为执行后内容的记录。当前内容（链的末尾）曾是该命令的执行前内容时，
+// 说明之后又被改回，不跳过。重放按命令顺序沿链推进，
+// 遇到第一条未执行过的命令后，该文件本批次不再跳过
+int ledger_skip(Ledger* ledger, FileState* file, uint64_t command_key, EditResult* edit) {
+    if (ledger->count == 0 || (file->replay_built && file->replay_pos < 0)) return 0;
+
+    uint64_t path_hash = hash_bytes(file->path, strlen(file->path), 0);
+    if (!file->replay_built) {
+        uint64_t hash;
+        file->replay_built = 1;
+        file->replay_pos = -1;
+        if (!file_state_hash(file, &hash)) return 0;
+        ledger_build_chain(ledger, file, path_hash, hash);
+        if (file->replay_len < 2) return 0;
+        file->replay_pos = 0;
+    }
+
+    uint64_t current = file->replay_chain[file->replay_len - 1];
+    if (ledger_find(ledger, ledger->by_key, ledger_record_key(path_hash, current, command_key), 0) != NULL) {
+        file->replay_pos = -1;
+        return 0;
+    }
+
+    for (int i = file->replay_pos; i + 1 < file->replay_len; i++) {
+        uint64_t key = ledger_record_key(path_hash, file->replay_chain[i], command_key);
+        const LedgerRecord* r = ledger_find(ledger, ledger->by_key, key, 0);
+        if (r != NULL && r->post_hash == file->replay_chain[i + 1]) {
+            edit->line = r->line;
+            edit->deleted = r->deleted;
+            edit->inserted = r->inserted;
+            file->replay_pos = i + 1;
+            return 1;
+        }
+    }
+    file->replay_pos = -1;
+    return 0;
+}
+
+// 记录一条成功执行的命令，批次写回时追加到账本文件。
+// 执行后状态暂用由命令推出的中间状态，批次写回时最后一条记录改为文件内容的哈希（ledger_seal），
+// 因此每个文件每批次只在首次执行和写回时各计算一次哈希；重放时沿记录回溯，中间状态同样能够接续
+void ledger_record(Ledger* ledger, FileState* file, uint64_t command_key, uint64_t pre_hash, const EditResult* edit) {
+    LedgerRecord record = {0};
+    record.path_hash = hash_bytes(file->path, strlen(file->path), 0);
+    record.pre_hash = pre_hash;
+    record.key = ledger_record_key(record.path_hash, pre_hash, command_key);
+    record.post_hash = ledger_chain_state(record.key);
+    record.line = edit->line;
+    record.deleted = edit->deleted;
+    record.inserted = edit->inserted;
+    if (!ledger_append(ledger, &record)) return;
+    file->ledger_state = record.post_hash;
+    file->ledger_last = ledger->count - 1;
+    file->ledger_pending = 1;
+
+    // 已执行新命令，该文件之后的命令不再按账本跳过
+    file->replay_built = 1;
+    file->replay_pos = -1;
+}
+
+// 批次写回前将该文件最后一条记录的执行后状态改为当前内容的哈希
+void ledger_seal(Ledger* ledger, FileState* file) {
+    if (file->ledger_pending) {
+        uint64_t hash;
+        if (file_state_hash(file, &hash)) ledger->records[file->ledger_last].post_hash = hash;
+        file->ledger_pending = 0;
+    }
+}
+
+// 将新记录追加到账本文件。加载之后其他进程可能已经追加或重建了账本，
+// 写入前在独占锁下重新检查文件头：格式正确时截掉末尾不完整的记录再追加，否则重建。
+// 记录数超过LEDGER_COMPACT_LIMIT时丢弃较早的记录，只保留最新的一半
+int ledger_commit(Ledger* ledger) {
+    if (ledger == NULL || ledger->disabled) return 1;
+    ledger_index_pending(ledger);
+    if (ledger->committed == ledger->count) return 1;
+
+    int lock_fd = ledger_lock(F_WRLCK);
+    int fd = (lock_fd >= 0) ? open(LEDGER_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+    if (fd < 0) {
+        if (lock_fd >= 0) close(lock_fd);
+        report("  Failed to write ledger: %s\n", LEDGER_PATH);
+        return 0;
+    }
+
+    LedgerHeader header;
+    struct stat st;
+    int valid = (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(header) &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, LEDGER_MAGIC, 8) == 0 && header.version == LEDGER_VERSION &&
+                 header.record_size == sizeof(LedgerRecord));
+    size_t stored = valid ? ((size_t)st.st_size - sizeof(header)) / sizeof(LedgerRecord) : 0;
+    int first = valid ? ledger->committed : 0;
+    size_t added = (size_t)(ledger->count - first);
+    size_t kept = stored;
+    int success = 1;
+
+    if (!valid || stored + added > LEDGER_COMPACT_LIMIT) {
+        // 重建账本文件，或压缩时将保留的较新记录移到文件头之后
+        kept = (valid && added < LEDGER_COMPACT_LIMIT / 2) ? LEDGER_COMPACT_LIMIT / 2 - added : 0;
+        if (kept > stored) kept = stored;
+        LedgerRecord* tail = NULL;
+        if (kept > 0) {
+            tail = (LedgerRecord*)malloc(kept * sizeof(LedgerRecord));
+            off_t from = (off_t)(sizeof(header) + (stored - kept) * sizeof(LedgerRecord));
+            success = (tail != NULL && pread(fd, tail, kept * sizeof(LedgerRecord), from) ==
+                                           (ssize_t)(kept * sizeof(LedgerRecord)));
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LEDGER_MAGIC, 8);
+        header.version = LEDGER_VERSION;
+        header.record_size = sizeof(LedgerRecord);
+        success = success && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+        if (success && kept > 0) {
+            success = (pwrite(fd, tail, kept * sizeof(LedgerRecord), sizeof(header)) ==
+                       (ssize_t)(kept * sizeof(LedgerRecord)));
+        }
+        free(tail);
+        if (added > LEDGER_COMPACT_LIMIT / 2) {
+            first = ledger->count - LEDGER_COMPACT_LIMIT / 2;
+            added = LEDGER_COMPACT_LIMIT / 2;
+        }
+    }
+    off_t offset = (off_t)(sizeof(header) + kept * sizeof(LedgerRecord));
+    size_t size = added * sizeof(LedgerRecord);
+    if (success && (ftruncate(fd, offset) != 0 || pwrite(fd, ledger->records + first, size, offset) != (ssize_t)size)) {
+        success = 0;
+    }
+    close(fd);
+    close(lock_fd);
+
+    if (!success) {
+        report("  Failed to write ledger: %s\n", LEDGER_PATH);
+        return 0;
+    }
+    ledger->committed = ledger->count;
+    return 1;
+}
+
+// 记录输出超过该大小时提前写出，避免超大批次占用过多内存
+#define REPORT_FLUSH_SIZE (4u * 1024 * 1024)
+
+// 文本消息：文本模式直接输出，JSONL模式或库接口调用时收集到当前命令的message字段
+void report(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (!report_state.capture && (!report_state.jsonl || report_state.source == NULL)) {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    char stack[512];
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(stack, sizeof(stack), format, args);
+    if (len >= (int)sizeof(stack)) {
+        char* text = (char*)malloc(len + 1);
+        if (text != NULL) {
+            vsnprintf(text, len + 1, format, copy);
+            byte_buffer_append(&report_state.message, text, len, 1);
+            free(text);
+        }
+    } else if (len > 0) {
+        byte_buffer_append(&report_state.message, stack, len, 1);
+    }
+    va_end(copy);
+    va_end(args);
+}
+
+// 仅在文本模式输出的提示（标题、分隔行等），JSONL记录中已有对应字段
+void report_text(const char* format, ...) {
+    if (report_state.jsonl || report_state.capture) return;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// 是否需要逐条命令的记录（JSONL输出或库接口的执行结果）
+int report_records(void) {
+    return report_state.jsonl || report_state.capture;
+}
+
+long long report_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void report_append(const char* text) {
+    byte_buffer_append(&report_state.out, text, strlen(text), 1);
+}
+
+static void report_append_format(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void report_append_format(const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (len > 0) byte_buffer_append(&report_state.out, text, (size_t)len < sizeof(text) ? (size_t)len : sizeof(text) - 1, 1);
+}
+
+// 追加JSON字符串（含引号），NULL输出为null
+static void report_append_string(const char* text, size_t len) {
+    if (text == NULL) {
+        report_append("null");
+        return;
+    }
+    report_append("\"");
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        byte_buffer_append(&report_state.out, text + run, i - run, 1);
+        run = i + 1;
+        switch (c) {
+            case '"': report_append("\\\""); break;
+            case '\\': report_append("\\\\"); break;
+            case '\n': report_append("\\n"); break;
+            case '\r': report_append("\\r"); break;
+            case '\t': report_append("\\t"); break;
+            default: report_append_format("\\u%04x", c); break;
+        }
+    }
+    byte_buffer_append(&report_state.out, text + run, len - run, 1);
+    report_append("\"");
+}
+
+// 已收集的消息去掉首尾的缩进和换行后的范围
+static const char* report_message_text(size_t* out_len) {
+    const char* text = report_state.message.data;
+    size_t begin = 0, len = report_state.message.len;
+    while (begin < len && text[begin] == ' ') begin++;
+    while (len > begin && (text[len - 1] == '\n' || text[len - 1] == ' ')) len--;
+    *out_len = len - begin;
+    return (len > begin) ? text + begin : "";
+}
+
+// 取出已收集的消息并清空
+static void report_append_message(void) {
+    size_t len = 0;
+    const char* text = report_message_text(&len);
+    report_append_string(text, len);
+    report_state.message.len = 0;
+}
+
+static char* report_take_message(void) {
+    size_t len = 0;
+    const char* text = report_message_text(&len);
+    char* message = (char*)malloc(len + 1);
+    if (message != NULL) {
+        memcpy(message, text, len);
+        message[len] = '\0';
+    }
+    report_state.message.len = 0;
+    return message;
+}
+
+// 记录中的行号范围为被替换的原有行；纯插入（deleted为0）时起止行号均为插入位置
+static int report_end_line(const EditResult* edit) {
+    return (edit->deleted > 0) ? edit->line + edit->deleted - 1 : edit->line;
+}
+
+// 库接口调用：命令结果追加到调用者的result中
+static void report_capture_command(const CommandSpec* spec, const char* status, const EditResult* edit,
+                                   long long bytes_delta, long long elapsed_us) {
+    JsondoResult* result = report_state.result;
+    JsondoCommandResult* items = (result != NULL) ?
+        (JsondoCommandResult*)realloc(result->commands, (result->command_count + 1) * sizeof(JsondoCommandResult)) : NULL;
+    if (items == NULL) {
+        report_state.message.len = 0;
+        return;
+    }
+
+    result->commands = items;
+    JsondoCommandResult* item = &items[result->command_count++];
+    memset(item, 0, sizeof(*item));
+    item->index = spec->index;
+    item->status = status;
+    if (strcmp(status, "failed") != 0) {
+        item->start_line = edit->line;
+        item->end_line = report_end_line(edit);
+        item->deleted = edit->deleted;
+        item->inserted = edit->inserted;
+        item->bytes_delta = bytes_delta;
+    }
+    item->time_us = elapsed_us;
+    item->message = report_take_message();
+}
+
+static void report_flush(void) {
+    if (report_state.out.len > 0) {
+        fwrite(report_state.out.data, 1, report_state.out.len, stdout);
+        report_state.out.len = 0;
+    }
+    fflush(stdout);
+}
+
+void report_begin_batch(const char* source) {
+    report_state.source = source;
+    report_state.applied = 0;
+    report_state.skipped = 0;
+    report_state.failed = 0;
+    report_state.message.len = 0;
+    report_state.started_us = report_clock_us();
+}
+
+// 每条命令一行记录：状态、实际行号范围、删除/插入行数、字节变化和耗时
+void report_command(const CommandSpec* spec, const char* status, const EditResult* edit,
+                    long long bytes_delta, long long elapsed_us) {
+    if (strcmp(status, "failed") == 0) {
+        report_state.failed++;
+    } else if (strcmp(status, "skipped") == 0) {
+        report_state.skipped++;
+    } else {
+        report_state.applied++;
+    }
+    if (report_state.capture) {
+        report_capture_command(spec, status, edit, bytes_delta, elapsed_us);
+        return;
+    }
+    if (!report_state.jsonl) return;
+
+    const char* file = command_spec_file(spec);
+    report_append("{\"type\":\"command\",\"source\":");
+    report_append_string(report_state.source, report_state.source ? strlen(report_state.source) : 0);
+    report_append_format(",\"index\":%d,\"call\":\"%s\",\"file\":", spec->index, command_spec_call_name(spec));
+    report_append_string(file, strlen(file));
+    report_append(",\"title\":");
+    report_append_string(spec->title, spec->title ? strlen(spec->title) : 0);
+    report_append_format(",\"status\":\"%s\"", status);
+    if (strcmp(status, "failed") != 0) {
+        report_append_format(",\"start_line\":%d,\"end_line\":%d,\"deleted\":%d,\"inserted\":%d,\"bytes_delta\":%lld",
+                             edit->line, report_end_line(edit), edit->deleted, edit->inserted, bytes_delta);
+    }
+    report_append_format(",\"time_us\":%lld,\"message\":", elapsed_us);
+    report_append_message();
+    report_append("}\n");
+
+    if (report_state.out.len >= REPORT_FLUSH_SIZE) report_flush();
+}
+
+// 批次结束：输出汇总记录（包含命令之外的消息，如JSON格式错误、写回失败）并写出
+void report_end_batch(int success) {
+    if (report_state.capture) {
+        JsondoResult* result = report_state.result;
+        if (result != NULL) {
+            result->success = success;
+            result->applied = report_state.applied;
+            result->skipped = report_state.skipped;
+            result->failed = report_state.failed;
+            result->time_us = report_clock_us() - report_state.started_us;
+            result->message = report_take_message();
+        }
+        report_state.message.len = 0;
+    } else if (report_state.jsonl) {
+        report_append("{\"type\":\"batch\",\"source\":");
+        report_append_string(report_state.source, report_state.source ? strlen(report_state.source) : 0);
+        report_append_format(",\"status\":\"%s\",\"applied\":%d,\"skipped\":%d,\"failed\":%d,\"time_us\":%lld,\"message\":",
+                             success ? "ok" : "failed", report_state.applied, report_state.skipped,
+                             report_state.failed, report_clock_us() - report_state.started_us);
+        report_append_message();
+        report_append("}\n");
+        report_flush();
+    }
+    report_state.source = NULL;
+}
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static void watch_signal_handler(int sig) {
+    watch_stop = 1;
+}
+
+// 监视模式只处理目录中非隐藏的.json文件（编辑器临时文件、写入中的.tmp文件均跳过）
+static int watch_is_command_file(const char* name) {
+    size_t len = strlen(name);
+    return name[0] != '.' && len > 5 && strcmp(name + len - 5, ".json") == 0;
+}
+
+static int watch_compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// 执行一个命令文件，成功后移入done/，失败移入failed/，避免重复执行
+static void watch_apply_file(const char* dir, const char* name, FileStateTable* files) {
+    char command_file[MAX_PATH_LEN];
+    char moved_path[MAX_PATH_LEN];
+    snprintf(command_file, sizeof(command_file), "%s/%s", dir, name);
+
+    // 文件可能在事件到达前已被移走
+    char* json_content = read_file(command_file);
+    if (json_content == NULL) return;
+
+    report_begin_batch(command_file);
+    report_text("Eval command from %s\n", command_file);
+    int success = run_command_batch(json_content, files);
+    free(json_content);
+
+    if (success) {
+        record_applied(files, command_file);
+    }
+    snprintf(moved_path, sizeof(moved_path), "%s/%s/%s", dir, success ? "done" : "failed", name);
+    if (rename(command_file, moved_path) != 0) {
+        report("Failed to move command file: %s\n", command_file);
+    } else if (success) {
+        report_text("[OK] All changes from %s[done] are applied.\n", command_file);
+    } else {
+        report_text("[FAILED] %s moved to %s\n", command_file, moved_path);
+    }
+    report_text("\n");
+    report_end_batch(success);
+    fflush(stdout);
+}
+
+// 处理目录中已存在的命令文件，按文件名排序执行
+static void watch_drain_directory(const char* dir, FileStateTable* files) {
+    DIR* handle = opendir(dir);
+    if (handle == NULL) return;
+
+    char** names = NULL;
+    int count = 0;
+    int capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (!watch_is_command_file(entry->d_name)) continue;
+        if (count == capacity) {
+            capacity = (capacity > 0) ? capacity * 2 : 16;
+            names = (char**)realloc(names, capacity * sizeof(char*));
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(handle);
+
+    if (count > 1) qsort(names, count, sizeof(char*), watch_compare_names);
+    for (int i = 0; i < count && !watch_stop; i++) {
+        watch_apply_file(dir, names[i], files);
+    }
+    free_string_array(names, count);
+}
+
+// 监视目录：命令文件写入完成（或移入目录）后立即执行；
+// 同一个进程内复用文件缓存和I/O队列，省去每个命令文件的启动和重新读取开销
+int watch_directory(const char* dir) {
+#ifdef __linux__
+    char sub_dir[MAX_PATH_LEN];
+    snprintf(sub_dir, sizeof(sub_dir), "%s/done", dir);
+    mkdir(sub_dir, 0755);
+    snprintf(sub_dir, sizeof(sub_dir), "%s/failed", dir);
+    mkdir(sub_dir, 0755);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        printf("Failed to watch directory: %s\n", dir);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    // 不设置SA_RESTART，使read()被信号中断后退出循环
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watch_signal_handler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    FileStateTable files = {0};
+    files.ring = io_ring_create(IO_RING_ENTRIES);
+
+    report_text("Watching %s for command files (Ctrl+C to stop)\n\n", dir);
+    fflush(stdout);
+
+    // 先处理启动前已存在的命令文件，再处理新事件
+    watch_drain_directory(dir, &files);
+
+    char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!watch_stop) {
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            printf("Failed to read watch events: %s\n", dir);
+            break;
+        }
+
+        for (char* p = events; p < events + n && !watch_stop; ) {
+            struct inotify_event* event = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // 事件队列溢出时重新扫描目录
+                watch_drain_directory(dir, &files);
+            } else if (event->len > 0 && watch_is_command_file(event->name)) {
+                watch_apply_file(dir, event->name, &files);
+            }
+        }
+    }
+
+    report_text("Stopped watching %s\n", dir);
+    file_state_table_free(&files);
+    close(fd);
+    return 1;
+#else
+    printf("Watch mode is only supported on Linux\n");
+    return 0;
+#endif
+}
+
+// 库接口调用的开始和结束：消息与结果收集到result，内存模式下只编辑给定的缓冲区
+static void jsondo_api_begin(FileStateTable* files, JsondoBuffer* buffers, int buffer_count, JsondoResult* result) {
+    if (result != NULL) memset(result, 0, sizeof(*result));
+    for (int i = 0; i < buffer_count && buffers != NULL; i++) {
+        buffers[i].output = NULL;
+        buffers[i].output_len = 0;
+    }
+    memset(files, 0, sizeof(*files));
+    files->buffers = buffers;
+    files->buffer_count = (buffers != NULL) ? buffer_count : 0;
+
+    report_state.capture = 1;
+    report_state.result = result;
+    report_begin_batch(NULL);
+}
+
+static int jsondo_api_end(FileStateTable* files, int success) {
+    file_state_table_free(files);
+    report_end_batch(success);
+    report_state.capture = 0;
+    report_state.result = NULL;
+    return success;
+}
+
+int jsondo_apply(const JsondoCommand* commands, int count,
+                 JsondoBuffer* buffers, int buffer_count, JsondoResult* result) {
+    FileStateTable files;
+    jsondo_api_begin(&files, buffers, buffer_count, result);
+
+    CommandSource source = {0};
+    source.structs = commands;
+    source.count = (commands != NULL && count > 0) ? count : 0;
+    int success = run_command_source(&source, &files);
+    return jsondo_api_end(&files, success);
+}
+
+int jsondo_apply_json(const cJSON* root, JsondoBuffer* buffers, int buffer_count, JsondoResult* result) {
+    FileStateTable files;
+    jsondo_api_begin(&files, buffers, buffer_count, result);
+
+    int success = 0;
+    cJSON* commands_array = (root != NULL) ? cJSON_GetObjectItem(root, "commands") : NULL;
+    if (commands_array == NULL || !cJSON_IsArray(commands_array)) {
+        report("Invalid JSON format: missing 'commands' array\n");
+    } else {
+        CommandSource source = {0};
+        source.commands = commands_array;
+        source.count = cJSON_GetArraySize(commands_array);
+        success = run_command_source(&source, &files);
+    }
+    return jsondo_api_end(&files, success);
+}
+
+void jsondo_result_free(JsondoResult* result) {
+    if (result == NULL) return;
+    for (int i = 0; i < result->command_count; i++) {
+        free(result->commands[i].message);
+    }
+    free(result->commands);
+    free(result->message);
+    memset(result, 0, sizeof(*result));
+}
+
+void jsondo_free(void* data) {
+    free(data);
+}
+
+void jsondo_set_output(JsondoOutput output) {
+    report_state.jsonl = (output == JSONDO_OUTPUT_JSONL);
+}
+
+void jsondo_set_diagnose(int candidates) {
+    diagnose_candidates = (candidates > 0) ? candidates : 0;
+}
+
+// 执行命令文件（jsondo -f），全部成功后删除命令文件
+int jsondo_eval_command_file(const char* command_file) {
+    report_begin_batch(command_file);
+    if (!file_exists(command_file)) {
+        report("Command file not found: %s\n", command_file);
+        report_end_batch(0);
+        return 0;
+    }
+
+    char* json_content = read_file(command_file);
+    if (json_content == NULL) {
+        report("Failed to read command file: %s\n", command_file);
+        report_end_batch(0);
+        return 0;
+    }
+
+    report_text("Eval command from %s\n", command_file);
+    int result = eval_command(json_content, command_file);
+    free(json_content);
+
+    report_text("\n");
+    report_end_batch(result == 0);
+    return result == 0;
+}
+
+// 执行统一格式的补丁文件（jsondo -d），补丁文件执行后不删除
+int jsondo_eval_patch_file(const char* patch_file) {
+    report_begin_batch(patch_file);
+    report_text("Eval patch from %s\n", patch_file);
+
+    int success = 0;
+    MappedText map;
+    if (!mapped_text_open(patch_file, &map)) {
+        report("Failed to read patch file: %s\n", patch_file);
+    } else if (memchr(map.data, '\0', map.len) != NULL) {
+        report("Invalid patch file: %s contains NUL bytes\n", patch_file);
+    } else {
+        JsondoCommand command = JSONDO_COMMAND_INIT;
+        command.call = JSONDO_APPLY_PATCH;
+        command.patch = map.data;
+
+        CommandSource source = {0};
+        source.structs = &command;
+        source.count = 1;
+        FileStateTable files = {0};
+        success = run_command_source(&source, &files);
+        file_state_table_free(&files);
+        if (success) {
+            report_text("[OK] All changes from %s are applied.\n", patch_file);
+        }
+    }
+    mapped_text_close(&map);
+
+    report_text("\n");
+    report_end_batch(success);
+    return success;
+}
+
+// 执行编译后的执行计划（jsondo -p）
+int jsondo_eval_plan_file(const char* plan_file) {
+    report_begin_batch(plan_file);
+    report_text("Eval plan from %s\n", plan_file);
+    int result = eval_plan(plan_file);
+    report_text("\n");
+    report_end_batch(result == 0);
+    return result == 0;
+}
+
+int jsondo_compile(const char* command_file, const char* plan_file) {
+    return compile_command_file(command_file, plan_file);
+}
+
+int jsondo_watch(const char* dir) {
+    return watch_directory(dir);
+}
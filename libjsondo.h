@@ -0,0 +1,117 @@
+// libjsondo：jsondo 的编辑引擎，可嵌入其他程序直接调用，
+// 命令可以作用于磁盘上的文件，也可以作用于调用者提供的内存缓冲区
+#ifndef LIBJSONDO_H
+#define LIBJSONDO_H
+
+#include <stddef.h>
+#include "cJSON.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define JSONDO_API __attribute__((visibility("default")))
+#else
+#define JSONDO_API
+#endif
+
+typedef enum {
+    JSONDO_REPLACE_BY_CONTENT = 1,
+    JSONDO_REPLACE_BY_RANGE = 2,
+    JSONDO_REPLACE_BLOCK = 3,
+    JSONDO_APPLY_PATCH = 4,
+    JSONDO_INSERT_LINES = 5,
+    JSONDO_DELETE_LINES = 6,
+    JSONDO_APPEND = 7
+} JsondoCall;
+
+// 一条命令，字段与命令文件中的参数同名；字符串只在调用期间引用，不复制
+typedef struct {
+    JsondoCall call;
+    const char* title;            // 可选
+    const char* file;             // 目标文件，或内存缓冲区的名称
+    const char* old_str;          // replace_by_content
+    const char* new_str;
+    int startLine;                // insert_lines插入的位置（命令文件中为line或startLine），delete_lines删除的第一行
+    int endLine;                  // replace_by_range、delete_lines，-1表示到文件末尾
+    const char* startLine_str;    // replace_by_range
+    const char* endLine_str;      // replace_by_range
+    int backward_scan_limit;
+    int forward_scan_limit;
+    const char* header;           // replace_block，块的开头（一行或多行）
+    const char* patch;            // apply_patch，统一格式补丁，目标文件由补丁给出（file不使用）
+    int strip;                    // apply_patch，去掉路径中的目录层数（同patch -p）
+    const char* guard;            // insert_lines、delete_lines、append，可选的校验行
+} JsondoCommand;
+
+// 与命令文件相同的默认值：扫描范围向前10行、向后15行，补丁路径去掉1层目录
+#define JSONDO_COMMAND_INIT {JSONDO_REPLACE_BY_CONTENT, NULL, NULL, NULL, NULL, 0, -1, NULL, NULL, 10, 15, NULL, NULL, 1, NULL}
+
+// 内存缓冲区：命令的file参数与name相同时编辑该缓冲区，不读写磁盘。
+// 输入内容不会被修改；批次结束后修改过的缓冲区在output中给出新内容（以\0结尾，用jsondo_free释放）
+typedef struct {
+    const char* name;
+    const char* data;
+    size_t len;
+    char* output;                 // 未修改时为NULL
+    size_t output_len;
+} JsondoBuffer;
+
+// 单条命令的执行结果，与 --output jsonl 的命令记录一一对应
+typedef struct {
+    int index;
+    const char* status;           // "applied"、"skipped"或"failed"
+    int start_line;               // 以下在失败时为0
+    int end_line;                 // 被替换的原有行为start_line~end_line；纯插入时与start_line相同
+    int deleted;
+    int inserted;
+    long long bytes_delta;
+    long long time_us;
+    char* message;                // 执行期间的消息，没有时为空字符串
+} JsondoCommandResult;
+
+typedef struct {
+    int success;
+    int applied;
+    int skipped;
+    int failed;
+    JsondoCommandResult* commands;  // 已执行（含失败）的命令，失败后的命令不执行
+    int command_count;
+    char* message;                // 命令之外的消息（如参数错误、写回失败）
+    long long time_us;
+} JsondoResult;
+
+// 执行一批命令，成功返回1，失败返回0。buffers为NULL时作用于磁盘上的文件
+// （与命令行相同：加锁、备份、账本），否则只编辑给定的缓冲区。
+// result可以为NULL；不为NULL时需用jsondo_result_free释放。执行期间不向stdout输出
+JSONDO_API int jsondo_apply(const JsondoCommand* commands, int count,
+                            JsondoBuffer* buffers, int buffer_count, JsondoResult* result);
+
+// 同上，命令取自已解析的命令文件（含"commands"数组的对象）
+JSONDO_API int jsondo_apply_json(const cJSON* root, JsondoBuffer* buffers, int buffer_count,
+                                 JsondoResult* result);
+
+JSONDO_API void jsondo_result_free(JsondoResult* result);
+JSONDO_API void jsondo_free(void* data);
+
+// 以下为命令行使用的接口，结果输出到stdout，成功返回1，失败返回0
+typedef enum {
+    JSONDO_OUTPUT_TEXT = 0,
+    JSONDO_OUTPUT_JSONL = 1
+} JsondoOutput;
+
+JSONDO_API void jsondo_set_output(JsondoOutput output);
+// 查找失败时在整个文件中近似查找，列出最接近的candidates处及逐行差异；0表示关闭（默认）
+JSONDO_API void jsondo_set_diagnose(int candidates);
+JSONDO_API int jsondo_eval_command_file(const char* command_file);  // 全部成功后删除命令文件
+JSONDO_API int jsondo_eval_plan_file(const char* plan_file);
+JSONDO_API int jsondo_eval_patch_file(const char* patch_file);     // 补丁文件不删除
+JSONDO_API int jsondo_compile(const char* command_file, const char* plan_file);
+JSONDO_API int jsondo_watch(const char* dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,346 @@
+// 回归用例：通过 libjsondo 的内存缓冲区接口执行命令，比较输出与期望内容（账本用例在临时目录中作用于磁盘上的文件）
+// 用法：tests/regress，全部通过返回0
+#define _GNU_SOURCE   // nftw
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include "libjsondo.h"
+
+#define CASE_FILE "f.c"
+#define CASE_OTHERS 2
+
+// 除CASE_FILE之外的缓冲区
+typedef struct {
+    const char* name;       // 为NULL时不使用
+    const char* input;
+    const char* expected;
+} RegressFile;
+
+typedef struct {
+    const char* name;
+    const char* input;
+    const char* commands;   // 命令文件的内容，file参数为CASE_FILE
+    const char* expected;   // 期望的输出；为NULL时期望命令失败且内容不变
+    int start_line;         // 不为0时校验最后一条命令结果的start_line/end_line
+    int end_line;
+    RegressFile others[CASE_OTHERS];
+} RegressCase;
+
+static const RegressCase cases[] = {
+    // replace_block：'}'之后同一行的内容保留
+    {"block_else_tail",
+     "int f(int x) {\n  if (x) {\n    a();\n  } else {\n    b();\n  }\n}\n",
+     "{\"commands\":[{\"call\":\"replace_block\",\"args\":{\"file\":\"f.c\",\"header\":\"if (x) {\","
+     "\"new_str\":\"  if (y) {\\n    c();\\n  }\"}}]}",
+     "int f(int x) {\n  if (y) {\n    c();\n  } else {\n    b();\n  }\n}\n"},
+    {"block_semicolon_comment_tail",
+     "struct S {\n  int a;\n}; // end\nint g;\n",
+     "{\"commands\":[{\"call\":\"replace_block\",\"args\":{\"file\":\"f.c\",\"header\":\"struct S {\","
+     "\"new_str\":\"struct S {\\n  long a;\\n}\\n\"}}]}",
+     "struct S {\n  long a;\n}; // end\nint g;\n"},
+    {"block_comma_tail_crlf",
+     "int a[] = {\r\n  1\r\n}, b[] = {\r\n  2\r\n};\r\n",
+     "{\"commands\":[{\"call\":\"replace_block\",\"args\":{\"file\":\"f.c\",\"header\":\"int a[] = {\","
+     "\"new_str\":\"int a[] = {\\n  3\\n}\"}}]}",
+     "int a[] = {\r\n  3\r\n}, b[] = {\r\n  2\r\n};\r\n"},
+    {"block_whole_lines",
+     "void f() {\n  a();\n}  \nint g;\n",
+     "{\"commands\":[{\"call\":\"replace_block\",\"args\":{\"file\":\"f.c\",\"header\":\"void f() {\","
+     "\"new_str\":\"void f() {\\n  b();\\n}\"}}]}",
+     "void f() {\n  b();\n}\nint g;\n"},
+    // replace_by_range：行号小于1时失败，不读取扫描窗口之外的行
+    {"range_start_line_zero",
+     "a\nb\n",
+     "{\"commands\":[{\"call\":\"replace_by_range\",\"args\":{\"file\":\"f.c\",\"startLine\":0,\"endLine\":0,"
+     "\"startLine_str\":\"zz\",\"endLine_str\":\"zz\",\"new_str\":\"x\"}}]}",
+     NULL},
+    // insert_lines：命令文件中也接受startLine；纯插入的结果范围起止均为插入位置
+    {"insert_start_line_alias",
+     "a\nb\nc\n",
+     "{\"commands\":[{\"call\":\"insert_lines\",\"args\":{\"file\":\"f.c\",\"startLine\":3,\"new_str\":\"x\"}}]}",
+     "a\nb\nx\nc\n", 3, 3},
+    {"append_range",
+     "a\nb\n",
+     "{\"commands\":[{\"call\":\"append\",\"args\":{\"file\":\"f.c\",\"new_str\":\"z\"}}]}",
+     "a\nb\nz\n", 3, 3},
+    // 一个补丁修改多个文件，之后还有其他命令：目标文件列表超过命令数时扩容
+    {"patch_three_files_then_commands",
+     "a\nb\nc\n",
+     "{\"commands\":["
+     "{\"call\":\"apply_patch\",\"args\":{\"patch\":"
+     "\"--- a/f.c\\n+++ b/f.c\\n@@ -1,2 +1,2 @@\\n a\\n-b\\n+B\\n"
+     "--- a/g.c\\n+++ b/g.c\\n@@ -1 +1 @@\\n-g\\n+G\\n"
+     "--- a/h.c\\n+++ b/h.c\\n@@ -1 +1 @@\\n-h\\n+H\\n\"}},"
+     "{\"call\":\"replace_by_content\",\"args\":{\"file\":\"f.c\",\"old_str\":\"a\",\"new_str\":\"A\"}},"
+     "{\"call\":\"replace_by_content\",\"args\":{\"file\":\"f.c\",\"old_str\":\"c\",\"new_str\":\"C\"}}]}",
+     "A\nB\nC\n", 0, 0,
+     {{"g.c", "g\n", "G\n"}, {"h.c", "h\n", "H\n"}}},
+    // 同一文件的多条编辑乱序给出，行号均为原始行号且扫描范围为0：删除之后的行号仍须换算到正确位置
+    {"remap_after_delete",
+     "L1\nL2\nL3\nL4\nL5\nL6\nL7\nL8\nL9\nL10\nL11\nL12\n",
+     "{\"commands\":["
+     "{\"call\":\"delete_lines\",\"args\":{\"file\":\"f.c\",\"startLine\":3,\"endLine\":6}},"
+     "{\"call\":\"replace_by_range\",\"args\":{\"file\":\"f.c\",\"startLine\":10,\"endLine\":10,"
+     "\"startLine_str\":\"L10\",\"endLine_str\":\"L10\",\"new_str\":\"A\\nB\\nC\","
+     "\"backward_scan_limit\":0,\"forward_scan_limit\":0}},"
+     "{\"call\":\"insert_lines\",\"args\":{\"file\":\"f.c\",\"line\":8,\"new_str\":\"INS\"}}]}",
+     "L1\nL2\nL7\nINS\nL8\nL9\nA\nB\nC\nL11\nL12\n"},
+    {"remap_shuffled",
+     "L1\nL2\nL3\nL4\nL5\nL6\nL7\nL8\nL9\nL10\nL11\nL12\n",
+     "{\"commands\":["
+     "{\"call\":\"replace_by_range\",\"args\":{\"file\":\"f.c\",\"startLine\":9,\"endLine\":10,"
+     "\"startLine_str\":\"L9\",\"endLine_str\":\"L10\",\"new_str\":\"X\","
+     "\"backward_scan_limit\":0,\"forward_scan_limit\":0}},"
+     "{\"call\":\"delete_lines\",\"args\":{\"file\":\"f.c\",\"startLine\":2,\"endLine\":4,\"guard\":\"L2\","
+     "\"backward_scan_limit\":0,\"forward_scan_limit\":0}},"
+     "{\"call\":\"insert_lines\",\"args\":{\"file\":\"f.c\",\"line\":6,\"new_str\":\"Y\"}},"
+     "{\"call\":\"replace_by_range\",\"args\":{\"file\":\"f.c\",\"startLine\":12,\"endLine\":12,"
+     "\"startLine_str\":\"L12\",\"endLine_str\":\"L12\",\"new_str\":\"Z1\\nZ2\","
+     "\"backward_scan_limit\":0,\"forward_scan_limit\":0}},"
+     "{\"call\":\"delete_lines\",\"args\":{\"file\":\"f.c\",\"startLine\":7,\"endLine\":7,\"guard\":\"L7\","
+     "\"backward_scan_limit\":0,\"forward_scan_limit\":0}},"
+     "{\"call\":\"replace_by_range\",\"args\":{\"file\":\"f.c\",\"startLine\":5,\"endLine\":5,"
+     "\"startLine_str\":\"L5\",\"endLine_str\":\"L5\",\"new_str\":\"F\","
+     "\"backward_scan_limit\":0,\"forward_scan_limit\":0}}]}",
+     "L1\nF\nY\nL6\nL8\nX\nL11\nZ1\nZ2\n"},
+};
+
+// 以解析好的命令执行一个用例，通过返回1
+static int run_case_json(const RegressCase* c, cJSON* root) {
+    JsondoBuffer buffers[1 + CASE_OTHERS] = {{CASE_FILE, c->input, strlen(c->input), NULL, 0}};
+    int buffer_count = 1;
+    for (int i = 0; i < CASE_OTHERS && c->others[i].name != NULL; i++) {
+        JsondoBuffer other = {c->others[i].name, c->others[i].input, strlen(c->others[i].input), NULL, 0};
+        buffers[buffer_count++] = other;
+    }
+    JsondoResult result;
+    int success = jsondo_apply_json(root, buffers, buffer_count, &result);
+
+    const char* output = (buffers[0].output != NULL) ? buffers[0].output : c->input;
+    int passed = 0;
+    if (c->expected == NULL) {
+        passed = !success && strcmp(output, c->input) == 0;
+    } else {
+        passed = success && strcmp(output, c->expected) == 0;
+    }
+    for (int i = 1; i < buffer_count && passed; i++) {
+        const RegressFile* other = &c->others[i - 1];
+        const char* other_output = (buffers[i].output != NULL) ? buffers[i].output : other->input;
+        if (other->expected != NULL && strcmp(other_output, other->expected) != 0) {
+            printf("FAIL %s: %s is %s", c->name, other->name, other_output);
+            passed = 0;
+        }
+    }
+    if (passed && c->start_line != 0) {
+        const JsondoCommandResult* last = &result.commands[result.command_count - 1];
+        if (last->start_line != c->start_line || last->end_line != c->end_line) {
+            printf("FAIL %s: range %d-%d, expected %d-%d\n", c->name, last->start_line, last->end_line,
+                   c->start_line, c->end_line);
+            passed = 0;
+        }
+    }
+    if (!passed) {
+        printf("FAIL %s: %s\n", c->name, success ? "applied" : "failed");
+        for (int i = 0; i < result.command_count; i++) {
+            if (result.commands[i].message[0] != '\0') printf("  %s", result.commands[i].message);
+        }
+        if (result.message != NULL && result.message[0] != '\0') printf("  %s", result.message);
+        printf("  expected: %s\n  actual:   %s\n", c->expected ? c->expected : "(unchanged, failed)", output);
+    }
+    for (int i = 0; i < buffer_count; i++) jsondo_free(buffers[i].output);
+    jsondo_result_free(&result);
+    return passed;
+}
+
+// 执行一个用例，通过返回1
+static int run_case(const RegressCase* c) {
+    cJSON* root = cJSON_Parse(c->commands);
+    if (root == NULL) {
+        printf("FAIL %s: invalid command JSON\n", c->name);
+        return 0;
+    }
+    int passed = run_case_json(c, root);
+    cJSON_Delete(root);
+    return passed;
+}
+
+// 大文件上的乱序编辑：编辑跨越多个行号索引步长，行号均为原始行号且扫描范围为0
+#define LARGE_LINES 5000
+
+typedef struct {
+    const char* call;
+    int start;              // 原始行号；insert_lines插在该行之前
+    int end;                // insert_lines为0
+    const char* new_str;    // delete_lines为NULL
+} LargeEdit;
+
+// 按原始行号排列，执行顺序见large_order
+static const LargeEdit large_edits[] = {
+    {"replace_by_range", 20, 20, "R20a\nR20b\nR20c"},
+    {"delete_lines", 1000, 2100, NULL},
+    {"replace_by_range", 2101, 2101, "R2101"},
+    {"insert_lines", 2200, 0, "I2200"},
+    {"delete_lines", 2500, 2500, NULL},
+    {"insert_lines", 3000, 0, "I3000a\nI3000b"},
+    {"replace_by_range", 4100, 4101, "R4100"},
+    {"replace_by_range", 4999, 5000, "END"},
+};
+static const int large_order[] = {6, 1, 5, 0, 4, 7, 3, 2};
+
+// 追加一行（text可含换行符）
+static void large_append(char* buffer, size_t* len, const char* text) {
+    size_t n = strlen(text);
+    memcpy(buffer + *len, text, n);
+    buffer[*len + n] = '\n';
+    *len += n + 1;
+    buffer[*len] = '\0';
+}
+
+static int run_large_case(void) {
+    int edit_count = (int)(sizeof(large_edits) / sizeof(large_edits[0]));
+    size_t capacity = LARGE_LINES * 8 + 256;
+    char* input = (char*)malloc(capacity);
+    char* expected = (char*)malloc(capacity);
+    size_t input_len = 0, expected_len = 0;
+
+    char line[32];
+    int edit = 0;
+    for (int i = 1; i <= LARGE_LINES; i++) {
+        snprintf(line, sizeof(line), "L%d", i);
+        large_append(input, &input_len, line);
+        if (edit < edit_count && large_edits[edit].start == i && large_edits[edit].end == 0) {
+            large_append(expected, &expected_len, large_edits[edit++].new_str);
+        }
+        const LargeEdit* e = (edit < edit_count) ? &large_edits[edit] : NULL;
+        if (e != NULL && e->start <= i && i <= e->end) {
+            if (i == e->start && e->new_str != NULL) large_append(expected, &expected_len, e->new_str);
+            if (i == e->end) edit++;
+            continue;
+        }
+        large_append(expected, &expected_len, line);
+    }
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON* commands = cJSON_AddArrayToObject(root, "commands");
+    for (int i = 0; i < edit_count; i++) {
+        const LargeEdit* e = &large_edits[large_order[i]];
+        cJSON* command = cJSON_CreateObject();
+        cJSON* args = cJSON_CreateObject();
+        cJSON_AddStringToObject(command, "call", e->call);
+        cJSON_AddItemToObject(command, "args", args);
+        cJSON_AddItemToArray(commands, command);
+        cJSON_AddStringToObject(args, "file", CASE_FILE);
+        cJSON_AddNumberToObject(args, "startLine", e->start);
+        if (e->new_str != NULL) cJSON_AddStringToObject(args, "new_str", e->new_str);
+        if (e->end == 0) continue;
+
+        cJSON_AddNumberToObject(args, "endLine", e->end);
+        snprintf(line, sizeof(line), "L%d", e->start);
+        cJSON_AddStringToObject(args, (e->new_str != NULL) ? "startLine_str" : "guard", line);
+        if (e->new_str != NULL) {
+            snprintf(line, sizeof(line), "L%d", e->end);
+            cJSON_AddStringToObject(args, "endLine_str", line);
+        }
+        cJSON_AddNumberToObject(args, "backward_scan_limit", 0);
+        cJSON_AddNumberToObject(args, "forward_scan_limit", 0);
+    }
+
+    RegressCase c = {"remap_large_shuffled", input, NULL, expected, 0, 0, {{NULL, NULL, NULL}}};
+    int passed = run_case_json(&c, root);
+    cJSON_Delete(root);
+    free(input);
+    free(expected);
+    return passed;
+}
+
+// 磁盘上的账本重放（内存模式不使用账本），在临时目录中执行：
+// 批次A将x、y改为2，批次B改回1；之后再次执行A时必须重新执行而不是按账本跳过，第四次才跳过
+typedef struct {
+    const char* commands;
+    const char* status;     // 每条命令的期望状态
+    const char* expected;   // 执行后的文件内容
+} LedgerStep;
+
+#define LEDGER_BATCH_A \
+    "{\"commands\":[{\"call\":\"replace_by_content\",\"args\":{\"file\":\"f.c\",\"old_str\":\"x = 1\",\"new_str\":\"x = 2\"}}," \
+    "{\"call\":\"replace_by_content\",\"args\":{\"file\":\"f.c\",\"old_str\":\"y = 1\",\"new_str\":\"y = 2\"}}]}"
+#define LEDGER_BATCH_B \
+    "{\"commands\":[{\"call\":\"replace_by_content\",\"args\":{\"file\":\"f.c\",\"old_str\":\"x = 2\",\"new_str\":\"x = 1\"}}," \
+    "{\"call\":\"replace_by_content\",\"args\":{\"file\":\"f.c\",\"old_str\":\"y = 2\",\"new_str\":\"y = 1\"}}]}"
+
+static const LedgerStep ledger_steps[] = {
+    {LEDGER_BATCH_A, "applied", "x = 2\ny = 2\n"},
+    {LEDGER_BATCH_B, "applied", "x = 1\ny = 1\n"},
+    {LEDGER_BATCH_A, "applied", "x = 2\ny = 2\n"},
+    {LEDGER_BATCH_A, "skipped", "x = 2\ny = 2\n"},
+};
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    return remove(path);
+}
+
+static int run_ledger_case(void) {
+    char dir[] = "/tmp/jsondo-regress-XXXXXX";
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        printf("FAIL ledger_cycle_replay: cannot create %s\n", dir);
+        return 0;
+    }
+
+    FILE* fp = fopen(CASE_FILE, "w");
+    if (fp != NULL) {
+        fputs("x = 1\ny = 1\n", fp);
+        fclose(fp);
+    }
+
+    int passed = (fp != NULL);
+    int step_count = (int)(sizeof(ledger_steps) / sizeof(ledger_steps[0]));
+    for (int i = 0; i < step_count && passed; i++) {
+        const LedgerStep* step = &ledger_steps[i];
+        cJSON* root = cJSON_Parse(step->commands);
+        JsondoResult result;
+        int success = jsondo_apply_json(root, NULL, 0, &result);
+        cJSON_Delete(root);
+
+        char content[64] = "";
+        fp = fopen(CASE_FILE, "r");
+        if (fp != NULL) {
+            content[fread(content, 1, sizeof(content) - 1, fp)] = '\0';
+            fclose(fp);
+        }
+        passed = success && strcmp(content, step->expected) == 0;
+        for (int j = 0; j < result.command_count; j++) {
+            if (strcmp(result.commands[j].status, step->status) != 0) passed = 0;
+        }
+        if (!passed) {
+            printf("FAIL ledger_cycle_replay: step %d %s, expected %s\n", i + 1, success ? "applied" : "failed",
+                   step->status);
+            for (int j = 0; j < result.command_count; j++) {
+                const JsondoCommandResult* command = &result.commands[j];
+                printf("  %s%s%s", command->status, command->message[0] ? ": " : "\n", command->message);
+            }
+            printf("  expected: %s\n  actual:   %s\n", step->expected, content);
+        }
+        jsondo_result_free(&result);
+    }
+
+    if (chdir(cwd) != 0) passed = 0;
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return passed;
+}
+
+int main(void) {
+    int count = (int)(sizeof(cases) / sizeof(cases[0]));
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (!run_case(&cases[i])) failed++;
+    }
+    count++;
+    if (!run_large_case()) failed++;
+    count++;
+    if (!run_ledger_case()) failed++;
+    printf("%d/%d cases passed\n", count - failed, count);
+    return failed ? 1 : 0;
+}